@@ -23,6 +23,12 @@
 #define FTY_COMMON_NUT_CONVERT_H_INCLUDED
 
 #include "fty_common_nut_library.h"
+#include "fty_common_nut_parse.h"
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace fty {
 namespace nut {
@@ -30,6 +36,307 @@ namespace nut {
 KeyValues performMapping(const KeyValues &mapping, const KeyValues &values, int daisychain);
 KeyValues loadMapping(const std::string &file, const std::string &type);
 
+/**
+ * \brief Perform mapping on values classified by type, keeping their classification.
+ * \param mapping Mapping.
+ * \param values Typed values to map.
+ * \param daisychain Daisy-chain index of device (0 if not daisy-chained).
+ * \return Typed mapped values.
+ */
+TypedKeyValues performMapping(const KeyValues &mapping, const TypedKeyValues &values, int daisychain);
+
+/**
+ * \brief Perform mapping on interned data.
+ *
+ * Mapping and values must be interned in the same pool, which is used to look
+ * up the composite keys of daisy-chain and override rules.
+ *
+ * \param mapping Interned mapping.
+ * \param values Interned values to map.
+ * \param daisychain Daisy-chain index of device (0 if not daisy-chained).
+ * \param pool String pool of mapping and values.
+ * \return Interned mapped values.
+ */
+InternedKeyValues performMapping(const InternedKeyValues &mapping, const InternedKeyValues &values, int daisychain, const StringPool &pool);
+PooledKeyValues performMapping(const InternedKeyValues &mapping, const PooledKeyValues &values, int daisychain, const StringPool &pool);
+
+/**
+ * \brief Load a mapping, interning its keys and values.
+ * \param file Mapping file.
+ * \param type Mapping type.
+ * \param pool String pool to intern into.
+ * \return Interned mapping.
+ * \throw std::runtime_error if the mapping can't be loaded.
+ */
+InternedKeyValues loadMapping(const std::string &file, const std::string &type, StringPool &pool);
+
+/**
+ * \brief Mapping entries, in file order.
+ */
+using MappingEntries = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * \brief Load several mapping types of a mapping file from a single parse.
+ *
+ * Entries are in file order, with templates left unexpanded. When several
+ * members have the same name, only the first one counts, like loadMapping().
+ *
+ * \param file Mapping file.
+ * \param types Mapping types to load. If empty, all members of the file which are JSON objects are loaded, even empty ones.
+ * \return Entries of each loaded mapping type.
+ * \throw std::runtime_error if the file can't be parsed, or a requested type is missing, not a JSON object or empty.
+ */
+std::map<std::string, MappingEntries> loadMappingFile(const std::string &file, const std::vector<std::string> &types = {});
+
+/**
+ * \brief Statistics of mapping calls with a compiled mapping.
+ *
+ * Every NUT variable walked is either mapped, unmapped (no entry, or mapped
+ * to an empty key) or dropped by an override. For performDaisychainMapping(),
+ * host device variables are mapped or dropped once per member.
+ */
+struct MappingStatistics
+{
+    static const size_t latencyBuckets = 32;
+
+    /// Number of mapping calls.
+    uint64_t calls = 0;
+    /// Number of NUT variables walked.
+    uint64_t seen = 0;
+    uint64_t mapped = 0;
+    uint64_t unmapped = 0;
+    /// Host device variables dropped for a "device.<id>.<property>" variable of the member.
+    uint64_t daisychainOverridden = 0;
+    /// Variables dropped for "input.L1.current" (3-phase UPS).
+    uint64_t threePhaseOverridden = 0;
+    /// Number of calls by duration, bucket N counting calls of 2^N to 2^(N+1)-1 ns (bucket 0 also counts 0 ns).
+    uint64_t latency[latencyBuckets] = {};
+};
+
+/**
+ * \brief Immutable mapping compiled into flat hash tables.
+ *
+ * Keys and mapped keys are stored in a single string table, indexed by
+ * open-addressing hash tables keyed both by NUT variable name and by property
+ * name of "device.<property>" keys. Daisy-chain and 3-phase override rules are
+ * resolved at compile time, so that mapping a value is a hash lookup which
+ * doesn't allocate. Copies share the compiled data.
+ *
+ * Template entries (with a '#' placeholder in both key and mapped key) are
+ * kept as patterns and match any index without leading zero, instead of being
+ * instanciated for indexes 1 to 98.
+ */
+class CompiledMapping
+{
+public:
+    struct Data;
+
+    CompiledMapping();
+
+    /**
+     * \brief Compile a regular mapping, where '#' has no special meaning.
+     */
+    explicit CompiledMapping(const KeyValues &mapping);
+
+    /**
+     * \brief Compile mapping entries, keeping templates as patterns.
+     *
+     * When several entries match a key, the earliest one wins.
+     */
+    explicit CompiledMapping(const MappingEntries &mapping);
+
+    /**
+     * \brief Look up the mapped key of a NUT variable.
+     * \param key NUT variable.
+     * \param length Length of NUT variable.
+     * \param mappedKey Set to the mapped key if found.
+     * \return True if the variable is mapped.
+     */
+    bool find(const char *key, size_t length, std::string &mappedKey) const;
+    bool find(const std::string &key, std::string &mappedKey) const { return find(key.data(), key.size(), mappedKey); }
+
+    /**
+     * \brief Number of entries, templates counting as one.
+     */
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+
+    /**
+     * \brief Convert back to a regular mapping, instanciating templates for indexes 1 to 98 like loadMapping().
+     */
+    KeyValues toKeyValues() const;
+
+    /**
+     * \brief Statistics of mapping calls since compilation or last reset, shared by copies.
+     *
+     * Counters are updated with relaxed atomic operations once per call, so
+     * a snapshot taken during concurrent calls may be slightly inconsistent.
+     * Only performMapping() and performDaisychainMapping() calls are counted:
+     * mapping through a MappingPlan (and so MappingPlanCache and DeltaMapper)
+     * doesn't look up the mapping and bypasses statistics.
+     */
+    MappingStatistics statistics() const;
+    void resetStatistics() const;
+
+private:
+    explicit CompiledMapping(std::shared_ptr<const Data> data);
+
+    /**
+     * \brief Perform mapping like performMapping(), without recording it in the statistics.
+     */
+    KeyValues resolve(const KeyValues &values, int daisychain) const;
+
+    std::shared_ptr<const Data> m_data;
+
+    friend class MappingPlan;
+    friend class ReverseMapping;
+    friend CompiledMapping loadCompiledMapping(const std::string &file, const std::string &type, const std::string &image);
+
+    friend KeyValues performMapping(const CompiledMapping &mapping, const KeyValues &values, int daisychain);
+    friend TypedKeyValues performMapping(const CompiledMapping &mapping, const TypedKeyValues &values, int daisychain);
+    friend std::vector<KeyValues> performDaisychainMapping(const CompiledMapping &mapping, const KeyValues &values);
+    friend std::vector<TypedKeyValues> performDaisychainMapping(const CompiledMapping &mapping, const TypedKeyValues &values);
+};
+
+/**
+ * \brief Index from mapped keys back to the NUT variables that feed them.
+ *
+ * Template entries are indexed by mapped key pattern, so that looking up an
+ * instance doesn't depend on the number of instances. Candidates are checked
+ * against the forward mapping, so that results follow the same precedence,
+ * daisy-chain folding and template rules as performMapping().
+ */
+class ReverseMapping
+{
+public:
+    ReverseMapping();
+    explicit ReverseMapping(const CompiledMapping &mapping);
+
+    /**
+     * \brief Look up the NUT variables mapped to a key.
+     *
+     * For a daisy-chained device, both its own variables ("device.<id>.<property>")
+     * and the host device variables they may override are returned.
+     *
+     * \param mappedKey Mapped key.
+     * \param daisychain Daisy-chain index of device (0 if not daisy-chained).
+     * \return NUT variables mapped to the key, sorted.
+     */
+    std::vector<std::string> find(const std::string &mappedKey, int daisychain = 0) const;
+
+private:
+    std::shared_ptr<const CompiledMapping::Data> m_data;
+    /// Entries by mapped key, for regular entries, and by mapped key pattern, for templates.
+    std::unordered_map<std::string, std::vector<uint32_t>> m_keys;
+    std::unordered_map<std::string, std::vector<uint32_t>> m_templates;
+};
+
+/**
+ * \brief Load a mapping and index it by mapped key.
+ * \param file Mapping file.
+ * \param type Mapping type.
+ * \return Reverse mapping.
+ * \throw std::runtime_error if the mapping can't be loaded.
+ */
+ReverseMapping loadReverseMapping(const std::string &file, const std::string &type);
+
+/**
+ * \brief Perform mapping with a compiled mapping.
+ *
+ * Results are identical to performMapping() with the mapping it was compiled
+ * from (or, for templates, with their instances).
+ *
+ * \param mapping Compiled mapping.
+ * \param values Values to map.
+ * \param daisychain Daisy-chain index of device (0 if not daisy-chained).
+ * \return Mapped values.
+ */
+KeyValues performMapping(const CompiledMapping &mapping, const KeyValues &values, int daisychain);
+TypedKeyValues performMapping(const CompiledMapping &mapping, const TypedKeyValues &values, int daisychain);
+
+/**
+ * \brief Perform mapping of all members of a daisy-chain at once.
+ *
+ * The values are walked once: properties of daisy-chained devices
+ * ("device.<id>.<property>") are mapped for their member only, host device
+ * properties for all members, subject to the same override rules. Results are
+ * identical to performMapping() called for each member.
+ *
+ * The number of members is read from "device.count", or else is the highest
+ * daisy-chain index seen (up to 1024).
+ *
+ * \param mapping Mapping (compiled on each call for the KeyValues overload).
+ * \param values Values of the whole daisy-chain.
+ * \return Mapped values of each member, member N at index N-1.
+ */
+std::vector<KeyValues> performDaisychainMapping(const CompiledMapping &mapping, const KeyValues &values);
+std::vector<TypedKeyValues> performDaisychainMapping(const CompiledMapping &mapping, const TypedKeyValues &values);
+std::vector<KeyValues> performDaisychainMapping(const KeyValues &mapping, const KeyValues &values);
+
+/**
+ * \brief Input of batch mapping: values of a device and its daisy-chain index.
+ */
+struct MappingInput
+{
+    const KeyValues *values;
+    int daisychain;
+};
+
+/**
+ * \brief Perform mapping of many devices in parallel.
+ *
+ * Inputs are shared among the calling thread and up to threads - 1 worker
+ * threads, which take chunks of inputs from a common cursor until none are
+ * left, so that faster threads take over the work of slower ones.
+ *
+ * \param mapping Compiled mapping.
+ * \param inputs Inputs to map.
+ * \param count Number of inputs.
+ * \param threads Maximum number of threads (0 for the number of cores).
+ * \return Mapped values of each input, in input order.
+ */
+std::vector<KeyValues> performBatchMapping(const CompiledMapping &mapping, const MappingInput *inputs, size_t count, unsigned threads = 0);
+std::vector<KeyValues> performBatchMapping(const CompiledMapping &mapping, const std::vector<MappingInput> &inputs, unsigned threads = 0);
+
+/**
+ * \brief Load and compile a mapping, keeping templates as patterns.
+ * \param file Mapping file.
+ * \param type Mapping type.
+ * \return Compiled mapping.
+ * \throw std::runtime_error if the mapping can't be loaded.
+ */
+CompiledMapping loadCompiledMapping(const std::string &file, const std::string &type);
+
+/**
+ * \brief Compile all mapping types of a mapping file into a binary image.
+ *
+ * The image holds the string table, hash tables and template patterns of
+ * each non-empty mapping type, laid out so that it can be memory-mapped and
+ * used as is. It records the size and hash of the mapping file, to detect
+ * stale images. Images are in host byte order and aren't portable.
+ *
+ * \param file Mapping file.
+ * \param image Path of image to write (replaced atomically).
+ * \throw std::runtime_error if the mapping file can't be loaded or the image can't be written.
+ */
+void compileMappingImage(const std::string &file, const std::string &image);
+
+/**
+ * \brief Load a compiled mapping from a binary image, falling back to the mapping file.
+ *
+ * The image is memory-mapped and used without copying its entries. If it is
+ * missing, invalid, stale (the mapping file changed since it was compiled)
+ * or lacks the mapping type, the mapping file is loaded instead. If the
+ * mapping file is missing, a valid image is used as is.
+ *
+ * \param file Mapping file.
+ * \param type Mapping type.
+ * \param image Binary image of mapping file.
+ * \return Compiled mapping.
+ * \throw std::runtime_error if the mapping can't be loaded.
+ */
+CompiledMapping loadCompiledMapping(const std::string &file, const std::string &type, const std::string &image);
+
 }
 }
 
@@ -0,0 +1,115 @@
+/*  =========================================================================
+    fty_common_nut_delta - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_delta -
+@discuss
+@end
+*/
+
+#ifndef FTY_COMMON_NUT_DELTA_H_INCLUDED
+#define FTY_COMMON_NUT_DELTA_H_INCLUDED
+
+#include "fty_common_nut_library.h"
+#include "fty_common_nut_convert.h"
+
+namespace fty {
+namespace nut {
+
+/**
+ * \brief Changes of mapped values between two polls.
+ */
+struct MappingDelta
+{
+    /// Mapped values which appeared.
+    KeyValues added;
+    /// Mapped values whose value changed, with their new value.
+    KeyValues changed;
+    /// Mapped keys which disappeared.
+    std::vector<std::string> removed;
+
+    bool empty() const { return added.empty() && changed.empty() && removed.empty(); }
+};
+
+/**
+ * \brief Stateful mapper of the successive dumps of one device.
+ *
+ * Each update maps the new dump and returns only the mapped values added,
+ * changed or removed since the previous update. As long as a dump has the
+ * same set of NUT variables as the previous one, the outcome of the mapping
+ * (which variable yields which mapped key, after daisy-chain and 3-phase
+ * overrides) is reused and only changed values are looked at.
+ *
+ * Mappers can be moved but not copied, as they point into their own state.
+ */
+class DeltaMapper
+{
+public:
+    /**
+     * \param mapping Compiled mapping.
+     * \param daisychain Daisy-chain index of device (0 if not daisy-chained).
+     */
+    DeltaMapper(const CompiledMapping &mapping, int daisychain);
+
+    DeltaMapper(const DeltaMapper&) = delete;
+    DeltaMapper& operator=(const DeltaMapper&) = delete;
+    /// Moving maps keeps pointers to their elements valid.
+    DeltaMapper(DeltaMapper&&) = default;
+    DeltaMapper& operator=(DeltaMapper&&) = default;
+
+    /**
+     * \brief Map a new dump of the device.
+     * \param values Values of the device, as parsed from its dump.
+     * \return Changes of mapped values since the previous update (or since construction/reset).
+     */
+    MappingDelta update(const KeyValues &values);
+
+    /**
+     * \brief Current mapped values, identical to performMapping() of the last dump.
+     */
+    const KeyValues& state() const { return m_state; }
+
+    /**
+     * \brief Forget the previous dump, so that the next update reports all mapped values as added.
+     */
+    void reset();
+
+private:
+    void rebuild(const KeyValues &values, MappingDelta &delta);
+
+    CompiledMapping m_mapping;
+    int m_daisychain;
+    /// Last dump.
+    KeyValues m_values;
+    /// Mapped values.
+    KeyValues m_state;
+    /// Mapped value produced by each variable of the last dump, in order (nullptr if none).
+    std::vector<KeyValues::value_type *> m_plan;
+};
+
+}
+}
+
+//  Self test of this class
+void fty_common_nut_delta_test(bool verbose);
+
+#endif
@@ -30,10 +30,127 @@
 #define FTY_COMMON_NUT_DUMP_H_INCLUDED
 
 #include "fty_common_nut_library.h"
+#include "fty_common_nut_convert.h"
+#include "fty_common_nut_parse.h"
+
+#include <chrono>
+#include <future>
+#include <set>
 
 namespace fty {
 namespace nut {
 
+/**
+ * \brief Outcome of an asynchronous dump.
+ */
+enum class DumpStatus
+{
+    /// Driver exited by itself.
+    Completed,
+    /// Driver couldn't be started.
+    FailedToStart,
+    /// Driver was terminated on deadline.
+    TimedOut,
+    /// Driver was terminated on cancellation.
+    Cancelled
+};
+
+/**
+ * \brief Result of an asynchronous dump.
+ */
+struct DumpResult
+{
+    DumpStatus status = DumpStatus::FailedToStart;
+    /// Return code of driver.
+    int returnCode = -1;
+    /// Data returned by driver (until termination, if terminated).
+    KeyValues values;
+};
+
+/**
+ * \brief Callback fired once a dump has finished.
+ *
+ * It is fired from the event loop thread of the library, which supervises all
+ * dumps in flight, so it must not block.
+ */
+using DumpCompletion = std::function<void(const DumpResult& result)>;
+
+/**
+ * \brief Handle on an asynchronous dump, to wait for or cancel it.
+ */
+class DumpHandle
+{
+public:
+    DumpHandle() = default;
+
+    /**
+     * \brief Cancel dump, terminating driver if still running.
+     *
+     * Result is reported with status DumpStatus::Cancelled, unless the dump
+     * had already finished.
+     */
+    void cancel();
+
+    bool finished() const;
+
+    /**
+     * \brief Wait for dump to finish.
+     * \return Result of dump.
+     */
+    const DumpResult& wait() const;
+
+    /**
+     * \brief Future result of dump.
+     */
+    std::shared_future<DumpResult> result() const { return m_result; }
+
+private:
+    struct Task;
+
+    DumpHandle(std::shared_ptr<Task> task);
+
+    friend DumpHandle dumpDeviceAsync(
+        const std::string& driver,
+        const std::string& port,
+        unsigned loopNb,
+        unsigned loopIterTime,
+        const std::vector<secw::DocumentPtr>& documents,
+        const KeyValues& extra,
+        const DumpCompletion& completion,
+        std::chrono::steady_clock::time_point deadline
+    );
+
+    std::shared_ptr<Task> m_task;
+    std::shared_future<DumpResult> m_result;
+};
+
+/**
+ * \brief Dump NUT data from a device without blocking.
+ *
+ * The driver is run on the event loop thread of the library, which
+ * supervises all drivers in flight.
+ *
+ * \param driver Driver to use.
+ * \param port Device to scan.
+ * \param loopNb Number of acquisition loops to perform.
+ * \param loopIterTime Max time per acquisition loop.
+ * \param documents Security documents to use.
+ * \param extra Extra parameters to pass to driver.
+ * \param completion Callback fired once the dump has finished (optional).
+ * \param deadline Time after which driver is terminated (defaults to loopNb*loopIterTime seconds from now, none if 0).
+ * \return Handle on dump.
+ */
+DumpHandle dumpDeviceAsync(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents = {},
+    const KeyValues& extra = {},
+    const DumpCompletion& completion = nullptr,
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point()
+);
+
 /**
  * \brief Helper method to dump NUT data from a device.
  * \param driver Driver to use.
@@ -53,6 +170,123 @@ KeyValues dumpDevice(
     const KeyValues& extra = {}
 );
 
+/**
+ * \brief Helper method to dump NUT data from a device, streaming data as the driver outputs it.
+ * \param driver Driver to use.
+ * \param port Device to scan.
+ * \param loopNb Number of acquisition loops to perform.
+ * \param loopIterTime Max time per acquisition loop.
+ * \param documents Security documents to use.
+ * \param extra Extra parameters to pass to driver.
+ * \param callback Callback fired for each key/value entry as soon as the driver outputs it,
+ *        on the calling thread (an exception thrown by it terminates the driver and is propagated).
+ * \return Return code of driver.
+ */
+int dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const DumpOutputParser::Callback& callback
+);
+
+/**
+ * \brief Helper method to dump NUT data from a device, ending the driver once all required keys have been seen.
+ * \param driver Driver to use.
+ * \param port Device to scan.
+ * \param loopNb Max number of acquisition loops to perform.
+ * \param loopIterTime Max time per acquisition loop.
+ * \param documents Security documents to use.
+ * \param extra Extra parameters to pass to driver.
+ * \param requiredKeys Keys to wait for (if empty, driver runs to completion).
+ * \return Map of key/value data returned by driver, up to the last required key.
+ */
+KeyValues dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const std::set<std::string>& requiredKeys
+);
+
+/**
+ * \brief Helper method to dump and map NUT data from a device, ending the driver after its first acquisition loop.
+ *
+ * Later loops only refresh values of the first one, so they are not waited
+ * for.
+ *
+ * \param driver Driver to use.
+ * \param port Device to scan.
+ * \param loopNb Max number of acquisition loops to perform.
+ * \param loopIterTime Max time per acquisition loop.
+ * \param documents Security documents to use.
+ * \param extra Extra parameters to pass to driver.
+ * \param mapping Mapping to apply.
+ * \param daisychain Daisy-chain index of device, as for performMapping().
+ * \return Mapped data of first loop.
+ */
+KeyValues dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const CompiledMapping& mapping,
+    int daisychain
+);
+
+/**
+ * \brief Helper method to dump NUT data from a device, delivering each acquisition loop as soon as it is complete.
+ *
+ * Unlike the other variants, which merge all loops keeping the first value
+ * of each key, each loop is reported separately with its index.
+ *
+ * \param driver Driver to use.
+ * \param port Device to scan.
+ * \param loopNb Number of acquisition loops to perform.
+ * \param loopIterTime Max time per acquisition loop.
+ * \param documents Security documents to use.
+ * \param extra Extra parameters to pass to driver.
+ * \param callback Callback fired with the data of each loop,
+ *        on the calling thread (an exception thrown by it terminates the driver and is propagated).
+ * \return Return code of driver.
+ */
+int dumpDeviceLoops(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const DumpLoopParser::Callback& callback
+);
+
+/**
+ * \brief Helper method to dump NUT data from a device into a flat snapshot.
+ * \param driver Driver to use.
+ * \param port Device to scan.
+ * \param loopNb Number of acquisition loops to perform.
+ * \param loopIterTime Max time per acquisition loop.
+ * \param documents Security documents to use.
+ * \param extra Extra parameters to pass to driver.
+ * \param snapshot Snapshot of data returned by driver.
+ * \return Return code of driver.
+ */
+int dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    DumpSnapshot& snapshot
+);
+
 }
 }
 
@@ -0,0 +1,208 @@
+/*  =========================================================================
+    fty_common_nut_intern - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_intern -
+@discuss
+@end
+*/
+
+#ifndef FTY_COMMON_NUT_INTERN_H_INCLUDED
+#define FTY_COMMON_NUT_INTERN_H_INCLUDED
+
+#include "fty_common_nut_library.h"
+
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace fty {
+namespace nut {
+
+/**
+ * \brief Handle to a string interned in a StringPool.
+ *
+ * Handles are the size of a pointer and are cheap to copy. Handles of equal
+ * strings from the same pool compare equal by pointer, and ordering is the
+ * same as std::string's so maps of handles iterate like KeyValues.
+ */
+class InternedString
+{
+public:
+    InternedString();
+
+    const std::string& str() const { return *m_str; }
+    const char *c_str() const { return m_str->c_str(); }
+    size_t size() const { return m_str->size(); }
+    bool empty() const { return m_str->empty(); }
+
+    bool operator==(const InternedString &other) const { return m_str == other.m_str || *m_str == *other.m_str; }
+    bool operator!=(const InternedString &other) const { return !(*this == other); }
+    bool operator<(const InternedString &other) const { return m_str != other.m_str && *m_str < *other.m_str; }
+
+private:
+    friend class StringPool;
+    explicit InternedString(const std::string *str) : m_str(str) {}
+
+    const std::string *m_str;
+};
+
+using InternedKeyValues = std::map<InternedString, InternedString>;
+
+/**
+ * \brief Value of a NUT variable, interned if it has a low cardinality and owned otherwise.
+ *
+ * Measurements, counters and timestamps change on every poll, interning them
+ * into a long-lived pool would grow it without bound (see isLowCardinalityValue()).
+ */
+class PooledValue
+{
+public:
+    PooledValue() : m_interned(true) {}
+    explicit PooledValue(InternedString interned) : m_handle(interned), m_interned(true) {}
+    explicit PooledValue(std::string owned) : m_owned(std::move(owned)), m_interned(false) {}
+
+    const std::string& str() const { return m_interned ? m_handle.str() : m_owned; }
+    const char *c_str() const { return str().c_str(); }
+    size_t size() const { return str().size(); }
+    bool empty() const { return str().empty(); }
+    bool interned() const { return m_interned; }
+
+    bool operator==(const PooledValue &other) const { return str() == other.str(); }
+    bool operator!=(const PooledValue &other) const { return !(*this == other); }
+
+private:
+    InternedString m_handle;
+    std::string m_owned;
+    bool m_interned;
+};
+
+using PooledKeyValues = std::map<InternedString, PooledValue>;
+
+/**
+ * \brief Thread-safe string interning table.
+ *
+ * Interned strings are never freed during the lifetime of the pool, so only
+ * low-cardinality data (NUT variable names, enumerated values...) should be
+ * interned into long-lived pools.
+ */
+class StringPool
+{
+public:
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    /**
+     * \brief Process-wide string pool.
+     */
+    static StringPool& instance();
+
+    /**
+     * \brief Intern a string, adding it to the pool if needed.
+     * \return Handle to interned string.
+     */
+    InternedString intern(const char *str, size_t length);
+    InternedString intern(const std::string &str) { return intern(str.data(), str.size()); }
+
+    /**
+     * \brief Look up a string without adding it to the pool.
+     * \param str String to look up.
+     * \param length Length of string.
+     * \param handle Set to handle of interned string, if found.
+     * \return True if the string is in the pool.
+     */
+    bool find(const char *str, size_t length, InternedString &handle) const;
+    bool find(const std::string &str, InternedString &handle) const { return find(str.data(), str.size(), handle); }
+
+    /// \brief Number of strings in the pool.
+    size_t size() const;
+
+private:
+    struct Key
+    {
+        const char *data;
+        size_t length;
+        size_t hash;
+
+        bool operator==(const Key &other) const { return length == other.length && std::memcmp(data, other.data, length) == 0; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const { return key.hash; }
+    };
+
+    static size_t hash(const char *str, size_t length);
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<Key, const std::string *, KeyHash> index;
+        std::deque<std::string> strings;
+    };
+
+    static const size_t SHARD_COUNT = 16;
+    Shard m_shards[SHARD_COUNT];
+};
+
+/**
+ * \brief Intern all keys and values of a map.
+ *
+ * Meant for low-cardinality data such as mappings, see internVariables() for
+ * values of NUT variables.
+ */
+InternedKeyValues intern(const KeyValues &values, StringPool &pool);
+
+/**
+ * \brief Check whether a value of a NUT variable is worth interning.
+ *
+ * Values without any digit (statuses, enumerations...) and identification
+ * properties (model, manufacturer, serial number, firmware, type, version) are
+ * interned, others are likely measurements, counters or timestamps.
+ *
+ * \param key NUT variable.
+ * \param value Value of variable.
+ * \param length Length of value.
+ * \return True if the value should be interned.
+ */
+bool isLowCardinalityValue(const std::string &key, const char *value, size_t length);
+
+/**
+ * \brief Intern names of NUT variables, and their values if of low cardinality.
+ */
+PooledKeyValues internVariables(const KeyValues &values, StringPool &pool);
+
+/**
+ * \brief Convert back interned key/values to a map.
+ */
+KeyValues toKeyValues(const InternedKeyValues &values);
+KeyValues toKeyValues(const PooledKeyValues &values);
+
+}
+}
+
+//  Self test of this class
+void fty_common_nut_intern_test(bool verbose);
+
+#endif
@@ -76,23 +76,38 @@
 
 //  Opaque class structures to allow forward references
 //  These classes are stable or legacy and built in all releases
+typedef struct _fty_common_nut_intern_t fty_common_nut_intern_t;
+#define FTY_COMMON_NUT_INTERN_T_DEFINED
 typedef struct _fty_common_nut_credentials_t fty_common_nut_credentials_t;
 #define FTY_COMMON_NUT_CREDENTIALS_T_DEFINED
 typedef struct _fty_common_nut_convert_t fty_common_nut_convert_t;
 #define FTY_COMMON_NUT_CONVERT_T_DEFINED
 typedef struct _fty_common_nut_dump_t fty_common_nut_dump_t;
 #define FTY_COMMON_NUT_DUMP_T_DEFINED
+typedef struct _fty_common_nut_upsd_t fty_common_nut_upsd_t;
+#define FTY_COMMON_NUT_UPSD_T_DEFINED
 typedef struct _fty_common_nut_parse_t fty_common_nut_parse_t;
 #define FTY_COMMON_NUT_PARSE_T_DEFINED
+typedef struct _fty_common_nut_registry_t fty_common_nut_registry_t;
+#define FTY_COMMON_NUT_REGISTRY_T_DEFINED
+typedef struct _fty_common_nut_plan_t fty_common_nut_plan_t;
+#define FTY_COMMON_NUT_PLAN_T_DEFINED
+typedef struct _fty_common_nut_delta_t fty_common_nut_delta_t;
+#define FTY_COMMON_NUT_DELTA_T_DEFINED
 typedef struct _fty_common_nut_scan_t fty_common_nut_scan_t;
 #define FTY_COMMON_NUT_SCAN_T_DEFINED
 
 
 //  Public classes, each with its own header file
+#include "fty_common_nut_intern.h"
 #include "fty_common_nut_credentials.h"
 #include "fty_common_nut_convert.h"
 #include "fty_common_nut_dump.h"
+#include "fty_common_nut_upsd.h"
 #include "fty_common_nut_parse.h"
+#include "fty_common_nut_registry.h"
+#include "fty_common_nut_plan.h"
+#include "fty_common_nut_delta.h"
 #include "fty_common_nut_scan.h"
 
 #ifdef FTY_COMMON_NUT_BUILD_DRAFT_API
@@ -31,13 +31,306 @@
 
 #include "fty_common_nut_library.h"
 
+#include <functional>
+
 namespace fty {
 namespace nut {
 
+/**
+ * \brief Flat, read-only view of a driver dump.
+ *
+ * The raw driver output is kept in a single buffer and key/value entries are
+ * stored as a sorted flat array of offsets into it, instead of a node and
+ * two strings per entry like KeyValues. Lookups are done by binary search.
+ * Like parseDumpOutput(), the first value of a duplicated key wins.
+ */
+class DumpSnapshot
+{
+public:
+    DumpSnapshot() = default;
+
+    /**
+     * \brief Parse driver dump output into a snapshot.
+     * \param buffer Driver output, kept by the snapshot.
+     */
+    explicit DumpSnapshot(std::string buffer);
+
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+
+    /// \brief Key of entry at index, entries being sorted by key.
+    std::string key(size_t index) const;
+    /// \brief Value of entry at index, entries being sorted by key.
+    std::string value(size_t index) const;
+
+    /// \brief Zero-copy accessors to entry at index (not NUL-terminated).
+    const char *keyData(size_t index) const { return m_buffer.data() + m_entries[index].keyOffset; }
+    size_t keyLength(size_t index) const { return m_entries[index].keyLength; }
+    const char *valueData(size_t index) const { return m_buffer.data() + m_entries[index].valueOffset; }
+    size_t valueLength(size_t index) const { return m_entries[index].valueLength; }
+
+    /**
+     * \brief Look up a key.
+     * \return Index of entry, or npos if not found.
+     */
+    size_t indexOf(const char *key, size_t length) const;
+    size_t indexOf(const std::string &key) const { return indexOf(key.data(), key.size()); }
+
+    bool contains(const std::string &key) const { return indexOf(key) != npos; }
+
+    /**
+     * \brief Look up the value of a key.
+     * \param key Key to look up.
+     * \param value Set to the value of the key, if found.
+     * \return True if key was found.
+     */
+    bool find(const std::string &key, std::string &value) const;
+
+    /// \brief Convert snapshot to a map, for existing consumers.
+    KeyValues toKeyValues() const;
+
+    /// \brief Raw driver output backing this snapshot.
+    const std::string& buffer() const { return m_buffer; }
+
+    static const size_t npos = static_cast<size_t>(-1);
+
+private:
+    struct Entry
+    {
+        uint32_t keyOffset;
+        uint32_t keyLength;
+        uint32_t valueOffset;
+        uint32_t valueLength;
+    };
+
+    std::string m_buffer;
+    std::vector<Entry> m_entries;
+};
+
+/**
+ * \brief NUT value classified by type.
+ *
+ * Numeric values are converted once, when classified, and the original text
+ * is kept for exact round-trips.
+ */
+struct TypedValue
+{
+    enum Type
+    {
+        TYPE_STRING,
+        TYPE_INTEGER,
+        TYPE_FLOAT
+    };
+
+    Type type = TYPE_STRING;
+    /// \brief Integer value, valid if type is TYPE_INTEGER.
+    int64_t integer = 0;
+    /// \brief Numeric value, valid if type is TYPE_INTEGER or TYPE_FLOAT.
+    double number = 0.0;
+    /// \brief Original text of value.
+    std::string text;
+
+    bool isNumeric() const { return type != TYPE_STRING; }
+    bool operator==(const TypedValue &other) const { return text == other.text; }
+};
+
+using TypedKeyValues = std::map<std::string, TypedValue>;
+
+/**
+ * \brief Classify a value as integer, floating-point or string.
+ *
+ * Accepted numbers follow the std::from_chars() grammar: an optional minus
+ * sign, digits with an optional decimal point and an optional exponent, with
+ * nothing else around. Infinities, NaNs and out of range numbers are left as
+ * strings, integers which don't fit in 64 bits are classified as floating-point.
+ *
+ * \param text Value to classify.
+ * \return Typed value.
+ */
+TypedValue classifyValue(std::string text);
+
+/**
+ * \brief Classify all values of a map.
+ */
+TypedKeyValues classifyValues(const KeyValues &values);
+
 DeviceConfigurations parseConfigurationFile(const std::string& in);
+
+/**
+ * \brief Parse NUT configuration data (ups.conf format).
+ * \param in Configuration data.
+ * \param length Length of configuration data.
+ * \param rejectedLines If not null, filled with the (1-based) numbers of lines that were rejected, blank lines and comments excepted.
+ * \return List of device configurations.
+ */
+DeviceConfigurations parseConfigurationFile(const char *in, size_t length, std::vector<size_t> *rejectedLines);
+
+/**
+ * \brief Read and parse a NUT configuration file (ups.conf format), memory-mapping it.
+ * \param path Path of configuration file.
+ * \param rejectedLines If not null, filled with the (1-based) numbers of lines that were rejected, blank lines and comments excepted.
+ * \return List of device configurations.
+ * \throw std::runtime_error if the file can't be read.
+ */
+DeviceConfigurations readConfigurationFile(const std::string& path, std::vector<size_t> *rejectedLines = nullptr);
+
+/**
+ * \brief Write a NUT configuration file (ups.conf format), atomically replacing it.
+ *
+ * The configuration is rendered in memory, written to a temporary file next
+ * to the destination, synced and renamed over it, so readers see either the
+ * old or the new file. Values are always quoted, and the output reads back
+ * identically with parseConfigurationFile() and NUT itself, values containing
+ * '"' or '\\' being rejected.
+ *
+ * \param path Path of configuration file.
+ * \param devices List of device configurations, each one holding its section name under the "name" key.
+ * \throw std::runtime_error if a configuration can't be represented or the file can't be written.
+ */
+void writeConfigurationFile(const std::string& path, const DeviceConfigurations& devices);
 DeviceConfigurations parseScannerOutput(const std::string& in);
 KeyValues parseDumpOutput(const std::string& in);
 
+/**
+ * \brief Parse driver dump output into a flat snapshot.
+ * \param in Driver output, moved into the snapshot.
+ * \param snapshot Snapshot to fill.
+ */
+void parseDumpOutput(std::string in, DumpSnapshot& snapshot);
+
+/**
+ * \brief Parse driver dump output, interning keys and low-cardinality values.
+ *
+ * Other values (measurements, counters, timestamps...) are kept as owned
+ * strings, so that polling devices doesn't grow the pool (see isLowCardinalityValue()).
+ *
+ * \param in Driver output.
+ * \param pool String pool to intern into.
+ * \return Map of key/value data.
+ */
+PooledKeyValues parseDumpOutput(const std::string& in, StringPool& pool);
+
+/**
+ * \brief Parse driver dump output, classifying values by type.
+ * \param in Driver output.
+ * \param values Map of typed key/value data to fill.
+ */
+void parseDumpOutput(const std::string& in, TypedKeyValues& values);
+
+/**
+ * \brief Incremental parser for nut-scanner parsable output.
+ *
+ * Scanner output can be fed in arbitrary chunks as it is read from the
+ * scanner process; a callback is fired with each device configuration as
+ * soon as its line is complete. Lines without any configuration entry (such
+ * as blank lines) are skipped.
+ */
+class ScannerOutputParser
+{
+public:
+    /// \brief Callback fired for each device configuration, in order of appearance.
+    using Callback = std::function<void(DeviceConfiguration &&device)>;
+
+    explicit ScannerOutputParser(Callback callback);
+
+    /**
+     * \brief Parse a chunk of scanner output.
+     * \param data Chunk of scanner output.
+     * \param length Length of chunk.
+     */
+    void feed(const char *data, size_t length);
+    void feed(const std::string &data);
+
+    /**
+     * \brief Flush the trailing partial line, if any, at end of output.
+     */
+    void finish();
+
+private:
+    void parseLine(const char *begin, const char *end);
+
+    Callback m_callback;
+    std::string m_partialLine;
+};
+
+/**
+ * \brief Incremental parser for driver dump output.
+ *
+ * Driver output can be fed in arbitrary chunks as it is read from the driver
+ * process. Only the trailing partial line is kept between chunks, so memory
+ * usage is bounded by the longest line instead of the whole dump.
+ */
+class DumpOutputParser
+{
+public:
+    /// \brief Callback fired for each key/value entry, in order of appearance.
+    using Callback = std::function<void(const std::string &key, const std::string &value)>;
+
+    explicit DumpOutputParser(Callback callback);
+
+    /**
+     * \brief Parse a chunk of driver output.
+     * \param data Chunk of driver output.
+     * \param length Length of chunk.
+     */
+    void feed(const char *data, size_t length);
+    void feed(const std::string &data);
+
+    /**
+     * \brief Flush the trailing partial line, if any, at end of output.
+     */
+    void finish();
+
+private:
+    void parseLine(const char *begin, const char *end);
+
+    Callback m_callback;
+    std::string m_partialLine;
+    std::string m_key;
+    std::string m_value;
+};
+
+/**
+ * \brief Incremental parser splitting multi-loop driver dump output into per-loop snapshots.
+ *
+ * With several acquisition loops, the driver outputs its variables once per
+ * loop. A key seen again in the current loop marks the start of the next
+ * one, so each loop is delivered as soon as the next one begins (or at end
+ * of output for the last one).
+ */
+class DumpLoopParser
+{
+public:
+    /// \brief Callback fired for each complete loop, numbered from 0.
+    using Callback = std::function<void(unsigned loop, const KeyValues &values)>;
+
+    explicit DumpLoopParser(Callback callback);
+
+    DumpLoopParser(const DumpLoopParser&) = delete;
+    DumpLoopParser& operator=(const DumpLoopParser&) = delete;
+
+    void feed(const char *data, size_t length);
+    void feed(const std::string &data);
+
+    /**
+     * \brief Deliver the last loop, at end of output.
+     */
+    void finish();
+
+    /**
+     * \brief Number of loops delivered so far.
+     */
+    unsigned loops() const { return m_loop; }
+
+private:
+    void entry(const std::string &key, const std::string &value);
+
+    Callback m_callback;
+    DumpOutputParser m_parser;
+    KeyValues m_values;
+    unsigned m_loop;
+};
+
 }
 }
 
@@ -0,0 +1,147 @@
+/*  =========================================================================
+    fty_common_nut_plan - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_plan -
+@discuss
+@end
+*/
+
+#ifndef FTY_COMMON_NUT_PLAN_H_INCLUDED
+#define FTY_COMMON_NUT_PLAN_H_INCLUDED
+
+#include "fty_common_nut_library.h"
+#include "fty_common_nut_convert.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace fty {
+namespace nut {
+
+/**
+ * \brief Outcome of mapping a set of NUT variables: which variables survive override rules, and their mapped key.
+ *
+ * A plan only depends on the names of the variables, so it can be applied to
+ * any values with the same names, yielding the same result as performMapping().
+ * Neither building nor applying a plan is counted in the statistics of the
+ * mapping (see CompiledMapping::statistics()).
+ */
+class MappingPlan
+{
+public:
+    /**
+     * \brief Mapped key of a variable.
+     */
+    struct Target
+    {
+        /// Position of the variable in the values.
+        size_t index;
+        std::string key;
+    };
+
+    /**
+     * \brief Build the plan of the names of some values.
+     * \param mapping Compiled mapping.
+     * \param values Values (only their names matter).
+     * \param daisychain Daisy-chain index of device (0 if not daisy-chained).
+     */
+    MappingPlan(const CompiledMapping &mapping, const KeyValues &values, int daisychain);
+
+    /**
+     * \brief Check that values have the names the plan was built for.
+     */
+    bool matches(const KeyValues &values) const;
+
+    /**
+     * \brief Map values having the names the plan was built for (see matches()).
+     */
+    KeyValues apply(const KeyValues &values) const;
+
+    /**
+     * \brief Mapped variables, sorted by mapped key.
+     */
+    const std::vector<Target>& targets() const { return m_targets; }
+
+private:
+    std::vector<std::string> m_names;
+    std::vector<Target> m_targets;
+};
+
+using MappingPlanPtr = std::shared_ptr<const MappingPlan>;
+
+/**
+ * \brief Bounded cache of mapping plans, keyed by fingerprint of variable names and daisy-chain index.
+ *
+ * Devices of a given model return the same variables on every poll, so
+ * their plan is built once and later polls are mapped by a copy loop,
+ * without any lookup. Plans are checked against the variable names before
+ * use, so that fingerprint collisions are harmless. The least recently used
+ * plans are evicted beyond the capacity. The cache can be shared by threads.
+ */
+class MappingPlanCache
+{
+public:
+    /**
+     * \param mapping Compiled mapping.
+     * \param capacity Maximum number of plans.
+     */
+    MappingPlanCache(const CompiledMapping &mapping, size_t capacity = 256);
+
+    MappingPlanCache(const MappingPlanCache&) = delete;
+    MappingPlanCache& operator=(const MappingPlanCache&) = delete;
+
+    /**
+     * \brief Get the plan of values, building it if needed.
+     */
+    MappingPlanPtr plan(const KeyValues &values, int daisychain);
+
+    /**
+     * \brief Perform mapping through the plan of values, identical to performMapping().
+     */
+    KeyValues performMapping(const KeyValues &values, int daisychain) { return plan(values, daisychain)->apply(values); }
+
+    const CompiledMapping& mapping() const { return m_mapping; }
+    size_t size() const;
+    size_t capacity() const { return m_capacity; }
+    void clear();
+
+private:
+    using Entry = std::pair<uint64_t, MappingPlanPtr>;
+
+    const CompiledMapping m_mapping;
+    const size_t m_capacity;
+
+    mutable std::mutex m_mutex;
+    /// Plans, most recently used first.
+    std::list<Entry> m_plans;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+};
+
+}
+}
+
+//  Self test of this class
+void fty_common_nut_plan_test(bool verbose);
+
+#endif
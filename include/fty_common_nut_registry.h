@@ -0,0 +1,152 @@
+/*  =========================================================================
+    fty_common_nut_registry - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_registry -
+@discuss
+@end
+*/
+
+#ifndef FTY_COMMON_NUT_REGISTRY_H_INCLUDED
+#define FTY_COMMON_NUT_REGISTRY_H_INCLUDED
+
+#include "fty_common_nut_library.h"
+#include "fty_common_nut_convert.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace fty {
+namespace nut {
+
+/**
+ * \brief Immutable snapshot of a mapping type, as loaded from a mapping file.
+ */
+class MappingSnapshot
+{
+public:
+    MappingSnapshot(const MappingEntries &entries);
+
+    /**
+     * \brief Regular mapping, with templates instanciated like loadMapping(). Built on first use.
+     */
+    const KeyValues& mapping() const;
+
+    /**
+     * \brief Compiled mapping, with templates kept as patterns.
+     */
+    const CompiledMapping& compiled() const { return m_compiled; }
+
+private:
+    CompiledMapping m_compiled;
+    mutable std::once_flag m_mappingOnce;
+    mutable KeyValues m_mapping;
+};
+
+using MappingSnapshotPtr = std::shared_ptr<const MappingSnapshot>;
+
+/**
+ * \brief Process-wide cache of mappings, keyed by file and type.
+ *
+ * All types of a mapping file are loaded from a single parse. Snapshots are
+ * immutable and shared; when the file changes (modification time, size or
+ * inode), it is reloaded and the snapshots of all its types are swapped
+ * atomically. Holders of older snapshots keep them as long as they need.
+ *
+ * Files are checked for changes at most once per check interval, by a
+ * background thread of the registry. Only the very first load of a file
+ * blocks callers: get() merely schedules later checks and reloads, and keeps
+ * returning the current snapshots meanwhile.
+ */
+class MappingRegistry
+{
+public:
+    MappingRegistry();
+    ~MappingRegistry();
+
+    MappingRegistry(const MappingRegistry&) = delete;
+    MappingRegistry& operator=(const MappingRegistry&) = delete;
+
+    /**
+     * \brief Process-wide registry.
+     */
+    static MappingRegistry& instance();
+
+    /**
+     * \brief Get the current snapshot of a mapping.
+     *
+     * If reloading a changed file fails, the previous snapshots are kept.
+     * Once the check interval is elapsed, a check of the file is scheduled in
+     * the background, so a change is only seen by a later call.
+     *
+     * \param file Mapping file.
+     * \param type Mapping type.
+     * \return Mapping snapshot.
+     * \throw std::runtime_error if the mapping can't be loaded.
+     */
+    MappingSnapshotPtr get(const std::string &file, const std::string &type);
+
+    /**
+     * \brief Set the minimum interval between checks of a file for changes (0 to check on every call).
+     */
+    void setCheckInterval(std::chrono::milliseconds interval);
+
+    /**
+     * \brief Check all loaded files for changes now and reload them, on the calling thread.
+     */
+    void check();
+
+    /**
+     * \brief Forget all files.
+     */
+    void clear();
+
+private:
+    struct FileState;
+
+    std::shared_ptr<FileState> fileState(const std::string &file);
+    void checkFile(const std::string &file, FileState &state);
+    void scheduleCheck();
+    void runChecks();
+
+    std::mutex m_mutex;
+    std::map<std::string, std::shared_ptr<FileState>> m_files;
+    std::atomic<int64_t> m_checkInterval;
+
+    /// Background thread checking files scheduled by get(), started on first need.
+    std::mutex m_checkMutex;
+    std::condition_variable m_checkCondition;
+    bool m_checkScheduled;
+    bool m_stop;
+    std::thread m_checkThread;
+};
+
+}
+}
+
+//  Self test of this class
+void fty_common_nut_registry_test(bool verbose);
+
+#endif
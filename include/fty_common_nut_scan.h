@@ -30,6 +30,7 @@
 #define FTY_COMMON_NUT_SCAN_H_INCLUDED
 
 #include "fty_common_nut_library.h"
+#include "fty_common_nut_parse.h"
 
 namespace fty {
 namespace nut {
@@ -73,6 +74,26 @@ DeviceConfigurations scanRangeDevices(
     const std::vector<secw::DocumentPtr>& documents = {}
 );
 
+/**
+ * \brief Scan for NUT configurations on an IP address range, streaming devices as they are found.
+ * \param protocol Protocol to scan for.
+ * \param idAddressStart First IP address to scan.
+ * \param idAddressEnd Last IP address to scan.
+ * \param timeout Timeout of scan, in seconds.
+ * \param documents Security wallet documents to use for scan (at most one set of credentials can be specified).
+ * \param callback Callback fired with each device configuration as soon as the scanner outputs it,
+ *        on the calling thread (an exception thrown by it terminates the scanner and is propagated).
+ * \return Return code of scanner.
+ */
+int scanRangeDevices(
+    ScanProtocol protocol,
+    std::string ipAddressStart,
+    std::string ipAddressEnd,
+    unsigned timeout,
+    const std::vector<secw::DocumentPtr>& documents,
+    const ScannerOutputParser::Callback& callback
+);
+
 }
 }
 
@@ -0,0 +1,135 @@
+/*  =========================================================================
+    fty_common_nut_upsd - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_upsd -
+@discuss
+    Client of the NUT network protocol (upsd).
+@end
+*/
+
+#ifndef FTY_COMMON_NUT_UPSD_H_INCLUDED
+#define FTY_COMMON_NUT_UPSD_H_INCLUDED
+
+#include "fty_common_nut_library.h"
+#include "fty_common_nut_parse.h"
+
+#include <chrono>
+#include <functional>
+
+namespace fty {
+namespace nut {
+
+/**
+ * \brief Client of the NUT network protocol, to read values from a running upsd.
+ *
+ * The connection is opened on first request and kept for later ones; if the
+ * server closed it in the meantime, a request is retried once on a new
+ * connection. Requests of a batch are pipelined: they are all sent before
+ * reading any reply. Replies are returned in the same form as
+ * parseDumpOutput(), so that values read from upsd can replace those of a
+ * driver dump.
+ *
+ * Errors reported by upsd ("ERR <code>") and network errors throw
+ * std::runtime_error. After a network error the connection is closed and
+ * reopened by the next request. A client must not be used by several
+ * threads at once.
+ */
+class UpsdClient
+{
+public:
+    static const uint16_t defaultPort = 3493;
+
+    /**
+     * \param host Host name or address of upsd.
+     * \param port TCP port of upsd.
+     * \param timeout Timeout of connection and of each request (or batch).
+     */
+    UpsdClient(const std::string &host = "localhost", uint16_t port = defaultPort, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
+    ~UpsdClient();
+
+    UpsdClient(const UpsdClient&) = delete;
+    UpsdClient& operator=(const UpsdClient&) = delete;
+
+    /**
+     * \brief List devices served by upsd.
+     * \return Description of each device, by name.
+     */
+    KeyValues listUps();
+
+    /**
+     * \brief List all variables of a device.
+     * \return Variables of device, like parseDumpOutput().
+     */
+    KeyValues listVars(const std::string &ups);
+
+    /**
+     * \brief List all variables of several devices, with pipelined requests.
+     * \return Variables of each device, in request order.
+     */
+    std::vector<KeyValues> listVars(const std::vector<std::string> &upses);
+
+    /**
+     * \brief Get a variable of a device.
+     */
+    std::string getVar(const std::string &ups, const std::string &var);
+
+    /**
+     * \brief Get several variables of a device, with pipelined requests.
+     * \return Variables found (variables not supported by the device are left out).
+     */
+    KeyValues getVars(const std::string &ups, const std::vector<std::string> &vars);
+
+    bool connected() const { return m_fd >= 0; }
+    void close();
+
+private:
+    using Words = std::vector<std::string>;
+
+    void connect();
+    void transact(const std::vector<std::string> &requests, const std::function<void(size_t request)> &handler);
+    bool sendPending();
+    Words readWords(const std::string &request);
+    void readList(const std::string &request, const std::function<void(const Words &words)> &item);
+    std::string readLine();
+
+    std::string m_host;
+    uint16_t m_port;
+    std::chrono::milliseconds m_timeout;
+    int m_fd;
+    /// Received data, unread from m_bufferStart.
+    std::string m_buffer;
+    size_t m_bufferStart;
+    /// Requests of current batch, unsent from m_requestsSent.
+    std::string m_requests;
+    size_t m_requestsSent;
+    /// Deadline of current batch.
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+}
+}
+
+//  Self test of this class
+void fty_common_nut_upsd_test(bool verbose);
+
+#endif
@@ -98,6 +98,7 @@ This package contains development files for fty-common-nut: provides common nut
 %{_includedir}/*
 %{_libdir}/libfty_common_nut.so
 %{_libdir}/pkgconfig/libfty_common_nut.pc
+%{_bindir}/fty_common_nut_mapping_compiler
 %{_mandir}/man3/*
 %{_mandir}/man7/*
 
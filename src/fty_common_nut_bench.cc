@@ -0,0 +1,964 @@
+/*  =========================================================================
+    fty_common_nut_bench - benchmarks of fty-common-nut hot paths
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_bench - benchmarks of fty-common-nut hot paths
+@discuss
+    Results are printed as one JSON object per line on standard output,
+    with time per operation, bytes and allocations per operation and peak
+    RSS. Each benchmark runs in its own child process so that peak RSS and
+    allocation counters are not polluted by other benchmarks. Corpora are
+    synthetic and generated from fixed seeds, so runs are reproducible.
+@end
+*/
+
+#include "fty_common_nut_classes.h"
+
+#include <cxxtools/jsondeserializer.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <new>
+#include <random>
+#include <regex>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+//  --------------------------------------------------------------------------
+//  Allocation accounting, replacing the global allocation functions
+
+static std::atomic<uint64_t> s_allocatedBytes(0);
+static std::atomic<uint64_t> s_allocationCount(0);
+
+/// \brief Release memory, kept out of line so the compiler does not pair it with operator new.
+__attribute__((noinline)) static void release(void *ptr)
+{
+    free(ptr);
+}
+
+void *operator new(size_t size)
+{
+    s_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    s_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    release(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    release(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    release(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    release(ptr);
+}
+
+//  --------------------------------------------------------------------------
+//  Synthetic corpora
+
+/**
+ * \brief Generate the driver output of a synthetic NetXML UPS.
+ */
+static std::string generateUpsDump(std::mt19937 &generator)
+{
+    std::ostringstream out;
+
+    out << "Network UPS Tools - network XML UPS 0.42 (2.7.4.1)\n";
+    out << "ambient.humidity.high: 90\n";
+    out << "ambient.humidity.low: 5\n";
+    out << "ambient.temperature.high: 40\n";
+    out << "ambient.temperature.low: 5\n";
+    out << "battery.charge: " << generator() % 101 << "\n";
+    out << "battery.runtime: " << generator() % 4000 << "\n";
+    out << "battery.voltage: " << 40 + (generator() % 100) / 10.0 << "\n";
+    out << "device.contact: Computer Room Manager\n";
+    out << "device.location: Computer Room\n";
+    out << "device.mfr: EATON\n";
+    out << "device.model: HP R/T3000 HV INTL UPS\n";
+    out << "device.type: ups\n";
+    out << "driver.name: netxml-ups\n";
+    out << "driver.parameter.port: http://10.130.33.199\n";
+    out << "input.frequency: " << 49.5 + (generator() % 11) / 10.0 << "\n";
+    out << "input.voltage: " << 225 + generator() % 20 << "\n";
+    out << "outlet.1.status: on\n";
+    out << "outlet.1.switchable: yes\n";
+    out << "output.current: " << (generator() % 130) / 10.0 << "\n";
+    out << "output.voltage: " << 225 + generator() % 20 << "\n";
+    out << "output.voltage.nominal: 230\n";
+    out << "ups.beeper.status: disabled\n";
+    out << "ups.load: " << generator() % 100 << "\n";
+    out << "ups.mfr: EATON\n";
+    out << "ups.model: HP R/T3000 HV INTL UPS\n";
+    out << "ups.model.aux: UPS LI R\n";
+    out << "ups.realpower: " << generator() % 2700 << "\n";
+    out << "ups.status: OL\n";
+    out << "ups.type: offline / line interactive\n";
+
+    return out.str();
+}
+
+/**
+ * \brief Generate the driver output of a synthetic 3-phase ePDU.
+ * \param generator Random generator.
+ * \param id Device identifier, used for device-specific values.
+ * \param outlets Number of outlets.
+ * \param prefix Prefix of variables (for daisy-chained devices).
+ */
+static std::string generateEpduDump(std::mt19937 &generator, int id, int outlets, const std::string &prefix = "")
+{
+    std::ostringstream out;
+
+    if (prefix.empty()) {
+        out << "Network UPS Tools - Generic SNMP UPS driver 0.97 (2.7.4.1)\n";
+    }
+    out << prefix << "device.contact: Computer Room Manager\n";
+    out << prefix << "device.location: Room " << id % 50 << "\n";
+    out << prefix << "device.mfr: EATON\n";
+    out << prefix << "device.model: ePDU MANAGED 38U-A IN L6-30P 24A 3P OUT " << outlets << "xC13\n";
+    out << prefix << "device.serial: " << "G" << 100000000 + id << "\n";
+    out << prefix << "device.type: pdu\n";
+    out << prefix << "driver.name: snmp-ups\n";
+    out << prefix << "driver.parameter.port: 10." << id / 65536 % 256 << "." << id / 256 % 256 << "." << id % 256 << "\n";
+    out << prefix << "input.frequency: " << 49.5 + (generator() % 11) / 10.0 << "\n";
+    out << prefix << "input.phases: 3\n";
+    for (int phase = 1; phase <= 3; phase++) {
+        out << prefix << "input.L" << phase << ".current: " << (generator() % 160) / 10.0 << "\n";
+        out << prefix << "input.L" << phase << ".load: " << generator() % 100 << "\n";
+        out << prefix << "input.L" << phase << ".realpower: " << generator() % 3600 << "\n";
+        out << prefix << "input.L" << phase << ".voltage: " << 225 + generator() % 10 << "\n";
+    }
+    out << prefix << "outlet.count: " << outlets << "\n";
+    out << prefix << "outlet.switchable: yes\n";
+    for (int outlet = 1; outlet <= outlets; outlet++) {
+        out << prefix << "outlet." << outlet << ".current: " << (generator() % 100) / 10.0 << "\n";
+        out << prefix << "outlet." << outlet << ".desc: Outlet " << outlet << "\n";
+        out << prefix << "outlet." << outlet << ".id: " << outlet << "\n";
+        out << prefix << "outlet." << outlet << ".realpower: " << generator() % 1000 << "\n";
+        out << prefix << "outlet." << outlet << ".status: " << (generator() % 8 ? "on" : "off") << "\n";
+        out << prefix << "outlet." << outlet << ".switchable: yes\n";
+    }
+    out << prefix << "ups.mfr: EATON\n";
+    out << prefix << "ups.status: OL\n";
+
+    return out.str();
+}
+
+/**
+ * \brief Generate the driver output of a synthetic daisy-chain of ePDUs.
+ * \param generator Random generator.
+ * \param devices Number of daisy-chained devices.
+ * \param outlets Number of outlets per device.
+ */
+static std::string generateDaisychainDump(std::mt19937 &generator, int devices, int outlets)
+{
+    std::string out = generateEpduDump(generator, 0, outlets);
+    out += "device.count: " + std::to_string(devices) + "\n";
+    for (int i = 1; i <= devices; i++) {
+        out += generateEpduDump(generator, i, outlets, "device." + std::to_string(i) + ".");
+    }
+    return out;
+}
+
+/**
+ * \brief Generate the parsable output of a nut-scanner sweep.
+ */
+static std::string generateScannerOutput(std::mt19937 &generator, int lines)
+{
+    std::ostringstream out;
+
+    for (int i = 0; i < lines; i++) {
+        const std::string ip = "10.130." + std::to_string(i / 256 % 256) + "." + std::to_string(i % 256);
+        if (generator() % 4) {
+            out << "SNMP:driver=\"snmp-ups\",port=\"" << ip << "\",desc=\"ePDU MANAGED 38U-A IN L6-30P 24A 1P OUT 20xC13:4xC19\","
+                << "mibs=\"eaton_epdu\",community=\"public\"\n";
+        }
+        else {
+            out << "XML:driver=\"netxml-ups\",port=\"http://" << ip << "\",desc=\"Mosaic 4M 16M\"\n";
+        }
+    }
+
+    return out.str();
+}
+
+/**
+ * \brief Generate a ups.conf configuration file.
+ */
+static std::string generateConfigurationFile(std::mt19937 &generator, int sections)
+{
+    std::ostringstream out;
+
+    for (int i = 0; i < sections; i++) {
+        out << "[nutdev" << i << "]\n";
+        if (generator() % 2) {
+            out << "\tdriver = \"snmp-ups\"\n";
+            out << "\tport = \"10.130." << i / 256 % 256 << "." << i % 256 << "\"\n";
+            out << "\tdesc = \"ePDU MANAGED 38U-A IN L6-30P 24A 1P OUT 20xC13:4xC19\"\n";
+            out << "\tmibs = eaton_epdu\n";
+            out << "\tsecLevel = \"authPriv\"\n";
+            out << "\tsecName = user" << i << "\n";
+        }
+        else {
+            out << "\tdriver=netxml-ups\n";
+            out << "\tport = \"http://10.130." << i / 256 % 256 << "." << i % 256 << "\"\n";
+            out << "\tdesc = \"Mosaic 4M 16M\"\n";
+        }
+        out << "\n";
+    }
+
+    return out.str();
+}
+
+//  --------------------------------------------------------------------------
+//  Benchmark harness
+
+struct Options
+{
+    std::string filter;
+    std::string mappingFile = "src/mapping.conf";
+    std::string imageFile = "src/mapping.bin";
+    int devices = 5000;
+    int minTimeMs = 500;
+};
+
+static Options s_options;
+
+/// \brief Sink for results, to keep the compiler from optimizing them away.
+static volatile size_t s_sink;
+
+/**
+ * \brief Run a benchmark case in a child process.
+ * \return Peak RSS of the child, in kilobytes (-1 on failure).
+ */
+template <typename Function>
+static long runInChild(Function function)
+{
+    std::cout.flush();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        function();
+        std::cout.flush();
+        _exit(0);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+static bool selected(const std::string &name)
+{
+    return name.find(s_options.filter) != std::string::npos;
+}
+
+/**
+ * \brief Time an operation in a child process and report it.
+ * \param name Benchmark name.
+ * \param corpus Corpus name.
+ * \param setup Function preparing the corpus and returning the operation to time.
+ */
+static void bench(const std::string &name, const std::string &corpus, std::function<std::function<size_t()>()> setup)
+{
+    if (!selected(name + "/" + corpus)) {
+        return;
+    }
+
+    long ret = runInChild([&]() {
+        std::function<size_t()> operation;
+        try {
+            operation = setup();
+            s_sink = operation();
+        }
+        catch (std::exception &e) {
+            std::cout << "{\"benchmark\":\"" << name << "\",\"corpus\":\"" << corpus << "\",\"error\":\"" << e.what() << "\"}" << std::endl;
+            return;
+        }
+
+        const uint64_t bytesBefore = s_allocatedBytes.load();
+        const uint64_t countBefore = s_allocationCount.load();
+        const auto start = std::chrono::steady_clock::now();
+        const auto minTime = std::chrono::milliseconds(s_options.minTimeMs);
+        uint64_t iterations = 0;
+        std::chrono::steady_clock::duration elapsed;
+
+        do {
+            s_sink = operation();
+            iterations++;
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while (elapsed < minTime);
+
+        const double ns = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(elapsed).count();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        std::cout << "{\"benchmark\":\"" << name << "\",\"corpus\":\"" << corpus << "\""
+            << ",\"iterations\":" << iterations
+            << ",\"ns_per_op\":" << static_cast<uint64_t>(ns / iterations)
+            << ",\"bytes_per_op\":" << (s_allocatedBytes.load() - bytesBefore) / iterations
+            << ",\"allocs_per_op\":" << (s_allocationCount.load() - countBefore) / iterations
+            << ",\"peak_rss_kb\":" << usage.ru_maxrss << "}" << std::endl;
+    });
+
+    if (ret < 0) {
+        std::cout << "{\"benchmark\":\"" << name << "\",\"corpus\":\"" << corpus << "\",\"error\":\"child process failed\"}" << std::endl;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Benchmarks
+
+static void benchParse()
+{
+    const std::vector<std::pair<std::string, std::function<std::string()>>> dumps = {
+        { "small", []() { std::mt19937 g(1); return generateUpsDump(g); } },
+        { "large", []() { std::mt19937 g(2); return generateEpduDump(g, 1, 48); } },
+        { "daisychain", []() { std::mt19937 g(3); return generateDaisychainDump(g, 4, 24); } }
+    };
+
+    for (const auto &dump : dumps) {
+        auto generate = dump.second;
+        bench("parseDumpOutput", dump.first, [generate]() {
+            auto input = std::make_shared<std::string>(generate());
+            return [input]() { return fty::nut::parseDumpOutput(*input).size(); };
+        });
+    }
+
+    bench("parseScannerOutput", "4096-lines", []() {
+        std::mt19937 generator(4);
+        auto input = std::make_shared<std::string>(generateScannerOutput(generator, 4096));
+        return [input]() { return fty::nut::parseScannerOutput(*input).size(); };
+    });
+
+    bench("parseConfigurationFile", "10k-sections", []() {
+        std::mt19937 generator(5);
+        auto input = std::make_shared<std::string>(generateConfigurationFile(generator, 10000));
+        return [input]() { return fty::nut::parseConfigurationFile(*input).size(); };
+    });
+}
+
+static void benchConvert()
+{
+    const std::string mappingFile = s_options.mappingFile;
+    const std::string imageFile = s_options.imageFile;
+
+    for (const auto &type : { "physicsMapping", "inventoryMapping" }) {
+        const std::string mappingType = type;
+        bench("loadMapping", mappingType, [mappingFile, mappingType]() {
+            return [mappingFile, mappingType]() { return fty::nut::loadMapping(mappingFile, mappingType).size(); };
+        });
+        bench("loadCompiledMapping", mappingType, [mappingFile, mappingType]() {
+            return [mappingFile, mappingType]() { return fty::nut::loadCompiledMapping(mappingFile, mappingType).size(); };
+        });
+        bench("loadCompiledMapping", mappingType + "/image", [mappingFile, imageFile, mappingType]() {
+            return [mappingFile, imageFile, mappingType]() { return fty::nut::loadCompiledMapping(mappingFile, mappingType, imageFile).size(); };
+        });
+    }
+
+    bench("performMapping", "large", [mappingFile]() {
+        std::mt19937 generator(2);
+        auto mapping = std::make_shared<fty::nut::KeyValues>(fty::nut::loadMapping(mappingFile, "physicsMapping"));
+        auto values = std::make_shared<fty::nut::KeyValues>(fty::nut::parseDumpOutput(generateEpduDump(generator, 1, 48)));
+        return [mapping, values]() { return fty::nut::performMapping(*mapping, *values, 0).size(); };
+    });
+
+    bench("performMapping", "daisychain", [mappingFile]() {
+        std::mt19937 generator(3);
+        auto mapping = std::make_shared<fty::nut::KeyValues>(fty::nut::loadMapping(mappingFile, "physicsMapping"));
+        auto values = std::make_shared<fty::nut::KeyValues>(fty::nut::parseDumpOutput(generateDaisychainDump(generator, 4, 24)));
+        return [mapping, values]() {
+            size_t result = 0;
+            for (int i = 1; i <= 4; i++) {
+                result += fty::nut::performMapping(*mapping, *values, i).size();
+            }
+            return result;
+        };
+    });
+
+    bench("performCompiledMapping", "large", [mappingFile]() {
+        std::mt19937 generator(2);
+        auto mapping = std::make_shared<fty::nut::CompiledMapping>(fty::nut::loadCompiledMapping(mappingFile, "physicsMapping"));
+        auto values = std::make_shared<fty::nut::KeyValues>(fty::nut::parseDumpOutput(generateEpduDump(generator, 1, 48)));
+        return [mapping, values]() { return fty::nut::performMapping(*mapping, *values, 0).size(); };
+    });
+
+    bench("performCompiledMapping", "daisychain", [mappingFile]() {
+        std::mt19937 generator(3);
+        auto mapping = std::make_shared<fty::nut::CompiledMapping>(fty::nut::loadCompiledMapping(mappingFile, "physicsMapping"));
+        auto values = std::make_shared<fty::nut::KeyValues>(fty::nut::parseDumpOutput(generateDaisychainDump(generator, 4, 24)));
+        return [mapping, values]() {
+            size_t result = 0;
+            for (int i = 1; i <= 4; i++) {
+                result += fty::nut::performMapping(*mapping, *values, i).size();
+            }
+            return result;
+        };
+    });
+
+    bench("MappingPlanCache", "large", [mappingFile]() {
+        std::mt19937 generator(2);
+        auto cache = std::make_shared<fty::nut::MappingPlanCache>(fty::nut::loadCompiledMapping(mappingFile, "physicsMapping"));
+        auto values = std::make_shared<fty::nut::KeyValues>(fty::nut::parseDumpOutput(generateEpduDump(generator, 1, 48)));
+        return [cache, values]() { return cache->performMapping(*values, 0).size(); };
+    });
+
+    bench("DeltaMapper", "large", [mappingFile]() {
+        // Successive polls where about 5% of values change.
+        std::mt19937 generator(2);
+        auto mapper = std::make_shared<fty::nut::DeltaMapper>(fty::nut::loadCompiledMapping(mappingFile, "physicsMapping"), 0);
+        auto polls = std::make_shared<std::vector<fty::nut::KeyValues>>();
+        polls->emplace_back(fty::nut::parseDumpOutput(generateEpduDump(generator, 1, 48)));
+        for (int i = 1; i < 16; i++) {
+            polls->push_back(polls->back());
+            for (auto &value : polls->back()) {
+                if (generator() % 20 == 0) {
+                    value.second = std::to_string(generator() % 1000);
+                }
+            }
+        }
+        auto poll = std::make_shared<size_t>(0);
+        return [mapper, polls, poll]() {
+            const auto delta = mapper->update((*polls)[(*poll)++ % polls->size()]);
+            return delta.added.size() + delta.changed.size() + delta.removed.size();
+        };
+    });
+
+    bench("performDaisychainMapping", "daisychain", [mappingFile]() {
+        std::mt19937 generator(3);
+        auto mapping = std::make_shared<fty::nut::CompiledMapping>(fty::nut::loadCompiledMapping(mappingFile, "physicsMapping"));
+        auto values = std::make_shared<fty::nut::KeyValues>(fty::nut::parseDumpOutput(generateDaisychainDump(generator, 4, 24)));
+        return [mapping, values]() { return fty::nut::performDaisychainMapping(*mapping, *values).size(); };
+    });
+}
+
+/**
+ * \brief Scaling of batch mapping of many ePDU dumps, from 1 thread to the number of cores (at least 4).
+ */
+static void benchBatchMapping()
+{
+    static const int devices = 256;
+    const std::string mappingFile = s_options.mappingFile;
+    const unsigned cores = std::max(std::thread::hardware_concurrency(), 4u);
+
+    for (unsigned threads = 1; threads <= cores; threads = threads < cores ? std::min(threads * 2, cores) : threads + 1) {
+        bench("performBatchMapping", "epdu-" + std::to_string(devices) + "/threads-" + std::to_string(threads), [mappingFile, threads]() {
+            std::mt19937 generator(4);
+            auto mapping = std::make_shared<fty::nut::CompiledMapping>(fty::nut::loadCompiledMapping(mappingFile, "physicsMapping"));
+            auto dumps = std::make_shared<std::vector<fty::nut::KeyValues>>();
+            auto inputs = std::make_shared<std::vector<fty::nut::MappingInput>>();
+            for (int i = 0; i < devices; i++) {
+                dumps->emplace_back(fty::nut::parseDumpOutput(generateEpduDump(generator, i, 48)));
+            }
+            for (const auto &dump : *dumps) {
+                inputs->push_back({ &dump, 0 });
+            }
+            return [mapping, dumps, inputs, threads]() { return fty::nut::performBatchMapping(*mapping, *inputs, threads).size(); };
+        });
+    }
+}
+
+/**
+ * \brief Write a mapping file 10 times larger than the given one, with its types first and renamed copies after.
+ * \return Path of written file (empty on failure).
+ */
+static std::string writeLargeMappingFile(const std::string &mappingFile)
+{
+    std::ifstream input(mappingFile);
+    const std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    const size_t begin = contents.find('{');
+    const size_t end = contents.rfind('}');
+    if (!input || begin == std::string::npos || end == std::string::npos) {
+        return std::string();
+    }
+
+    const std::string members = contents.substr(begin + 1, end - begin - 1);
+    const std::regex typeRegex(R"xxx("(\w+Mapping)"(\s*):)xxx");
+    std::string large = "{" + members;
+    for (int i = 1; i < 10; i++) {
+        large += ",\n" + std::regex_replace(members, typeRegex, "\"$1" + std::to_string(i) + "\"$2:");
+    }
+    large += "}\n";
+
+    char path[] = "/tmp/fty_common_nut_bench_mapping.XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        return std::string();
+    }
+    const bool written = write(fd, large.data(), large.size()) == static_cast<ssize_t>(large.size());
+    close(fd);
+    if (!written) {
+        unlink(path);
+        return std::string();
+    }
+    return path;
+}
+
+/**
+ * \brief Load one mapping type from a large mapping file, streaming vs deserializing the whole document.
+ */
+static void benchLoadMappingFile()
+{
+    if (!selected("loadMappingFile")) {
+        return;
+    }
+
+    const std::string largeFile = writeLargeMappingFile(s_options.mappingFile);
+    if (largeFile.empty()) {
+        std::cout << "{\"benchmark\":\"loadMappingFile\",\"error\":\"can't write large mapping file\"}" << std::endl;
+        return;
+    }
+
+    bench("loadMappingFile", "10x/streaming", [largeFile]() {
+        return [largeFile]() { return fty::nut::loadMappingFile(largeFile, { "physicsMapping" }).size(); };
+    });
+
+    // Previous implementation, deserializing the whole document before picking the type.
+    bench("loadMappingFile", "10x/cxxtools", [largeFile]() {
+        return [largeFile]() {
+            std::ifstream input(largeFile);
+            cxxtools::JsonDeserializer deserializer(input);
+            deserializer.deserialize();
+            const cxxtools::SerializationInfo *mapping = deserializer.si()->findMember("physicsMapping");
+            fty::nut::MappingEntries entries;
+            for (const auto &i : *mapping) {
+                std::string value;
+                i.getValue(value);
+                entries.emplace_back(i.name(), std::move(value));
+            }
+            return entries.size();
+        };
+    });
+
+    unlink(largeFile.c_str());
+}
+
+/**
+ * \brief Time to first mapping of a fresh process, loading mappings from mapping file or binary image.
+ */
+static void benchColdStart()
+{
+    static const int runs = 20;
+    const std::string mappingFile = s_options.mappingFile;
+    const std::string imageFile = s_options.imageFile;
+
+    if (!selected("cold_start")) {
+        return;
+    }
+
+    for (const bool image : { false, true }) {
+        std::vector<uint64_t> times;
+        long peakRss = 0;
+
+        for (int run = 0; run < runs; run++) {
+            int fds[2];
+            if (pipe(fds) < 0) {
+                break;
+            }
+
+            long rss = runInChild([&]() {
+                close(fds[0]);
+                const auto start = std::chrono::steady_clock::now();
+                size_t result = 0;
+                try {
+                    for (const auto &type : { "physicsMapping", "inventoryMapping" }) {
+                        const auto mapping = image ?
+                            fty::nut::loadCompiledMapping(mappingFile, type, imageFile) :
+                            fty::nut::loadCompiledMapping(mappingFile, type);
+                        result += mapping.size();
+                    }
+                }
+                catch (...) {
+                    _exit(1);
+                }
+                s_sink = result;
+                const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                ssize_t written = write(fds[1], &ns, sizeof(ns));
+                _exit(written == sizeof(ns) ? 0 : 1);
+            });
+            close(fds[1]);
+
+            uint64_t ns;
+            if (rss >= 0 && read(fds[0], &ns, sizeof(ns)) == sizeof(ns)) {
+                times.push_back(ns);
+                peakRss = std::max(peakRss, rss);
+            }
+            close(fds[0]);
+        }
+
+        const char *corpus = image ? "image" : "json";
+        if (times.size() != runs) {
+            std::cout << "{\"benchmark\":\"cold_start\",\"corpus\":\"" << corpus << "\",\"error\":\"failed run\"}" << std::endl;
+            continue;
+        }
+        std::sort(times.begin(), times.end());
+        std::cout << "{\"benchmark\":\"cold_start\",\"corpus\":\"" << corpus << "\",\"runs\":" << runs
+            << ",\"median_ns\":" << times[runs / 2] << ",\"peak_rss_kb\":" << peakRss << "}" << std::endl;
+    }
+}
+
+/**
+ * \brief Serve "LIST VAR" requests like upsd, one connection at a time, from pre-formatted replies.
+ * \return Port listened on (0 on failure).
+ */
+static uint16_t startFakeUpsd(const std::map<std::string, fty::nut::KeyValues> &devices)
+{
+    auto replies = std::make_shared<std::map<std::string, std::string>>();
+    for (const auto &device : devices) {
+        std::string reply = "BEGIN LIST VAR " + device.first + "\n";
+        for (const auto &value : device.second) {
+            reply += "VAR " + device.first + " " + value.first + " \"" + value.second + "\"\n";
+        }
+        (*replies)["LIST VAR " + device.first] = reply + "END LIST VAR " + device.first + "\n";
+    }
+
+    const int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listenFd < 0 ||
+        bind(listenFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(listenFd, 16) < 0 ||
+        getsockname(listenFd, reinterpret_cast<struct sockaddr *>(&address), &length) < 0) {
+        return 0;
+    }
+
+    std::thread([listenFd, replies]() {
+        for (;;) {
+            const int fd = accept(listenFd, nullptr, nullptr);
+            std::string buffer;
+            char data[4096];
+            ssize_t ret;
+            while (fd >= 0 && (ret = recv(fd, data, sizeof(data), 0)) > 0) {
+                buffer.append(data, ret);
+                std::string out;
+                size_t eol;
+                while ((eol = buffer.find('\n')) != std::string::npos) {
+                    const auto reply = replies->find(buffer.substr(0, eol));
+                    out += reply != replies->end() ? reply->second : "ERR UNKNOWN-UPS\n";
+                    buffer.erase(0, eol + 1);
+                }
+                if (send(fd, out.data(), out.size(), MSG_NOSIGNAL) < 0) {
+                    break;
+                }
+            }
+            close(fd);
+        }
+    }).detach();
+
+    return ntohs(address.sin_port);
+}
+
+/**
+ * \brief Run a command and return its output, like the driver dumps do.
+ */
+static std::string readCommandOutput(const char *path, const char *argument)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        throw std::runtime_error("pipe failed");
+    }
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        execl(path, path, argument, nullptr);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    std::string output;
+    char data[16384];
+    ssize_t ret;
+    while ((ret = read(fds[0], data, sizeof(data))) > 0) {
+        output.append(data, ret);
+    }
+    close(fds[0]);
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error(std::string("command ") + path + " failed");
+    }
+    return output;
+}
+
+/**
+ * \brief Reading values of many ePDUs from upsd (pipelined, per request or per connection) vs spawning a process per dump.
+ */
+static void benchUpsd()
+{
+    static const int devices = 100;
+    const std::string corpus = "epdu-" + std::to_string(devices);
+
+    auto generate = []() {
+        std::mt19937 generator(5);
+        std::map<std::string, fty::nut::KeyValues> result;
+        for (int i = 0; i < devices; i++) {
+            result["epdu" + std::to_string(i)] = fty::nut::parseDumpOutput(generateEpduDump(generator, i, 48));
+        }
+        return result;
+    };
+
+    for (const std::string mode : { "pipelined", "sequential", "reconnect" }) {
+        bench("upsd", corpus + "/" + mode, [generate, mode]() -> std::function<size_t()> {
+            const auto dumps = generate();
+            const uint16_t port = startFakeUpsd(dumps);
+            if (!port) {
+                throw std::runtime_error("can't start fake upsd");
+            }
+
+            std::vector<std::string> names;
+            for (const auto &dump : dumps) {
+                names.push_back(dump.first);
+            }
+
+            auto client = std::make_shared<fty::nut::UpsdClient>("127.0.0.1", port);
+            return [client, names, mode, port]() {
+                size_t result = 0;
+                if (mode == "pipelined") {
+                    for (const auto &values : client->listVars(names)) {
+                        result += values.size();
+                    }
+                }
+                else {
+                    for (const auto &name : names) {
+                        if (mode == "reconnect") {
+                            client->close();
+                        }
+                        result += client->listVars(name).size();
+                    }
+                }
+                return result;
+            };
+        });
+    }
+
+    // Baseline: a process spawned per device (cat of a dump, far cheaper than a driver).
+    const std::string file = "/tmp/fty_common_nut_bench_dump." + std::to_string(getpid());
+    bench("spawn_dump", corpus, [file]() -> std::function<size_t()> {
+        std::mt19937 generator(5);
+        std::ofstream(file) << generateEpduDump(generator, 0, 48);
+
+        return [file]() {
+            size_t result = 0;
+            for (int i = 0; i < devices; i++) {
+                result += fty::nut::parseDumpOutput(readCommandOutput("/bin/cat", file.c_str())).size();
+            }
+            return result;
+        };
+    });
+    unlink(file.c_str());
+}
+
+/**
+ * \brief Concurrent fake drivers supervised by the single reactor thread, each outputting 3 loops of an ePDU dump 100 ms apart.
+ */
+static void benchReactor()
+{
+    static const int loops = 3;
+
+    if (!selected("reactor")) {
+        return;
+    }
+
+    const std::string file = "/tmp/fty_common_nut_bench_driver." + std::to_string(getpid());
+    {
+        std::mt19937 generator(6);
+        std::ofstream(file) << generateEpduDump(generator, 0, 48);
+    }
+    const std::string script = "i=0; while [ $i -lt " + std::to_string(loops) + " ]; do cat " + file + "; sleep 0.1; i=$((i+1)); done";
+
+    for (int concurrency : { 1, 16, 64, 256, 512 }) {
+        long ret = runInChild([&script, concurrency]() {
+            // Each child takes 3 descriptors (2 pipes and a pidfd).
+            struct rlimit limit;
+            if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
+
+            std::mutex mutex;
+            std::condition_variable condition;
+            int running = concurrency;
+            int failed = 0;
+            std::atomic<uint64_t> bytes(0);
+
+            struct rusage before, after;
+            getrusage(RUSAGE_SELF, &before);
+            const auto start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < concurrency; i++) {
+                fty::nut::priv::runCommandAsync(
+                    { "/bin/sh", "-c", script },
+                    [&bytes](const char *, size_t length) { bytes += length; },
+                    [](const char *, size_t) {},
+                    [&](fty::nut::priv::CommandStatus status, int ret) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (status != fty::nut::priv::CommandStatus::Exited || ret != 0) {
+                            failed++;
+                        }
+                        if (--running == 0) {
+                            condition.notify_all();
+                        }
+                    },
+                    std::chrono::steady_clock::now() + std::chrono::seconds(60)
+                );
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&running]() { return running == 0; });
+            const auto wall = std::chrono::steady_clock::now() - start;
+            getrusage(RUSAGE_SELF, &after);
+
+            auto cpuUs = [](const struct rusage &usage) {
+                return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+            };
+            const double wallMs = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(wall).count();
+
+            std::cout << "{\"benchmark\":\"reactor\",\"concurrency\":" << concurrency
+                << ",\"failed\":" << failed
+                << ",\"wall_ms\":" << static_cast<uint64_t>(wallMs)
+                << ",\"reactor_cpu_ms\":" << (cpuUs(after) - cpuUs(before)) / 1000
+                << ",\"output_mb\":" << bytes.load() / 1000000.0
+                << ",\"children_per_s\":" << static_cast<uint64_t>(concurrency * 1000.0 / wallMs) << "}" << std::endl;
+        });
+
+        if (ret < 0) {
+            std::cout << "{\"benchmark\":\"reactor\",\"concurrency\":" << concurrency << ",\"error\":\"child process failed\"}" << std::endl;
+        }
+    }
+
+    unlink(file.c_str());
+}
+
+/**
+ * \brief Peak RSS of holding parsed dumps of many devices over several polls, with and without interning.
+ *
+ * Measurements change on every poll, so that a pool interning them would keep growing.
+ */
+static void benchInternRss()
+{
+    static const int outlets = 42;
+    static const int polls = 10;
+    const int devices = s_options.devices;
+
+    if (!selected("intern_rss")) {
+        return;
+    }
+
+    auto run = [devices](int mode) {
+        std::mt19937 generator(1);
+        fty::nut::StringPool pool;
+        std::vector<fty::nut::KeyValues> plain(devices);
+        std::vector<fty::nut::PooledKeyValues> interned(devices);
+
+        for (int poll = 0; poll < polls; poll++) {
+            for (int i = 0; i < devices; i++) {
+                const std::string dump = generateEpduDump(generator, i, outlets);
+                if (mode == 1) {
+                    plain[i] = fty::nut::parseDumpOutput(dump);
+                }
+                else if (mode == 2) {
+                    interned[i] = fty::nut::parseDumpOutput(dump, pool);
+                }
+            }
+        }
+        s_sink = pool.size();
+    };
+
+    static const char *modes[] = { "baseline", "plain", "interned" };
+    for (int mode = 0; mode < 3; mode++) {
+        long rss = runInChild([&run, mode]() { run(mode); });
+        std::cout << "{\"benchmark\":\"intern_rss\",\"mode\":\"" << modes[mode] << "\",\"devices\":" << devices
+            << ",\"polls\":" << polls << ",\"peak_rss_kb\":" << rss << "}" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    for (int argn = 1; argn < argc; argn++) {
+        if (streq(argv[argn], "--filter") && argn + 1 < argc) {
+            s_options.filter = argv[++argn];
+        }
+        else if (streq(argv[argn], "--mapping") && argn + 1 < argc) {
+            s_options.mappingFile = argv[++argn];
+        }
+        else if (streq(argv[argn], "--image") && argn + 1 < argc) {
+            s_options.imageFile = argv[++argn];
+        }
+        else if (streq(argv[argn], "--devices") && argn + 1 < argc) {
+            s_options.devices = atoi(argv[++argn]);
+        }
+        else if (streq(argv[argn], "--min-time") && argn + 1 < argc) {
+            s_options.minTimeMs = atoi(argv[++argn]);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--filter substring] [--mapping file] [--image file] [--devices N] [--min-time ms]" << std::endl;
+            return 1;
+        }
+    }
+
+    benchParse();
+    benchConvert();
+    benchLoadMappingFile();
+    benchBatchMapping();
+    benchColdStart();
+    benchUpsd();
+    benchReactor();
+    benchInternRss();
+
+    return 0;
+}
@@ -28,14 +28,85 @@
 
 #include "fty_common_nut_classes.h"
 
-#include <cxxtools/jsondeserializer.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <random>
 #include <regex>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 namespace fty {
 namespace nut {
 
+/**
+ * \brief Match a key against "device\.([[:digit:]]+)\.(.+)" (daisy-chained device property).
+ * \param key Key to match.
+ * \param indexLength Set to length of daisy-chain index on match.
+ * \return True if key matched.
+ */
+static bool matchDaisychainKey(const char *key, size_t length, size_t &indexLength)
+{
+    static const char prefix[] = "device.";
+    static const size_t prefixLength = sizeof(prefix) - 1;
+
+    if (length < prefixLength || std::memcmp(key, prefix, prefixLength) != 0) {
+        return false;
+    }
+
+    size_t i = prefixLength;
+    while (i < length && key[i] >= '0' && key[i] <= '9') {
+        i++;
+    }
+
+    // Index, dot and a non-empty property without line terminators.
+    if (i == prefixLength || i + 1 >= length || key[i] != '.') {
+        return false;
+    }
+    for (size_t j = i + 1; j < length; j++) {
+        if (key[j] == '\n' || key[j] == '\r') {
+            return false;
+        }
+    }
+
+    indexLength = i - prefixLength;
+    return true;
+}
+
+/**
+ * \brief Match a key against "device\.([^[:digit:]].*)" (host device property).
+ */
+static bool matchDeviceKey(const char *key, size_t length)
+{
+    static const char prefix[] = "device.";
+    static const size_t prefixLength = sizeof(prefix) - 1;
+
+    if (length <= prefixLength || std::memcmp(key, prefix, prefixLength) != 0) {
+        return false;
+    }
+    if (key[prefixLength] >= '0' && key[prefixLength] <= '9') {
+        return false;
+    }
+    for (size_t j = prefixLength + 1; j < length; j++) {
+        if (key[j] == '\n' || key[j] == '\r') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static std::string performSingleMapping(const KeyValues &mapping, const std::string &key, int daisychain)
 {
     const static std::regex prefixRegex(R"xxx(device\.([[:digit:]]+)\.(.+))xxx", std::regex::optimize);
@@ -64,14 +135,28 @@ static std::string performSingleMapping(const KeyValues &mapping, const std::str
     return mappedKey == mapping.cend() ? "" : mappedKey->second;
 }
 
-KeyValues performMapping(const KeyValues &mapping, const KeyValues &values, int daisychain)
+static const std::string& valueText(const std::string &value)
+{
+    return value;
+}
+
+static const std::string& valueText(const TypedValue &value)
+{
+    return value.text;
+}
+
+/**
+ * \brief Perform mapping, for any map of values keyed by NUT variable name.
+ */
+template <typename Values>
+static Values performMappingImpl(const KeyValues &mapping, const Values &values, int daisychain)
 {
     const static std::regex overrideRegex(R"xxx(device\.([^[:digit:]].*))xxx", std::regex::optimize);
     const std::string strDaisychain = std::to_string(daisychain);
 
-    KeyValues mappedValues;
+    Values mappedValues;
 
-    for (auto value : values) {
+    for (const auto &value : values) {
         const std::string mappedKey = performSingleMapping(mapping, value.first, daisychain);
 
         // Let daisy-chained device data override host device data (device.<id>.<property> => device.<property> or <property>).
@@ -90,7 +175,7 @@ KeyValues performMapping(const KeyValues &mapping, const KeyValues &values, int
         }
 
         if (!mappedKey.empty()) {
-            log_trace("Mapped property '%s' to '%s' (value='%s').", value.first.c_str(), mappedKey.c_str(), value.second.c_str());
+            log_trace("Mapped property '%s' to '%s' (value='%s').", value.first.c_str(), mappedKey.c_str(), valueText(value.second).c_str());
             mappedValues.emplace(mappedKey, value.second);
         }
     }
@@ -99,114 +184,2475 @@ KeyValues performMapping(const KeyValues &mapping, const KeyValues &values, int
     return mappedValues;
 }
 
-KeyValues loadMapping(const std::string &file, const std::string &type)
+KeyValues performMapping(const KeyValues &mapping, const KeyValues &values, int daisychain)
 {
-    KeyValues result;
-    std::stringstream err;
+    return performMappingImpl(mapping, values, daisychain);
+}
 
-    std::ifstream input(file);
-    if (!input) {
-        err << "Error opening file '" << file << "'";
-        throw std::runtime_error(err.str());
+TypedKeyValues performMapping(const KeyValues &mapping, const TypedKeyValues &values, int daisychain)
+{
+    return performMappingImpl(mapping, values, daisychain);
+}
+
+/**
+ * \brief Look up a composite key in a map keyed by interned strings, which can only be there if it was interned.
+ */
+template <typename Map>
+static typename Map::const_iterator findInterned(const Map &map, const std::string &key, const StringPool &pool)
+{
+    InternedString handle;
+    return pool.find(key, handle) ? map.find(handle) : map.end();
+}
+
+/**
+ * \brief Perform mapping on interned data, for any map of values keyed by interned NUT variable name.
+ */
+template <typename Values>
+static Values performInternedMapping(const InternedKeyValues &mapping, const Values &values, int daisychain, const StringPool &pool)
+{
+    const std::string strDaisychain = std::to_string(daisychain);
+    std::string scratch;
+
+    Values mappedValues;
+
+    for (const auto &value : values) {
+        const std::string &key = value.first.str();
+        InternedKeyValues::const_iterator mappedKey;
+
+        // Daisy-chained special case, need to fold it back into conventional case.
+        size_t indexLength;
+        if (daisychain > 0 && matchDaisychainKey(key.data(), key.size(), indexLength)) {
+            if (key.compare(7, indexLength, strDaisychain) == 0) {
+                // We have a "device.<id>.<property>" property, map it to either device.<property> or <property>.
+                scratch.assign("device.").append(key, 8 + indexLength, std::string::npos);
+                mappedKey = findInterned(mapping, scratch, pool);
+                if (mappedKey == mapping.end()) {
+                    mappedKey = findInterned(mapping, key.substr(8 + indexLength), pool);
+                }
+            }
+            else {
+                // Not the daisy-chained index we're looking for.
+                mappedKey = findInterned(mapping, std::string(), pool);
+            }
+        }
+        else {
+            mappedKey = mapping.find(value.first);
+        }
+
+        // Let daisy-chained device data override host device data (device.<id>.<property> => device.<property> or <property>).
+        if (daisychain > 0 && matchDeviceKey(key.data(), key.size())) {
+            scratch.assign("device.").append(strDaisychain).append(".").append(key, 7, std::string::npos);
+            if (findInterned(values, scratch, pool) != values.end()) {
+                log_trace("Ignoring overriden property '%s' during mapping (daisy-chain override).", key.c_str());
+                continue;
+            }
+        }
+
+        // Let input.L1.current override input.current (3-phase UPS).
+        if (key == "input.current" && findInterned(values, "input.L1.current", pool) != values.end()) {
+            log_trace("Ignoring overriden property '%s' during mapping (3-phase UPS input current override).", key.c_str());
+            continue;
+        }
+
+        if (mappedKey != mapping.end() && !mappedKey->second.empty()) {
+            log_trace("Mapped property '%s' to '%s' (value='%s').", key.c_str(), mappedKey->second.c_str(), value.second.c_str());
+            mappedValues.emplace(mappedKey->second, value.second);
+        }
     }
 
-    // Parse JSON.
-    cxxtools::SerializationInfo si;
-    cxxtools::JsonDeserializer deserializer(input);
-    try {
-        deserializer.deserialize();
+    log_trace("Mapped %d/%d properties.", mappedValues.size(), values.size());
+    return mappedValues;
+}
+
+InternedKeyValues performMapping(const InternedKeyValues &mapping, const InternedKeyValues &values, int daisychain, const StringPool &pool)
+{
+    return performInternedMapping(mapping, values, daisychain, pool);
+}
+
+PooledKeyValues performMapping(const InternedKeyValues &mapping, const PooledKeyValues &values, int daisychain, const StringPool &pool)
+{
+    return performInternedMapping(mapping, values, daisychain, pool);
+}
+
+static const uint64_t hashOffsetBasis = 14695981039346656037ULL;
+
+/// Maximum number of daisy-chained devices mapped by performDaisychainMapping().
+static const size_t maxDaisychainMembers = 1024;
+
+/**
+ * \brief Continue a FNV-1a hash over more data.
+ */
+static uint64_t hashKey(uint64_t hash, const char *key, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 1099511628211ULL;
     }
-    catch (std::exception &e) {
-        err << "Couldn't parse mapping file '" << file << "': " << e.what() << ".";
-        throw std::runtime_error(err.str());
+    return hash;
+}
+
+/**
+ * \brief FNV-1a hash of a key.
+ */
+static uint64_t hashKey(const char *key, size_t length)
+{
+    return hashKey(hashOffsetBasis, key, length);
+}
+
+/**
+ * \brief Streaming parser of mapping files.
+ *
+ * Parses JSON (with C and C++ style comments) straight from a stream buffer,
+ * without building a document tree. Values which aren't wanted are skipped
+ * without being stored.
+ */
+class MappingFileParser
+{
+public:
+    MappingFileParser(std::streambuf &input) :
+        m_input(input)
+    {
     }
 
-    const cxxtools::SerializationInfo *mapping = deserializer.si()->findMember(type);
-    if (mapping == nullptr) {
-        err << "No mapping type '" << type << "' in mapping file '" << file << "'.";
-        throw std::runtime_error(err.str());
+    /**
+     * \brief Skip blanks and comments, then peek at the next character (EOF at end of input).
+     */
+    int peek()
+    {
+        for (;;) {
+            int c = m_input.sgetc();
+            if (c == '\n') {
+                m_line++;
+            }
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                m_input.sbumpc();
+                continue;
+            }
+            if (c != '/') {
+                return c;
+            }
+
+            m_input.sbumpc();
+            c = m_input.sbumpc();
+            if (c == '/') {
+                while ((c = m_input.sgetc()) != EOF && c != '\n') {
+                    m_input.sbumpc();
+                }
+            }
+            else if (c == '*') {
+                for (int previous = 0; (c = m_input.sbumpc()) != '/' || previous != '*'; previous = c) {
+                    if (c == EOF) {
+                        error("unterminated comment");
+                    }
+                    if (c == '\n') {
+                        m_line++;
+                    }
+                }
+            }
+            else {
+                error("unexpected character '/'");
+            }
+        }
     }
-    if (mapping->category () != cxxtools::SerializationInfo::Category::Object) {
-        err << "Mapping type '" << type << "' in mapping file '" << file << "' is not a JSON object.";
-        throw std::runtime_error(err.str());
+
+    void expect(char expected)
+    {
+        if (peek() != expected) {
+            error(std::string("expected '") + expected + "'");
+        }
+        m_input.sbumpc();
     }
 
-    // Convert all mappings.
-    for (const auto& i : *mapping) {
-        std::string name = i.name();
+    /**
+     * \brief Parse a string, into value if not null.
+     */
+    void parseString(std::string *value)
+    {
+        expect('"');
+        if (value) {
+            value->clear();
+        }
 
-        try {
-            if (i.category () != cxxtools::SerializationInfo::Category::Value) {
-                throw std::runtime_error("Not a JSON atomic value");
+        for (;;) {
+            int c = m_input.sbumpc();
+            if (c == '"') {
+                return;
+            }
+            if (c == EOF || c == '\n') {
+                error("unterminated string");
+            }
+            if (c == '\\') {
+                c = m_input.sbumpc();
+                switch (c) {
+                    case '"': case '\\': case '/': break;
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'n': c = '\n'; break;
+                    case 'r': c = '\r'; break;
+                    case 't': c = '\t'; break;
+                    case 'u':
+                        appendCodePoint(value, parseCodePoint());
+                        continue;
+                    default:
+                        error("invalid escape sequence in string");
+                }
+            }
+            if (value) {
+                value->push_back(static_cast<char>(c));
             }
+        }
+    }
 
-            std::string value;
-            i.getValue(value);
+    /**
+     * \brief Parse a number, true, false or null, into value if not null.
+     * \return False for null.
+     */
+    bool parseLiteral(std::string *value)
+    {
+        std::string literal;
+        for (int c; (c = m_input.sgetc()) != EOF && (std::isalnum(c) || c == '-' || c == '+' || c == '.'); m_input.sbumpc()) {
+            literal.push_back(static_cast<char>(c));
+        }
+
+        if (literal == "null") {
+            return false;
+        }
+        if (literal != "true" && literal != "false" && !isNumber(literal)) {
+            error(literal.empty() ? "expected value" : "invalid value '" + literal + "'");
+        }
+        if (value) {
+            *value = std::move(literal);
+        }
+        return true;
+    }
+
+    /**
+     * \brief Parse members of an object, calling member(name) for each with the stream at its value.
+     */
+    template <typename Function>
+    void parseObject(std::string &name, Function member)
+    {
+        expect('{');
+        if (peek() == '}') {
+            m_input.sbumpc();
+            return;
+        }
 
-            auto x = name.find("#");
-            auto y = value.find("#");
-            if (x == std::string::npos || y == std::string::npos) {
-                // Normal mapping, insert it.
-                result.emplace(std::make_pair(name, value));
+        for (;;) {
+            parseString(&name);
+            expect(':');
+            member(name);
+
+            const int c = peek();
+            m_input.sbumpc();
+            if (c == '}') {
+                return;
             }
-            else {
-                // Template mapping, instanciate it.
-                for (int i = 1; i < 99; i++) {
-                    std::string instanceName = name;
-                    std::string instanceValue = value;
-                    instanceName.replace(x, 1, std::to_string(i));
-                    instanceValue.replace(y, 1, std::to_string(i));
-                    result.emplace(std::make_pair(instanceName, instanceValue));
+            if (c != ',') {
+                error("expected ',' or '}'");
+            }
+        }
+    }
+
+    void skipValue()
+    {
+        const int c = peek();
+        if (c == '"') {
+            parseString(nullptr);
+        }
+        else if (c == '{') {
+            std::string name;
+            parseObject(name, [this](const std::string &) { skipValue(); });
+        }
+        else if (c == '[') {
+            m_input.sbumpc();
+            if (peek() == ']') {
+                m_input.sbumpc();
+                return;
+            }
+            for (;;) {
+                skipValue();
+                const int next = peek();
+                m_input.sbumpc();
+                if (next == ']') {
+                    return;
+                }
+                if (next != ',') {
+                    error("expected ',' or ']'");
                 }
             }
         }
-        catch (std::exception &e) {
-            log_warning("Can't deserialize key '%s.%s' in mapping file '%s' into string: %s.", type.c_str(), name.c_str(), file.c_str(), e.what());
+        else {
+            parseLiteral(nullptr);
         }
     }
 
-    if (result.empty()) {
-        err << "Mapping type '" << type << "' in mapping file '" << file << "' is empty.";
-        throw std::runtime_error(err.str());
+    void expectEnd()
+    {
+        if (peek() != EOF) {
+            error("trailing data");
+        }
+    }
+
+    [[noreturn]] void error(const std::string &what) const
+    {
+        throw std::runtime_error(what + " at line " + std::to_string(m_line));
+    }
+
+private:
+    /**
+     * \brief Check a literal against the JSON number grammar -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][-+]?[0-9]+)?.
+     */
+    static bool isNumber(const std::string &literal)
+    {
+        const char *it = literal.data();
+        const char *end = it + literal.size();
+        auto digits = [&it, end]() {
+            const char *begin = it;
+            while (it != end && *it >= '0' && *it <= '9') {
+                it++;
+            }
+            return it != begin;
+        };
+
+        if (it != end && *it == '-') {
+            it++;
+        }
+        if (it != end && *it == '0') {
+            it++;
+        }
+        else if (!digits()) {
+            return false;
+        }
+        if (it != end && *it == '.') {
+            it++;
+            if (!digits()) {
+                return false;
+            }
+        }
+        if (it != end && (*it == 'e' || *it == 'E')) {
+            it++;
+            if (it != end && (*it == '-' || *it == '+')) {
+                it++;
+            }
+            if (!digits()) {
+                return false;
+            }
+        }
+        return it == end;
+    }
+
+    unsigned parseCodePoint()
+    {
+        unsigned codePoint = parseHex();
+        if (codePoint >= 0xd800 && codePoint < 0xdc00) {
+            // High surrogate, must be followed by a low surrogate.
+            if (m_input.sbumpc() != '\\' || m_input.sbumpc() != 'u') {
+                error("invalid surrogate pair in string");
+            }
+            const unsigned low = parseHex();
+            if (low < 0xdc00 || low >= 0xe000) {
+                error("invalid surrogate pair in string");
+            }
+            codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+        }
+        else if (codePoint >= 0xdc00 && codePoint < 0xe000) {
+            error("invalid surrogate pair in string");
+        }
+        return codePoint;
+    }
+
+    unsigned parseHex()
+    {
+        unsigned result = 0;
+        for (int i = 0; i < 4; i++) {
+            const int c = m_input.sbumpc();
+            if (!std::isxdigit(c)) {
+                error("invalid unicode escape in string");
+            }
+            result = result * 16 + (std::isdigit(c) ? c - '0' : (std::tolower(c) - 'a' + 10));
+        }
+        return result;
+    }
+
+    static void appendCodePoint(std::string *value, unsigned codePoint)
+    {
+        if (!value) {
+            return;
+        }
+        if (codePoint < 0x80) {
+            value->push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800) {
+            value->push_back(static_cast<char>(0xc0 | (codePoint >> 6)));
+            value->push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+        else if (codePoint < 0x10000) {
+            value->push_back(static_cast<char>(0xe0 | (codePoint >> 12)));
+            value->push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+            value->push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+        else {
+            value->push_back(static_cast<char>(0xf0 | (codePoint >> 18)));
+            value->push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f)));
+            value->push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+            value->push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
     }
+
+    std::streambuf &m_input;
+    size_t m_line = 1;
+};
+
+/**
+ * \brief Parse the entries of a mapping type, warning about values which aren't atomic.
+ */
+static MappingEntries parseMappingType(MappingFileParser &parser, const std::string &file, const std::string &type)
+{
+    MappingEntries result;
+    std::string key;
+    std::string value;
+
+    parser.parseObject(key, [&](const std::string &name) {
+        const int c = parser.peek();
+        if (c == '"') {
+            parser.parseString(&value);
+        }
+        else if (c == '{' || c == '[' || !parser.parseLiteral(&value)) {
+            if (c == '{' || c == '[') {
+                parser.skipValue();
+            }
+            log_warning("Can't deserialize key '%s.%s' in mapping file '%s' into string: %s.", type.c_str(), name.c_str(), file.c_str(), "Not a JSON atomic value");
+            return;
+        }
+        result.emplace_back(name, std::move(value));
+    });
+
     return result;
 }
 
-}
+std::map<std::string, MappingEntries> loadMappingFile(const std::string &file, const std::vector<std::string> &types)
+{
+    std::map<std::string, MappingEntries> result;
+    // Requested types which were seen but aren't objects (only the first member of a given name counts).
+    std::set<std::string> seen;
+    std::set<std::string> notObjects;
+    std::stringstream err;
+
+    std::filebuf input;
+    if (!input.open(file, std::ios::in | std::ios::binary)) {
+        err << "Error opening file '" << file << "'";
+        throw std::runtime_error(err.str());
+    }
+
+    // Parse JSON in one pass, only building the requested mapping types.
+    try {
+        MappingFileParser parser(input);
+        std::string member;
+
+        if (parser.peek() != '{') {
+            parser.skipValue();
+        }
+        else {
+            parser.parseObject(member, [&](const std::string &type) {
+                const bool requested = types.empty() || std::find(types.begin(), types.end(), type) != types.end();
+                const bool first = seen.insert(type).second;
+
+                if (requested && first && parser.peek() == '{') {
+                    result[type] = parseMappingType(parser, file, type);
+                }
+                else {
+                    if (requested && first && !types.empty()) {
+                        notObjects.insert(type);
+                    }
+                    parser.skipValue();
+                }
+            });
+        }
+        parser.expectEnd();
+    }
+    catch (std::exception &e) {
+        err << "Couldn't parse mapping file '" << file << "': " << e.what() << ".";
+        throw std::runtime_error(err.str());
+    }
+
+    for (const auto &type : types) {
+        if (!seen.count(type)) {
+            err << "No mapping type '" << type << "' in mapping file '" << file << "'.";
+            throw std::runtime_error(err.str());
+        }
+        if (notObjects.count(type)) {
+            err << "Mapping type '" << type << "' in mapping file '" << file << "' is not a JSON object.";
+            throw std::runtime_error(err.str());
+        }
+        if (result[type].empty()) {
+            err << "Mapping type '" << type << "' in mapping file '" << file << "' is empty.";
+            throw std::runtime_error(err.str());
+        }
+    }
+
+    return result;
 }
 
-//  --------------------------------------------------------------------------
-//  Self test of this class
+/**
+ * \brief Read the entries of a mapping, in file order and with templates left unexpanded.
+ * \throw std::runtime_error if the mapping can't be loaded or is empty.
+ */
+static MappingEntries loadMappingEntries(const std::string &file, const std::string &type)
+{
+    return std::move(loadMappingFile(file, { type })[type]);
+}
 
-void fty_common_nut_convert_test(bool verbose)
+/**
+ * \brief Expand mapping entries into a regular mapping, instanciating templates for indexes 1 to 98.
+ */
+static KeyValues expandMappingEntries(const MappingEntries &entries)
 {
-    std::cout << " * fty_common_nut_convert: ";
+    KeyValues result;
 
-    const static std::vector<std::pair<std::string, std::string>> invalidTestCases = {
-        { "src/selftest-ro/nosuchfile.conf", "noSuchMapping" },
-        { "src/selftest-ro/mappingInvalid.conf", "noSuchMapping" },
-        { "src/selftest-ro/mappingValid.conf", "noSuchMapping" },
-        { "src/selftest-ro/mappingValid.conf", "emptyMapping" },
-        { "src/selftest-ro/mappingValid.conf", "badMapping" }
-    } ;
+    for (const auto &entry : entries) {
+        const std::string &name = entry.first;
+        const std::string &value = entry.second;
 
-    // Test invalid mapping cases.
-    for (const auto& i : invalidTestCases) {
-        bool caughtException = false;
-        try {
-            fty::nut::KeyValues mapping = fty::nut::loadMapping(i.first, i.second);
+        auto x = name.find("#");
+        auto y = value.find("#");
+        if (x == std::string::npos || y == std::string::npos) {
+            // Normal mapping, insert it.
+            result.emplace(std::make_pair(name, value));
         }
-        catch (...) {
-            caughtException = true;
+        else {
+            // Template mapping, instanciate it.
+            for (int i = 1; i < 99; i++) {
+                std::string instanceName = name;
+                std::string instanceValue = value;
+                instanceName.replace(x, 1, std::to_string(i));
+                instanceValue.replace(y, 1, std::to_string(i));
+                result.emplace(std::make_pair(instanceName, instanceValue));
+            }
         }
-        assert(caughtException);
     }
 
-    // Test valid mapping cases.
-    const auto physicsMapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", "physicsMapping");
-    const auto inventoryMapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", "inventoryMapping");
-    assert(!physicsMapping.empty());
-    assert(!inventoryMapping.empty());
+    return result;
+}
+
+struct CompiledMapping::Data
+{
+    enum Flags : uint32_t {
+        /// Key matches "device\.([^[:digit:]].*)", subject to daisy-chain override.
+        FLAG_DEVICE_PROPERTY = 1 << 0,
+        /// Key is "input.current", subject to 3-phase override.
+        FLAG_INPUT_CURRENT = 1 << 1
+    };
+
+    /// Maximum number of digits of a template index, so that it fits an int.
+    static const size_t maxIndexDigits = 9;
+    /// Placeholder position of entries which aren't templates.
+    static const uint32_t noPlaceholder = UINT32_MAX;
+
+    /**
+     * \brief Mapping entry, laid out identically in memory and in binary images.
+     */
+    struct Entry
+    {
+        uint32_t keyOffset;
+        uint32_t keyLength;
+        uint32_t mappedKeyOffset;
+        uint32_t mappedKeyLength;
+        /// Position of the '#' placeholder in the mapped key of templates, noPlaceholder otherwise.
+        uint32_t placeholder;
+        uint32_t flags;
+    };
+
+    /**
+     * \brief Open-addressing hash table of entry indexes, with linear probing.
+     *
+     * Templates are indexed by their key pattern, placeholder included.
+     */
+    struct Table
+    {
+        /// Slots hold entry index + 1, 0 for empty slots. Their number is a power of two.
+        const uint32_t *slots = nullptr;
+        uint32_t slotCount = 0;
+        /// Number of indexed entries.
+        uint32_t count = 0;
+        /// Offset of the indexed part of keys.
+        uint32_t skip = 0;
+        /// Bit n is set if a template has a placeholder at (indexed) position n, bit 63 for positions from 63 on.
+        uint64_t placeholderPositions = 0;
+
+        void build(const Data &data, const std::vector<uint32_t> &indexes, std::vector<uint32_t> &storage)
+        {
+            count = indexes.size();
+            placeholderPositions = 0;
+            size_t capacity = 8;
+            while (capacity < indexes.size() * 2) {
+                capacity *= 2;
+            }
+            storage.assign(capacity, 0);
+
+            for (uint32_t index : indexes) {
+                const Entry &entry = data.entries[index];
+                const char *key = data.strings + entry.keyOffset + skip;
+                if (entry.placeholder != noPlaceholder) {
+                    const size_t position = static_cast<const char *>(std::memchr(key, '#', entry.keyLength - skip)) - key;
+                    placeholderPositions |= 1ULL << std::min<size_t>(position, 63);
+                }
+
+                size_t slot = hashKey(key, entry.keyLength - skip) & (capacity - 1);
+                while (storage[slot]) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                storage[slot] = index + 1;
+            }
+
+            slots = storage.data();
+            slotCount = capacity;
+        }
+
+        /**
+         * \brief Find the entry whose (indexed part of) key is prefix, an optional placeholder and suffix.
+         */
+        const Entry *find(const Data &data, const char *prefix, size_t prefixLength, bool placeholder,
+            const char *suffix, size_t suffixLength, uint64_t hash) const
+        {
+            const size_t length = prefixLength + (placeholder ? 1 : 0) + suffixLength;
+            const size_t mask = slotCount - 1;
+
+            for (size_t slot = hash & mask; slots[slot]; slot = (slot + 1) & mask) {
+                const Entry &entry = data.entries[slots[slot] - 1];
+                if (entry.keyLength - skip != length) {
+                    continue;
+                }
+
+                const char *key = data.strings + entry.keyOffset + skip;
+                if (std::memcmp(key, prefix, prefixLength) == 0 &&
+                    (!placeholder || key[prefixLength] == '#') &&
+                    std::memcmp(key + length - suffixLength, suffix, suffixLength) == 0) {
+                    return &entry;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    /**
+     * \brief Result of a lookup.
+     */
+    struct Match
+    {
+        const Entry *entry;
+        /// Template index in the looked up key.
+        const char *index;
+        size_t indexLength;
+    };
+
+    /**
+     * \brief Piece of a string.
+     */
+    struct Piece
+    {
+        const char *data;
+        size_t size;
+    };
+
+    /// All keys and mapped keys, concatenated.
+    const char *strings = nullptr;
+    size_t stringsSize = 0;
+    /// Entries, in mapping order (earlier entries take precedence).
+    const Entry *entries = nullptr;
+    size_t entryCount = 0;
+    /// Entries by key.
+    Table keys;
+    /// Templates by key pattern.
+    Table templates;
+    /// Entries of "device.<property>" keys, by property.
+    Table deviceProperties;
+    /// Templates of "device.<property>" keys, by property pattern.
+    Table deviceTemplates;
+    /// Entry of the empty key, which daisy-chained properties of other devices fold into.
+    const Entry *emptyKey = nullptr;
+
+    /// Storage of compiled mappings.
+    std::string stringsStorage;
+    std::vector<Entry> entriesStorage;
+    std::vector<uint32_t> slotsStorage[4];
+
+    /// Storage of memory-mapped mappings.
+    std::shared_ptr<const void> image;
+
+    /**
+     * \brief Counters of a mapping call, published once at the end of the call.
+     */
+    struct Counts
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t seen = 0;
+        uint64_t mapped = 0;
+        uint64_t unmapped = 0;
+        uint64_t daisychainOverridden = 0;
+        uint64_t threePhaseOverridden = 0;
+    };
+
+    /// Statistics of mapping calls (see MappingStatistics).
+    mutable std::atomic<uint64_t> calls { 0 };
+    mutable std::atomic<uint64_t> seen { 0 };
+    mutable std::atomic<uint64_t> mapped { 0 };
+    mutable std::atomic<uint64_t> unmapped { 0 };
+    mutable std::atomic<uint64_t> daisychainOverridden { 0 };
+    mutable std::atomic<uint64_t> threePhaseOverridden { 0 };
+    mutable std::atomic<uint64_t> latency[MappingStatistics::latencyBuckets] {};
+
+    void record(const Counts &counts) const
+    {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - counts.start).count();
+        size_t bucket = 0;
+        for (uint64_t ns = elapsed > 0 ? elapsed : 0; ns > 1 && bucket < MappingStatistics::latencyBuckets - 1; ns >>= 1) {
+            bucket++;
+        }
+
+        calls.fetch_add(1, std::memory_order_relaxed);
+        seen.fetch_add(counts.seen, std::memory_order_relaxed);
+        mapped.fetch_add(counts.mapped, std::memory_order_relaxed);
+        unmapped.fetch_add(counts.unmapped, std::memory_order_relaxed);
+        daisychainOverridden.fetch_add(counts.daisychainOverridden, std::memory_order_relaxed);
+        threePhaseOverridden.fetch_add(counts.threePhaseOverridden, std::memory_order_relaxed);
+        latency[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Data(const MappingEntries &mapping, bool keepTemplates)
+    {
+        static const char devicePrefix[] = "device.";
+        static const size_t devicePrefixLength = sizeof(devicePrefix) - 1;
+
+        std::vector<uint32_t> keyIndexes, templateIndexes, deviceKeyIndexes, deviceTemplateIndexes;
+        entriesStorage.reserve(mapping.size());
+
+        for (const auto &i : mapping) {
+            const std::string &key = i.first;
+            const uint32_t index = entriesStorage.size();
+
+            const size_t keyPlaceholder = keepTemplates ? key.find('#') : std::string::npos;
+            const size_t placeholder = keyPlaceholder != std::string::npos ? i.second.find('#') : std::string::npos;
+            const bool isTemplate = placeholder != std::string::npos;
+
+            // Flags only depend on the key pattern, not on the template index.
+            std::string instance = key;
+            if (isTemplate) {
+                instance.replace(keyPlaceholder, 1, "1");
+            }
+
+            uint32_t flags = 0;
+            if (matchDeviceKey(instance.data(), instance.size())) {
+                flags |= FLAG_DEVICE_PROPERTY;
+            }
+            if (instance == "input.current") {
+                flags |= FLAG_INPUT_CURRENT;
+            }
+
+            Entry entry;
+            entry.keyOffset = stringsStorage.size();
+            entry.keyLength = key.size();
+            stringsStorage += key;
+            entry.mappedKeyOffset = stringsStorage.size();
+            entry.mappedKeyLength = i.second.size();
+            stringsStorage += i.second;
+            entry.placeholder = isTemplate ? placeholder : noPlaceholder;
+            entry.flags = flags;
+            entriesStorage.push_back(entry);
+
+            const bool isDeviceKey = key.compare(0, devicePrefixLength, devicePrefix) == 0;
+            (isTemplate ? templateIndexes : keyIndexes).push_back(index);
+            if (isDeviceKey) {
+                (isTemplate ? deviceTemplateIndexes : deviceKeyIndexes).push_back(index);
+            }
+        }
+
+        if (stringsStorage.size() > UINT32_MAX) {
+            throw std::runtime_error("Mapping is too large.");
+        }
+
+        strings = stringsStorage.data();
+        stringsSize = stringsStorage.size();
+        entries = entriesStorage.data();
+        entryCount = entriesStorage.size();
+
+        keys.build(*this, keyIndexes, slotsStorage[0]);
+        templates.build(*this, templateIndexes, slotsStorage[1]);
+        deviceProperties.skip = devicePrefixLength;
+        deviceProperties.build(*this, deviceKeyIndexes, slotsStorage[2]);
+        deviceTemplates.skip = devicePrefixLength;
+        deviceTemplates.build(*this, deviceTemplateIndexes, slotsStorage[3]);
+
+        emptyKey = keys.find(*this, "", 0, false, "", 0, hashKey("", 0));
+    }
+
+    /**
+     * \brief Refer to a mapping stored in a memory-mapped image, checked beforehand.
+     */
+    Data(std::shared_ptr<const void> imageStorage) :
+        image(std::move(imageStorage))
+    {
+    }
+
+    Table *tables() { return &keys; }
+
+    /**
+     * \brief Look up a key, both as is and as an instance of a template.
+     *
+     * Every run of digits without leading zero is tried as the template
+     * index. If several entries match, the earliest one wins.
+     *
+     * \return True if an entry matched.
+     */
+    bool lookup(const Table &exact, const Table &patterns, const char *key, size_t length, uint64_t hash, Match &match) const
+    {
+        match.entry = exact.find(*this, key, length, false, "", 0, hash);
+        match.index = nullptr;
+        match.indexLength = 0;
+
+        if (patterns.count == 0) {
+            return match.entry;
+        }
+
+        uint64_t prefixHash = hashOffsetBasis;
+        for (size_t i = 0; i < length && key[i] != '#'; prefixHash = hashKey(prefixHash, key + i, 1), i++) {
+            if (key[i] < '1' || key[i] > '9' || !(patterns.placeholderPositions & (1ULL << std::min<size_t>(i, 63)))) {
+                continue;
+            }
+
+            const uint64_t placeholderHash = hashKey(prefixHash, "#", 1);
+            for (size_t j = i + 1; j <= length && j - i <= maxIndexDigits && key[j - 1] >= '0' && key[j - 1] <= '9'; j++) {
+                const Entry *entry = patterns.find(*this, key, i, true, key + j, length - j, hashKey(placeholderHash, key + j, length - j));
+                if (entry && (!match.entry || entry < match.entry)) {
+                    match.entry = entry;
+                    match.index = key + i;
+                    match.indexLength = j - i;
+                }
+            }
+        }
+
+        return match.entry;
+    }
+
+    /**
+     * \brief Resolve the entry a NUT variable is mapped through.
+     * \param key NUT variable.
+     * \param daisychain Daisy-chain index of device as a string (empty if not daisy-chained).
+     * \param direct Set to true if the variable was looked up as is.
+     * \param match Set to the matching entry.
+     * \return True if the variable is mapped.
+     */
+    bool resolve(const std::string &key, const std::string &daisychain, bool &direct, Match &match) const
+    {
+        size_t indexLength;
+
+        direct = true;
+        if (daisychain.empty() || !matchDaisychainKey(key.data(), key.size(), indexLength)) {
+            return lookup(keys, templates, key.data(), key.size(), hashKey(key.data(), key.size()), match);
+        }
+
+        // Daisy-chained special case, fold "device.<id>.<property>" into device.<property> or <property>.
+        direct = false;
+        if (key.compare(7, indexLength, daisychain) != 0) {
+            // Not the daisy-chained index we're looking for.
+            match = Match { emptyKey, nullptr, 0 };
+            return match.entry;
+        }
+
+        return resolveProperty(key.data() + 8 + indexLength, key.size() - 8 - indexLength, match);
+    }
+
+    /**
+     * \brief Resolve the entry the property of a daisy-chained device is mapped through (device.<property> or <property>).
+     */
+    bool resolveProperty(const char *property, size_t length, Match &match) const
+    {
+        const uint64_t hash = hashKey(property, length);
+
+        return lookup(deviceProperties, deviceTemplates, property, length, hash, match) ||
+            lookup(keys, templates, property, length, hash, match);
+    }
+
+    Piece key(const Entry &entry) const
+    {
+        return Piece { strings + entry.keyOffset, entry.keyLength };
+    }
+
+    /**
+     * \brief Get the mapped key of a match.
+     * \param match Match.
+     * \param scratch Storage for mapped keys of templates.
+     */
+    Piece mappedKey(const Match &match, std::string &scratch) const
+    {
+        const Entry &entry = *match.entry;
+        const char *mapped = strings + entry.mappedKeyOffset;
+        if (entry.placeholder == noPlaceholder) {
+            return Piece { mapped, entry.mappedKeyLength };
+        }
+
+        scratch.assign(mapped, entry.placeholder)
+            .append(match.index, match.indexLength)
+            .append(mapped + entry.placeholder + 1, entry.mappedKeyLength - entry.placeholder - 1);
+        return Piece { scratch.data(), scratch.size() };
+    }
+};
+
+CompiledMapping::CompiledMapping() :
+    m_data(std::make_shared<Data>(MappingEntries(), false))
+{
+}
+
+CompiledMapping::CompiledMapping(const KeyValues &mapping) :
+    m_data(std::make_shared<Data>(MappingEntries(mapping.begin(), mapping.end()), false))
+{
+}
+
+CompiledMapping::CompiledMapping(const MappingEntries &mapping) :
+    m_data(std::make_shared<Data>(mapping, true))
+{
+}
+
+CompiledMapping::CompiledMapping(std::shared_ptr<const Data> data) :
+    m_data(std::move(data))
+{
+}
+
+bool CompiledMapping::find(const char *key, size_t length, std::string &mappedKey) const
+{
+    Data::Match match;
+    if (!m_data->lookup(m_data->keys, m_data->templates, key, length, hashKey(key, length), match)) {
+        return false;
+    }
+
+    const Data::Piece piece = m_data->mappedKey(match, mappedKey);
+    if (piece.data != mappedKey.data()) {
+        mappedKey.assign(piece.data, piece.size);
+    }
+    return true;
+}
+
+MappingStatistics CompiledMapping::statistics() const
+{
+    MappingStatistics statistics;
+    statistics.calls = m_data->calls.load(std::memory_order_relaxed);
+    statistics.seen = m_data->seen.load(std::memory_order_relaxed);
+    statistics.mapped = m_data->mapped.load(std::memory_order_relaxed);
+    statistics.unmapped = m_data->unmapped.load(std::memory_order_relaxed);
+    statistics.daisychainOverridden = m_data->daisychainOverridden.load(std::memory_order_relaxed);
+    statistics.threePhaseOverridden = m_data->threePhaseOverridden.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < MappingStatistics::latencyBuckets; i++) {
+        statistics.latency[i] = m_data->latency[i].load(std::memory_order_relaxed);
+    }
+    return statistics;
+}
+
+void CompiledMapping::resetStatistics() const
+{
+    m_data->calls = 0;
+    m_data->seen = 0;
+    m_data->mapped = 0;
+    m_data->unmapped = 0;
+    m_data->daisychainOverridden = 0;
+    m_data->threePhaseOverridden = 0;
+    for (auto &bucket : m_data->latency) {
+        bucket = 0;
+    }
+}
+
+size_t CompiledMapping::size() const
+{
+    return m_data->entryCount;
+}
+
+KeyValues CompiledMapping::toKeyValues() const
+{
+    KeyValues result;
+
+    for (size_t i = 0; i < m_data->entryCount; i++) {
+        const Data::Entry &entry = m_data->entries[i];
+        const std::string key(m_data->strings + entry.keyOffset, entry.keyLength);
+        const std::string mappedKey(m_data->strings + entry.mappedKeyOffset, entry.mappedKeyLength);
+        if (entry.placeholder == Data::noPlaceholder) {
+            result.emplace(key, mappedKey);
+            continue;
+        }
+
+        // Instanciate templates like loadMapping() does.
+        const size_t keyPlaceholder = key.find('#');
+        for (int i = 1; i < 99; i++) {
+            std::string instanceName = key;
+            std::string instanceValue = mappedKey;
+            instanceName.replace(keyPlaceholder, 1, std::to_string(i));
+            instanceValue.replace(entry.placeholder, 1, std::to_string(i));
+            result.emplace(std::move(instanceName), std::move(instanceValue));
+        }
+    }
+
+    return result;
+}
+
+/**
+ * \brief Perform mapping with a compiled mapping, for any map of values keyed by NUT variable name.
+ * \param record Whether to record the call in the statistics of the mapping.
+ */
+template <typename Values>
+static Values performCompiledMapping(const CompiledMapping::Data &mapping, const Values &values, int daisychain, bool record = true)
+{
+    static const std::string inputL1Current = "input.L1.current";
+    static thread_local std::string scratch;
+    static thread_local std::string mappedScratch;
+
+    CompiledMapping::Data::Counts counts;
+    const std::string strDaisychain = daisychain > 0 ? std::to_string(daisychain) : std::string();
+    const bool threePhase = values.count(inputL1Current);
+
+    Values mappedValues;
+
+    for (const auto &value : values) {
+        const std::string &key = value.first;
+
+        bool direct;
+        CompiledMapping::Data::Match match;
+        if (!mapping.resolve(key, strDaisychain, direct, match) || match.entry->mappedKeyLength == 0) {
+            counts.unmapped++;
+            continue;
+        }
+
+        if (direct) {
+            // Let daisy-chained device data override host device data (device.<id>.<property> => device.<property> or <property>).
+            if (!strDaisychain.empty() && (match.entry->flags & CompiledMapping::Data::FLAG_DEVICE_PROPERTY)) {
+                scratch.assign("device.").append(strDaisychain).append(".").append(key, 7, std::string::npos);
+                if (values.count(scratch)) {
+                    counts.daisychainOverridden++;
+                    continue;
+                }
+            }
+
+            // Let input.L1.current override input.current (3-phase UPS).
+            if (threePhase && (match.entry->flags & CompiledMapping::Data::FLAG_INPUT_CURRENT)) {
+                counts.threePhaseOverridden++;
+                continue;
+            }
+        }
+
+        const CompiledMapping::Data::Piece mappedKey = mapping.mappedKey(match, mappedScratch);
+        mappedValues.emplace(std::piecewise_construct, std::forward_as_tuple(mappedKey.data, mappedKey.size), std::forward_as_tuple(value.second));
+        counts.mapped++;
+    }
+
+    log_trace("Mapped %d/%d properties.", mappedValues.size(), values.size());
+    if (record) {
+        counts.seen = values.size();
+        mapping.record(counts);
+    }
+    return mappedValues;
+}
+
+KeyValues CompiledMapping::resolve(const KeyValues &values, int daisychain) const
+{
+    return performCompiledMapping(*m_data, values, daisychain, false);
+}
+
+KeyValues performMapping(const CompiledMapping &mapping, const KeyValues &values, int daisychain)
+{
+    return performCompiledMapping(*mapping.m_data, values, daisychain);
+}
+
+TypedKeyValues performMapping(const CompiledMapping &mapping, const TypedKeyValues &values, int daisychain)
+{
+    return performCompiledMapping(*mapping.m_data, values, daisychain);
+}
+
+/**
+ * \brief Parse a daisy-chain index, as written by NUT (no sign, no leading zero).
+ * \return Index, or 0 if invalid or above maxDaisychainMembers.
+ */
+static size_t parseDaisychainIndex(const char *index, size_t length)
+{
+    if (length == 0 || length > 9 || index[0] < '1' || index[0] > '9') {
+        return 0;
+    }
+
+    size_t result = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (index[i] < '0' || index[i] > '9') {
+            return 0;
+        }
+        result = result * 10 + (index[i] - '0');
+    }
+    return result <= maxDaisychainMembers ? result : 0;
+}
+
+/**
+ * \brief Count daisy-chain members, from device.count or else from the highest index seen.
+ */
+template <typename Values>
+static size_t countDaisychainMembers(const Values &values)
+{
+    static const std::string deviceCount = "device.count";
+
+    auto count = values.find(deviceCount);
+    if (count != values.end()) {
+        const std::string &text = valueText(count->second);
+        return parseDaisychainIndex(text.data(), text.size());
+    }
+
+    // Keys of daisy-chained devices are contiguous in the map.
+    size_t members = 0;
+    for (auto it = values.lower_bound("device."); it != values.end() && it->first.compare(0, 7, "device.") == 0; ++it) {
+        size_t indexLength;
+        if (matchDaisychainKey(it->first.data(), it->first.size(), indexLength)) {
+            members = std::max(members, parseDaisychainIndex(it->first.data() + 7, indexLength));
+        }
+    }
+    return members;
+}
+
+/**
+ * \brief Perform mapping of all daisy-chain members in one pass over the values.
+ */
+template <typename Values>
+static std::vector<Values> performCompiledDaisychainMapping(const CompiledMapping::Data &mapping, const Values &values)
+{
+    static const std::string inputL1Current = "input.L1.current";
+    static thread_local std::string scratch;
+    static thread_local std::string mappedScratch;
+
+    const size_t members = countDaisychainMembers(values);
+    std::vector<Values> mappedValues(members);
+
+    if (mapping.emptyKey && mapping.emptyKey->mappedKeyLength != 0) {
+        // Properties of other members fold into the empty key, which is mapped. Map each member on its own.
+        for (size_t member = 1; member <= members; member++) {
+            mappedValues[member - 1] = performCompiledMapping(mapping, values, member);
+        }
+        return mappedValues;
+    }
+
+    CompiledMapping::Data::Counts counts;
+    std::vector<std::string> prefixes;
+    for (size_t member = 1; member <= members; member++) {
+        prefixes.push_back("device." + std::to_string(member) + ".");
+    }
+    const bool threePhase = values.count(inputL1Current);
+
+    for (const auto &value : values) {
+        const std::string &key = value.first;
+        CompiledMapping::Data::Match match;
+
+        // Daisy-chained device property, map it for its member only.
+        size_t indexLength;
+        if (matchDaisychainKey(key.data(), key.size(), indexLength)) {
+            const size_t member = parseDaisychainIndex(key.data() + 7, indexLength);
+            if (member == 0 || member > members) {
+                counts.unmapped++;
+                continue;
+            }
+
+            if (mapping.resolveProperty(key.data() + 8 + indexLength, key.size() - 8 - indexLength, match) && match.entry->mappedKeyLength != 0) {
+                const CompiledMapping::Data::Piece mappedKey = mapping.mappedKey(match, mappedScratch);
+                mappedValues[member - 1].emplace(std::piecewise_construct, std::forward_as_tuple(mappedKey.data, mappedKey.size), std::forward_as_tuple(value.second));
+                counts.mapped++;
+            }
+            else {
+                counts.unmapped++;
+            }
+            continue;
+        }
+
+        // Host device property, map it for all members.
+        if (!mapping.lookup(mapping.keys, mapping.templates, key.data(), key.size(), hashKey(key.data(), key.size()), match) ||
+            match.entry->mappedKeyLength == 0) {
+            counts.unmapped++;
+            continue;
+        }
+
+        // Let input.L1.current override input.current (3-phase UPS).
+        if (threePhase && (match.entry->flags & CompiledMapping::Data::FLAG_INPUT_CURRENT)) {
+            counts.threePhaseOverridden += members;
+            continue;
+        }
+
+        const CompiledMapping::Data::Piece mappedPiece = mapping.mappedKey(match, mappedScratch);
+        const std::string mappedKey(mappedPiece.data, mappedPiece.size);
+        for (size_t member = 0; member < members; member++) {
+            // Let daisy-chained device data override host device data (device.<id>.<property> => device.<property> or <property>).
+            if (match.entry->flags & CompiledMapping::Data::FLAG_DEVICE_PROPERTY) {
+                scratch.assign(prefixes[member]).append(key, 7, std::string::npos);
+                if (values.count(scratch)) {
+                    counts.daisychainOverridden++;
+                    continue;
+                }
+            }
+
+            mappedValues[member].emplace(mappedKey, value.second);
+            counts.mapped++;
+        }
+    }
+
+    log_trace("Mapped %d properties for %d daisy-chained devices.", values.size(), members);
+    counts.seen = values.size();
+    mapping.record(counts);
+    return mappedValues;
+}
+
+std::vector<KeyValues> performDaisychainMapping(const CompiledMapping &mapping, const KeyValues &values)
+{
+    return performCompiledDaisychainMapping(*mapping.m_data, values);
+}
+
+std::vector<TypedKeyValues> performDaisychainMapping(const CompiledMapping &mapping, const TypedKeyValues &values)
+{
+    return performCompiledDaisychainMapping(*mapping.m_data, values);
+}
+
+std::vector<KeyValues> performDaisychainMapping(const KeyValues &mapping, const KeyValues &values)
+{
+    return performDaisychainMapping(CompiledMapping(mapping), values);
+}
+
+ReverseMapping::ReverseMapping() :
+    ReverseMapping(CompiledMapping())
+{
+}
+
+ReverseMapping::ReverseMapping(const CompiledMapping &mapping) :
+    m_data(mapping.m_data)
+{
+    for (uint32_t i = 0; i < m_data->entryCount; i++) {
+        const CompiledMapping::Data::Entry &entry = m_data->entries[i];
+        if (entry.mappedKeyLength == 0) {
+            continue;
+        }
+
+        std::string mappedKey(m_data->strings + entry.mappedKeyOffset, entry.mappedKeyLength);
+        auto &index = entry.placeholder == CompiledMapping::Data::noPlaceholder ? m_keys : m_templates;
+        index[std::move(mappedKey)].push_back(i);
+    }
+}
+
+std::vector<std::string> ReverseMapping::find(const std::string &mappedKey, int daisychain) const
+{
+    std::vector<std::string> candidates;
+
+    auto exact = m_keys.find(mappedKey);
+    if (exact != m_keys.end()) {
+        for (uint32_t i : exact->second) {
+            const CompiledMapping::Data::Piece key = m_data->key(m_data->entries[i]);
+            candidates.emplace_back(key.data, key.size);
+        }
+    }
+
+    // Try every run of digits of the mapped key as a template index.
+    for (size_t begin = 0; begin < mappedKey.size() && !m_templates.empty(); begin++) {
+        for (size_t end = begin; end < mappedKey.size() && mappedKey[end] >= '0' && mappedKey[end] <= '9'; end++) {
+            const std::string pattern = std::string(mappedKey, 0, begin) + '#' + std::string(mappedKey, end + 1);
+            auto templates = m_templates.find(pattern);
+            if (templates == m_templates.end()) {
+                continue;
+            }
+
+            for (uint32_t i : templates->second) {
+                const CompiledMapping::Data::Piece piece = m_data->key(m_data->entries[i]);
+                std::string key(piece.data, piece.size);
+                key.replace(key.find('#'), 1, mappedKey, begin, end + 1 - begin);
+                candidates.emplace_back(std::move(key));
+            }
+        }
+    }
+
+    // Properties of a daisy-chained device may come from its own variables.
+    const std::string strDaisychain = daisychain > 0 ? std::to_string(daisychain) : std::string();
+    if (!strDaisychain.empty()) {
+        const std::string prefix = "device." + strDaisychain + ".";
+        for (size_t i = 0, count = candidates.size(); i < count; i++) {
+            if (candidates[i].compare(0, 7, "device.") == 0) {
+                candidates.emplace_back(prefix + candidates[i].substr(7));
+            }
+            candidates.emplace_back(prefix + candidates[i]);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    // Keep candidates which the forward mapping actually maps to the key.
+    std::string scratch;
+    std::vector<std::string> keys;
+    for (auto &candidate : candidates) {
+        bool direct;
+        CompiledMapping::Data::Match match;
+        if (!m_data->resolve(candidate, strDaisychain, direct, match) || match.entry->mappedKeyLength == 0) {
+            continue;
+        }
+
+        const CompiledMapping::Data::Piece piece = m_data->mappedKey(match, scratch);
+        if (mappedKey.compare(0, std::string::npos, piece.data, piece.size) == 0) {
+            keys.emplace_back(std::move(candidate));
+        }
+    }
+    return keys;
+}
+
+ReverseMapping loadReverseMapping(const std::string &file, const std::string &type)
+{
+    return ReverseMapping(loadCompiledMapping(file, type));
+}
+
+std::vector<KeyValues> performBatchMapping(const CompiledMapping &mapping, const MappingInput *inputs, size_t count, unsigned threads)
+{
+    std::vector<KeyValues> results(count);
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    // Small chunks balance load, several per thread keep contention on the cursor low.
+    const size_t chunk = std::max<size_t>(count / (threads * 8), 1);
+    threads = std::min<size_t>(threads, (count + chunk - 1) / chunk);
+
+    std::atomic<size_t> cursor(0);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    auto work = [&]() {
+        try {
+            for (size_t begin; (begin = cursor.fetch_add(chunk)) < count; ) {
+                const size_t end = std::min(begin + chunk, count);
+                for (size_t i = begin; i < end; i++) {
+                    results[i] = performMapping(mapping, *inputs[i].values, inputs[i].daisychain);
+                }
+            }
+        }
+        catch (...) {
+            // Stop everyone at the first error.
+            cursor = count;
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return results;
+}
+
+std::vector<KeyValues> performBatchMapping(const CompiledMapping &mapping, const std::vector<MappingInput> &inputs, unsigned threads)
+{
+    return performBatchMapping(mapping, inputs.data(), inputs.size(), threads);
+}
+
+CompiledMapping loadCompiledMapping(const std::string &file, const std::string &type)
+{
+    return CompiledMapping(loadMappingEntries(file, type));
+}
+
+/**
+ * \brief Header of binary mapping images.
+ *
+ * The header is followed by the descriptions of the mapping types, then by
+ * the name, strings, entries and hash table slots of each type, each aligned
+ * on 8 bytes. Offsets are from the start of the image.
+ */
+struct MappingImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    /// mappingImageByteOrder, as written by the host.
+    uint32_t byteOrder;
+    /// Size and hash of the mapping file the image was compiled from.
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    uint32_t typeCount;
+    uint32_t reserved;
+};
+
+struct MappingImageTable
+{
+    uint64_t slotsOffset;
+    uint64_t placeholderPositions;
+    uint32_t slotCount;
+    uint32_t count;
+    uint32_t skip;
+    uint32_t reserved;
+};
+
+struct MappingImageType
+{
+    uint64_t nameOffset;
+    uint64_t stringsOffset;
+    uint64_t entriesOffset;
+    uint32_t nameLength;
+    uint32_t stringsSize;
+    uint32_t entryCount;
+    /// Index of the entry of the empty key, UINT32_MAX if none.
+    uint32_t emptyKey;
+    MappingImageTable tables[4];
+};
+
+static const char mappingImageMagic[8] = { 'F', 'T', 'Y', 'N', 'U', 'T', 'M', 'B' };
+static const uint32_t mappingImageVersion = 1;
+static const uint32_t mappingImageByteOrder = 0x01020304;
+
+static_assert(sizeof(CompiledMapping::Data::Entry) == 24, "Unexpected layout of mapping entries");
+static_assert(sizeof(MappingImageHeader) == 40, "Unexpected layout of mapping image header");
+static_assert(sizeof(MappingImageType) == 168, "Unexpected layout of mapping image type");
+
+/**
+ * \brief Compute size and hash of a file.
+ * \return False if the file can't be read.
+ */
+static bool hashFile(const std::string &file, uint64_t &size, uint64_t &hash)
+{
+    std::ifstream input(file, std::ios::binary);
+    if (!input) {
+        return false;
+    }
+
+    char buffer[65536];
+    size = 0;
+    hash = hashOffsetBasis;
+    while (input) {
+        input.read(buffer, sizeof(buffer));
+        size += input.gcount();
+        hash = hashKey(hash, buffer, input.gcount());
+    }
+    return input.eof();
+}
+
+static void alignImage(std::string &image)
+{
+    image.resize((image.size() + 7) & ~static_cast<size_t>(7), '\0');
+}
+
+template <typename T>
+static uint64_t appendImage(std::string &image, const T *data, size_t count)
+{
+    alignImage(image);
+    const uint64_t offset = image.size();
+    image.append(reinterpret_cast<const char *>(data), sizeof(T) * count);
+    return offset;
+}
+
+void compileMappingImage(const std::string &file, const std::string &image)
+{
+    MappingImageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, mappingImageMagic, sizeof(header.magic));
+    header.version = mappingImageVersion;
+    header.byteOrder = mappingImageByteOrder;
+
+    // Hash the mapping file before loading it, so that a concurrent change yields a stale image.
+    if (!hashFile(file, header.sourceSize, header.sourceHash)) {
+        throw std::runtime_error("Error opening file '" + file + "'");
+    }
+
+    std::vector<std::pair<std::string, std::unique_ptr<CompiledMapping::Data>>> types;
+    for (const auto &type : loadMappingFile(file)) {
+        if (!type.second.empty()) {
+            types.emplace_back(type.first, std::unique_ptr<CompiledMapping::Data>(new CompiledMapping::Data(type.second, true)));
+        }
+    }
+    header.typeCount = types.size();
+
+    std::vector<MappingImageType> typeHeaders(types.size());
+    std::string contents(sizeof(MappingImageHeader) + sizeof(MappingImageType) * types.size(), '\0');
+
+    for (size_t i = 0; i < types.size(); i++) {
+        const CompiledMapping::Data &data = *types[i].second;
+        MappingImageType &typeHeader = typeHeaders[i];
+
+        typeHeader.nameLength = types[i].first.size();
+        typeHeader.nameOffset = appendImage(contents, types[i].first.data(), types[i].first.size());
+        typeHeader.stringsSize = data.stringsSize;
+        typeHeader.stringsOffset = appendImage(contents, data.strings, data.stringsSize);
+        typeHeader.entryCount = data.entryCount;
+        typeHeader.entriesOffset = appendImage(contents, data.entries, data.entryCount);
+        typeHeader.emptyKey = data.emptyKey ? data.emptyKey - data.entries : UINT32_MAX;
+
+        const CompiledMapping::Data::Table *tables = &data.keys;
+        for (size_t j = 0; j < 4; j++) {
+            MappingImageTable &table = typeHeader.tables[j];
+            table.slotCount = tables[j].slotCount;
+            table.count = tables[j].count;
+            table.skip = tables[j].skip;
+            table.reserved = 0;
+            table.placeholderPositions = tables[j].placeholderPositions;
+            table.slotsOffset = appendImage(contents, tables[j].slots, tables[j].slotCount);
+        }
+    }
+
+    std::memcpy(&contents[0], &header, sizeof(header));
+    if (!typeHeaders.empty()) {
+        std::memcpy(&contents[sizeof(header)], typeHeaders.data(), sizeof(MappingImageType) * typeHeaders.size());
+    }
+
+    // Replace the image atomically, so that readers never see a partial one.
+    priv::writeFileAtomically(image, contents.data(), contents.size());
+}
+
+static bool inImage(uint64_t offset, uint64_t size, size_t imageSize)
+{
+    return offset <= imageSize && size <= imageSize - offset;
+}
+
+/**
+ * \brief Check a mapping type of an image and refer to it.
+ * \return Compiled mapping data, or nullptr if the type is invalid.
+ */
+static std::shared_ptr<const CompiledMapping::Data> mapImageType(std::shared_ptr<const void> image, size_t imageSize, const MappingImageType &type)
+{
+    typedef CompiledMapping::Data Data;
+
+    const char *base = static_cast<const char *>(image.get());
+    if (!inImage(type.stringsOffset, type.stringsSize, imageSize) ||
+        type.entriesOffset % alignof(Data::Entry) != 0 ||
+        !inImage(type.entriesOffset, uint64_t(type.entryCount) * sizeof(Data::Entry), imageSize) ||
+        (type.emptyKey != UINT32_MAX && type.emptyKey >= type.entryCount)) {
+        return nullptr;
+    }
+
+    const Data::Entry *entries = reinterpret_cast<const Data::Entry *>(base + type.entriesOffset);
+    for (size_t i = 0; i < type.entryCount; i++) {
+        const Data::Entry &entry = entries[i];
+        if (uint64_t(entry.keyOffset) + entry.keyLength > type.stringsSize ||
+            uint64_t(entry.mappedKeyOffset) + entry.mappedKeyLength > type.stringsSize ||
+            (entry.placeholder != Data::noPlaceholder && entry.placeholder >= entry.mappedKeyLength)) {
+            return nullptr;
+        }
+    }
+
+    auto data = std::make_shared<Data>(image);
+    data->strings = base + type.stringsOffset;
+    data->stringsSize = type.stringsSize;
+    data->entries = entries;
+    data->entryCount = type.entryCount;
+    data->emptyKey = type.emptyKey != UINT32_MAX ? entries + type.emptyKey : nullptr;
+
+    Data::Table *tables = &data->keys;
+    for (size_t j = 0; j < 4; j++) {
+        const MappingImageTable &table = type.tables[j];
+
+        // Slots must be a power of two with at least one free, and refer to entries with long enough keys.
+        if (table.slotCount == 0 || (table.slotCount & (table.slotCount - 1)) != 0 || table.count >= table.slotCount ||
+            table.slotsOffset % alignof(uint32_t) != 0 ||
+            !inImage(table.slotsOffset, uint64_t(table.slotCount) * sizeof(uint32_t), imageSize)) {
+            return nullptr;
+        }
+
+        const uint32_t *slots = reinterpret_cast<const uint32_t *>(base + table.slotsOffset);
+        size_t used = 0;
+        for (size_t slot = 0; slot < table.slotCount; slot++) {
+            if (slots[slot] == 0) {
+                continue;
+            }
+            if (slots[slot] > type.entryCount || entries[slots[slot] - 1].keyLength < table.skip) {
+                return nullptr;
+            }
+            used++;
+        }
+        if (used != table.count) {
+            return nullptr;
+        }
+
+        tables[j].slots = slots;
+        tables[j].slotCount = table.slotCount;
+        tables[j].count = table.count;
+        tables[j].skip = table.skip;
+        tables[j].placeholderPositions = table.placeholderPositions;
+    }
+
+    return data;
+}
+
+/**
+ * \brief Map a mapping type of a binary image.
+ * \return Compiled mapping data, or nullptr if the image can't be used.
+ */
+static std::shared_ptr<const CompiledMapping::Data> mapImage(const std::string &file, const std::string &type, const std::string &image)
+{
+    int fd = ::open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_debug("No mapping image '%s', loading mapping file '%s'.", image.c_str(), file.c_str());
+        return nullptr;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(MappingImageHeader))) {
+        ::close(fd);
+        log_warning("Invalid mapping image '%s', loading mapping file '%s'.", image.c_str(), file.c_str());
+        return nullptr;
+    }
+
+    const size_t imageSize = st.st_size;
+    void *address = ::mmap(nullptr, imageSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        log_warning("Can't map mapping image '%s', loading mapping file '%s'.", image.c_str(), file.c_str());
+        return nullptr;
+    }
+    std::shared_ptr<const void> mapped(address, [imageSize](const void *p) { ::munmap(const_cast<void *>(p), imageSize); });
+
+    const char *base = static_cast<const char *>(address);
+    const MappingImageHeader &header = *reinterpret_cast<const MappingImageHeader *>(base);
+    if (std::memcmp(header.magic, mappingImageMagic, sizeof(header.magic)) != 0 ||
+        header.version != mappingImageVersion || header.byteOrder != mappingImageByteOrder ||
+        !inImage(sizeof(MappingImageHeader), uint64_t(header.typeCount) * sizeof(MappingImageType), imageSize)) {
+        log_warning("Invalid or incompatible mapping image '%s', loading mapping file '%s'.", image.c_str(), file.c_str());
+        return nullptr;
+    }
+
+    uint64_t sourceSize, sourceHash;
+    if (hashFile(file, sourceSize, sourceHash) && (sourceSize != header.sourceSize || sourceHash != header.sourceHash)) {
+        log_info("Stale mapping image '%s', loading mapping file '%s'.", image.c_str(), file.c_str());
+        return nullptr;
+    }
+
+    const MappingImageType *types = reinterpret_cast<const MappingImageType *>(base + sizeof(MappingImageHeader));
+    for (size_t i = 0; i < header.typeCount; i++) {
+        if (!inImage(types[i].nameOffset, types[i].nameLength, imageSize) ||
+            type.compare(0, std::string::npos, base + types[i].nameOffset, types[i].nameLength) != 0) {
+            continue;
+        }
+
+        auto data = mapImageType(mapped, imageSize, types[i]);
+        if (!data) {
+            log_warning("Invalid mapping type '%s' in mapping image '%s', loading mapping file '%s'.", type.c_str(), image.c_str(), file.c_str());
+        }
+        return data;
+    }
+
+    return nullptr;
+}
+
+CompiledMapping loadCompiledMapping(const std::string &file, const std::string &type, const std::string &image)
+{
+    auto data = mapImage(file, type, image);
+    if (data) {
+        return CompiledMapping(data);
+    }
+    return loadCompiledMapping(file, type);
+}
+
+InternedKeyValues loadMapping(const std::string &file, const std::string &type, StringPool &pool)
+{
+    return intern(loadMapping(file, type), pool);
+}
+
+KeyValues loadMapping(const std::string &file, const std::string &type)
+{
+    return expandMappingEntries(loadMappingEntries(file, type));
+}
+
+}
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+/**
+ * \brief Generate a synthetic device dump, optionally daisy-chained.
+ * \param generator Random generator.
+ * \param daisychainCount Number of daisy-chained devices (0 for a standalone device).
+ */
+static fty::nut::KeyValues generateDeviceDump(std::mt19937 &generator, int daisychainCount)
+{
+    static const std::vector<std::string> properties = {
+        "battery.charge", "battery.runtime", "device.model", "device.mfr", "device.serial", "device.type",
+        "ups.model", "ups.mfr", "ups.status", "ups.serial", "ups.alarm", "input.current", "input.L1.current",
+        "input.voltage", "outlet.count", "outlet.switchable", "outlet.group.count", "unmapped.property"
+    };
+    static const std::vector<std::string> outletProperties = {
+        "current", "voltage", "realpower", "power", "id", "status", "desc"
+    };
+
+    std::vector<std::string> prefixes;
+    if (daisychainCount == 0) {
+        prefixes.push_back("");
+    }
+    else {
+        prefixes.push_back("");
+        for (int i = 1; i <= daisychainCount; i++) {
+            prefixes.push_back("device." + std::to_string(i) + ".");
+        }
+    }
+
+    fty::nut::KeyValues values;
+    for (const auto &prefix : prefixes) {
+        for (const auto &property : properties) {
+            if (generator() % 3) {
+                values.emplace(prefix + property, std::to_string(generator() % 1000));
+            }
+        }
+
+        const int outletCount = generator() % 30;
+        for (int outlet = 1; outlet <= outletCount; outlet++) {
+            for (const auto &property : outletProperties) {
+                if (generator() % 4) {
+                    values.emplace(prefix + "outlet." + std::to_string(outlet) + "." + property, std::to_string(generator() % 1000));
+                }
+            }
+            if (generator() % 4 == 0) {
+                values.emplace(prefix + "outlet.group." + std::to_string(outlet) + ".load", std::to_string(generator() % 100));
+            }
+        }
+    }
+
+    if (daisychainCount) {
+        values.emplace("device.count", std::to_string(daisychainCount));
+    }
+
+    return values;
+}
+
+/**
+ * \brief Instanciate templates of mapping entries, like loadMapping() but up to an arbitrary index.
+ */
+static fty::nut::KeyValues expandTemplates(const fty::nut::MappingEntries &entries, int maxIndex)
+{
+    fty::nut::KeyValues result;
+
+    for (const auto &entry : entries) {
+        auto x = entry.first.find("#");
+        auto y = entry.second.find("#");
+        if (x == std::string::npos || y == std::string::npos) {
+            result.emplace(entry);
+            continue;
+        }
+
+        for (int i = 1; i <= maxIndex; i++) {
+            std::string instanceName = entry.first;
+            std::string instanceValue = entry.second;
+            instanceName.replace(x, 1, std::to_string(i));
+            instanceValue.replace(y, 1, std::to_string(i));
+            result.emplace(instanceName, instanceValue);
+        }
+    }
+
+    return result;
+}
+
+void fty_common_nut_convert_test(bool verbose)
+{
+    std::cout << " * fty_common_nut_convert: ";
+
+    const static std::vector<std::pair<std::string, std::string>> invalidTestCases = {
+        { "src/selftest-ro/nosuchfile.conf", "noSuchMapping" },
+        { "src/selftest-ro/mappingInvalid.conf", "noSuchMapping" },
+        { "src/selftest-ro/mappingValid.conf", "noSuchMapping" },
+        { "src/selftest-ro/mappingValid.conf", "emptyMapping" },
+        { "src/selftest-ro/mappingValid.conf", "badMapping" }
+    } ;
+
+    // Test invalid mapping cases.
+    for (const auto& i : invalidTestCases) {
+        bool caughtException = false;
+        try {
+            fty::nut::KeyValues mapping = fty::nut::loadMapping(i.first, i.second);
+        }
+        catch (...) {
+            caughtException = true;
+        }
+        assert(caughtException);
+    }
+
+    // Test valid mapping cases.
+    const auto physicsMapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", "physicsMapping");
+    const auto inventoryMapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", "inventoryMapping");
+    assert(!physicsMapping.empty());
+    assert(!inventoryMapping.empty());
+
+    // Test parsing of mapping files.
+    {
+        const std::string path = "src/selftest-rw/mappingParse.conf";
+        const auto writeFile = [&path](const std::string &contents) {
+            std::ofstream output(path, std::ios::binary | std::ios::trunc);
+            output << contents;
+        };
+
+        writeFile(R"xxx(
+// Comment before the document.
+{
+    "first" : { "a" : "1" },
+    /* Multi-line
+       comment. */
+    "physics" : {
+        "quote\"key" : "back\\slash/\/",
+        "escapes" : "\b\f\n\r\t",
+        "unicode" : "\u00e9\u20ac\ud83d\ude00",
+        "number" : 12.5e-3,
+        "negative" : -7,
+        "boolean" : true,
+        "null" : null,     // Skipped with a warning.
+        "object" : { "nested" : [ 1, { "a" : [] } ] },
+        "array" : [ "a", "b" ],
+        "last" : "value"
+    },
+    "skipped" : [ { "a" : "b" }, 1, null, false, "x" ],
+    "notObject" : 42,
+    "empty" : { },
+    "first" : { "b" : "2" }
+}
+)xxx");
+
+        const auto physics = fty::nut::loadMappingFile(path, { "physics" });
+        assert(physics.size() == 1);
+        assert((physics.at("physics") == fty::nut::MappingEntries {
+            { "quote\"key", "back\\slash//" },
+            { "escapes", "\b\f\n\r\t" },
+            { "unicode", "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80" },
+            { "number", "12.5e-3" },
+            { "negative", "-7" },
+            { "boolean", "true" },
+            { "last", "value" }
+        }));
+
+        // First member of a name counts, whether requested or loading all.
+        assert((fty::nut::loadMappingFile(path, { "first" }).at("first") == fty::nut::MappingEntries { { "a", "1" } }));
+        const auto all = fty::nut::loadMappingFile(path);
+        assert(all.size() == 3);
+        assert((all.at("first") == fty::nut::MappingEntries { { "a", "1" } }));
+        assert(all.at("empty").empty());
+        assert(all.at("physics") == physics.at("physics"));
+
+        for (const auto &type : { "notObject", "empty", "skipped", "missing" }) {
+            bool caughtException = false;
+            try {
+                fty::nut::loadMappingFile(path, { "physics", type });
+            }
+            catch (std::runtime_error &) {
+                caughtException = true;
+            }
+            assert(caughtException);
+        }
+
+        const std::vector<std::string> invalidFiles = {
+            "",
+            "{",
+            "{ \"a\" : { \"b\" : \"c\" } } }",
+            "{ \"a\" : { \"b\" : \"c\" }, }",
+            "{ \"a\" : { \"b\" : 'c' } }",
+            "{ \"a\" : { \"b\" : \"c } }",
+            "{ \"a\" : { \"b\" : \"c\n\" } }",
+            "{ \"a\" : { \"b\" : \"\\x\" } }",
+            "{ \"a\" : { \"b\" : \"\\u12\" } }",
+            "{ \"a\" : { \"b\" : \"\\ud83d\" } }",
+            "{ \"a\" : { \"b\" : 01 } }",
+            "{ \"a\" : { \"b\" : -01 } }",
+            "{ \"a\" : { \"b\" : - } }",
+            "{ \"a\" : { \"b\" : 1. } }",
+            "{ \"a\" : { \"b\" : .5 } }",
+            "{ \"a\" : { \"b\" : +1 } }",
+            "{ \"a\" : { \"b\" : 1e } }",
+            "{ \"a\" : { \"b\" : 1e+ } }",
+            "{ \"a\" : { \"b\" : 1.5.3 } }",
+            "{ \"a\" : { \"b\" : 0x1 } }",
+            "{ \"a\" : { \"b\" : nil } }",
+            "{ \"a\" : { \"b\" : \"c\" } } /* unterminated",
+            "{ \"a\" : { \"b\" : \"c\" } } / comment",
+            "{ \"a\" { \"b\" : \"c\" } }",
+            "{ \"a\" : [ 1 2 ] }"
+        };
+        for (const auto &invalidFile : invalidFiles) {
+            writeFile(invalidFile);
+            bool caughtException = false;
+            try {
+                fty::nut::loadMappingFile(path);
+            }
+            catch (std::runtime_error &e) {
+                caughtException = std::string(e.what()).find("Couldn't parse mapping file") == 0;
+            }
+            assert(caughtException);
+        }
+
+        for (const std::string number : { "0", "-0", "7", "-12", "0.5", "-0.25", "10e3", "1E-2", "2.5e+10", "-0e0" }) {
+            writeFile("{ \"a\" : { \"b\" : " + number + " } }");
+            assert((fty::nut::loadMappingFile(path).at("a") == fty::nut::MappingEntries { { "b", number } }));
+        }
+
+        // Documents which aren't objects have no mapping types.
+        writeFile("[ { \"a\" : { \"b\" : \"c\" } } ]");
+        assert(fty::nut::loadMappingFile(path).empty());
+        std::remove(path.c_str());
+    }
+
+    // Test typed mapping against regular mapping.
+    {
+        std::mt19937 generator(11);
+        for (int i = 0; i < 20; i++) {
+            const auto values = generateDeviceDump(generator, i % 4);
+            const auto typedValues = fty::nut::classifyValues(values);
+            for (int daisychain = 0; daisychain <= 4; daisychain++) {
+                const auto result = fty::nut::performMapping(physicsMapping, typedValues, daisychain);
+                const auto expected = fty::nut::performMapping(physicsMapping, values, daisychain);
+                assert(result.size() == expected.size());
+                for (const auto &it : result) {
+                    assert(it.second.text == expected.at(it.first));
+                    assert(it.second.type == fty::nut::TypedValue::TYPE_INTEGER);
+                }
+            }
+        }
+    }
+
+    // Test interned mapping against regular mapping.
+    {
+        fty::nut::StringPool pool;
+        std::mt19937 generator(10);
+
+        for (const auto &type : { "physicsMapping", "inventoryMapping" }) {
+            const auto mapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", type);
+            const auto internedMapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", type, pool);
+            assert(fty::nut::toKeyValues(internedMapping) == mapping);
+
+            for (int i = 0; i < 20; i++) {
+                const auto values = generateDeviceDump(generator, i % 4);
+                const auto internedValues = fty::nut::intern(values, pool);
+                const auto pooledValues = fty::nut::internVariables(values, pool);
+                for (int daisychain = 0; daisychain <= 4; daisychain++) {
+                    const auto expected = fty::nut::performMapping(mapping, values, daisychain);
+                    assert(fty::nut::toKeyValues(fty::nut::performMapping(internedMapping, internedValues, daisychain, pool)) == expected);
+                    assert(fty::nut::toKeyValues(fty::nut::performMapping(internedMapping, pooledValues, daisychain, pool)) == expected);
+                }
+            }
+        }
+    }
+
+    // Test compiled mapping against regular mapping.
+    {
+        std::mt19937 generator(12);
+
+        for (const auto &type : { "physicsMapping", "inventoryMapping" }) {
+            const auto mapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", type);
+            const auto compiledMapping = fty::nut::loadCompiledMapping("src/selftest-ro/mappingValid.conf", type);
+            assert(compiledMapping.toKeyValues() == mapping);
+            assert(compiledMapping.size() == fty::nut::loadMappingEntries("src/selftest-ro/mappingValid.conf", type).size());
+
+            for (int i = 0; i < 20; i++) {
+                const auto values = generateDeviceDump(generator, i % 4);
+                const auto typedValues = fty::nut::classifyValues(values);
+                for (int daisychain = 0; daisychain <= 4; daisychain++) {
+                    const auto expected = fty::nut::performMapping(mapping, values, daisychain);
+                    assert(fty::nut::performMapping(compiledMapping, values, daisychain) == expected);
+                    assert(fty::nut::performMapping(compiledMapping, typedValues, daisychain) == fty::nut::performMapping(mapping, typedValues, daisychain));
+                }
+            }
+        }
+
+        // Corner cases of daisy-chain folding and overrides.
+        const fty::nut::KeyValues mapping = {
+            { "", "folded" },
+            { "device.model", "" },
+            { "model", "model.unreachable" },
+            { "device.mfr", "manufacturer" },
+            { "mfr", "manufacturer.bare" },
+            { "serial", "serial" },
+            { "device.type", "type" },
+            { "device.1x", "digit" },
+            { "input.current", "current.input" },
+            { "input.L1.current", "current.input.L1" },
+            { "ups.status", "status" }
+        };
+        const fty::nut::KeyValues values = {
+            { "device.model", "host model" },
+            { "device.1.model", "model 1" },
+            { "device.mfr", "host mfr" },
+            { "device.1.mfr", "mfr 1" },
+            { "device.2.mfr", "mfr 2" },
+            { "device.01.mfr", "mfr 01" },
+            { "device.1.serial", "serial 1" },
+            { "device.type", "host type" },
+            { "device.2.type", "type 2" },
+            { "device.1x", "digit" },
+            { "device.1.", "empty" },
+            { "device.1.a\rb", "cr" },
+            { "input.current", "1" },
+            { "input.L1.current", "2" },
+            { "ups.status", "OL" }
+        };
+        const fty::nut::CompiledMapping compiledMapping(mapping);
+        std::string mappedKey;
+        assert(compiledMapping.find("device.mfr", mappedKey) && mappedKey == "manufacturer");
+        assert(!compiledMapping.find("nosuchkey", mappedKey));
+        for (int daisychain = 0; daisychain <= 3; daisychain++) {
+            assert(fty::nut::performMapping(compiledMapping, values, daisychain) == fty::nut::performMapping(mapping, values, daisychain));
+        }
+
+        auto threePhaseValues = values;
+        threePhaseValues.erase("input.L1.current");
+        for (int daisychain = 0; daisychain <= 3; daisychain++) {
+            assert(fty::nut::performMapping(compiledMapping, threePhaseValues, daisychain) == fty::nut::performMapping(mapping, threePhaseValues, daisychain));
+        }
+
+        const fty::nut::CompiledMapping emptyMapping;
+        assert(emptyMapping.empty());
+        assert(fty::nut::performMapping(emptyMapping, values, 1).empty());
+    }
+
+    // Test template mappings of compiled mapping.
+    {
+        // Indexes beyond 98 match templates too.
+        const auto entries = fty::nut::loadMappingEntries("src/selftest-ro/mappingValid.conf", "physicsMapping");
+        const fty::nut::CompiledMapping compiledMapping(entries);
+        const auto expandedMapping = expandTemplates(entries, 300);
+
+        std::mt19937 generator(13);
+        for (int i = 0; i < 10; i++) {
+            fty::nut::KeyValues values = generateDeviceDump(generator, i % 3);
+            for (int outlet = 90; outlet <= 300; outlet += generator() % 7 + 1) {
+                values.emplace("outlet." + std::to_string(outlet) + ".current", std::to_string(outlet));
+                values.emplace("device.1.outlet." + std::to_string(outlet) + ".voltage", std::to_string(outlet));
+                values.emplace("outlet.group." + std::to_string(outlet) + ".load", std::to_string(outlet));
+            }
+            for (int daisychain = 0; daisychain <= 2; daisychain++) {
+                assert(fty::nut::performMapping(compiledMapping, values, daisychain) == fty::nut::performMapping(expandedMapping, values, daisychain));
+            }
+        }
+
+        std::string mappedKey;
+        assert(compiledMapping.find("outlet.12345.current", mappedKey) && mappedKey == "current.outlet.12345");
+        assert(compiledMapping.find("outlet.123456789.current", mappedKey) && mappedKey == "current.outlet.123456789");
+        assert(!compiledMapping.find("outlet.1234567890.current", mappedKey));
+        assert(!compiledMapping.find("outlet.0.current", mappedKey));
+        assert(!compiledMapping.find("outlet.05.current", mappedKey));
+        assert(!compiledMapping.find("outlet..current", mappedKey));
+        assert(!compiledMapping.find("outlet.#.current", mappedKey));
+        assert(!compiledMapping.find("outlet.1a.current", mappedKey));
+
+        // The earliest entry wins, templates or not.
+        const fty::nut::MappingEntries precedenceEntries = {
+            { "outlet.#.current", "current.outlet.#" },
+            { "outlet.5.current", "current.special" },
+            { "outlet.6.voltage", "voltage.special" },
+            { "outlet.#.voltage", "voltage.outlet.#" },
+            { "outlet.1#.voltage", "voltage.one.#" },
+            { "device.outlet.#.status", "status.device.outlet.#" },
+            { "outlet.#.status", "status.outlet.#" },
+            { "outlet.#.#", "literal.#.#" },
+            { "ups.#", "no.placeholder" },
+            { "device.#", "device.index.#" }
+        };
+        const fty::nut::CompiledMapping precedenceMapping(precedenceEntries);
+        const auto expandedPrecedenceMapping = expandTemplates(precedenceEntries, 98);
+        assert(precedenceMapping.toKeyValues() == expandedPrecedenceMapping);
+
+        fty::nut::KeyValues values = {
+            { "ups.#", "literal" },
+            { "ups.1", "instance" },
+            { "device.count", "2" }
+        };
+        for (int outlet = 1; outlet <= 20; outlet++) {
+            for (const std::string prefix : { "", "device.1.", "device.2." }) {
+                for (const std::string property : { "current", "voltage", "status", "#" }) {
+                    values.emplace(prefix + "outlet." + std::to_string(outlet) + "." + property, std::to_string(outlet));
+                }
+                values.emplace(prefix + "device.outlet." + std::to_string(outlet) + ".status", std::to_string(outlet));
+                values.emplace(prefix + "device." + std::to_string(outlet), std::to_string(outlet));
+            }
+        }
+        for (int daisychain = 0; daisychain <= 2; daisychain++) {
+            assert(fty::nut::performMapping(precedenceMapping, values, daisychain) == fty::nut::performMapping(expandedPrecedenceMapping, values, daisychain));
+        }
+    }
+
+    // Test daisy-chain fan-out mapping against per-member mapping.
+    {
+        auto checkDaisychainMapping = [](const fty::nut::KeyValues &mapping, const fty::nut::KeyValues &values, size_t members) {
+            const fty::nut::CompiledMapping compiledMapping(mapping);
+            const auto result = fty::nut::performDaisychainMapping(compiledMapping, values);
+            assert(result.size() == members);
+            for (size_t member = 1; member <= members; member++) {
+                assert(result[member - 1] == fty::nut::performMapping(mapping, values, member));
+            }
+            assert(fty::nut::performDaisychainMapping(mapping, values) == result);
+
+            const auto typedValues = fty::nut::classifyValues(values);
+            const auto typedResult = fty::nut::performDaisychainMapping(compiledMapping, typedValues);
+            assert(typedResult.size() == members);
+            for (size_t member = 1; member <= members; member++) {
+                assert(typedResult[member - 1] == fty::nut::performMapping(mapping, typedValues, member));
+            }
+        };
+
+        std::mt19937 generator(14);
+        for (const auto &type : { "physicsMapping", "inventoryMapping" }) {
+            const auto mapping = fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", type);
+            for (int i = 0; i < 20; i++) {
+                const int members = i % 6;
+                auto values = generateDeviceDump(generator, members);
+                checkDaisychainMapping(mapping, values, members);
+
+                // Without device.count, the highest index seen counts.
+                values.erase("device.count");
+                size_t highestIndex = 0;
+                for (int member = 1; member <= members; member++) {
+                    if (values.lower_bound("device." + std::to_string(member) + ".") != values.lower_bound("device." + std::to_string(member) + "/")) {
+                        highestIndex = member;
+                    }
+                }
+                checkDaisychainMapping(mapping, values, highestIndex);
+
+                // A device.count lower than the highest index seen wins.
+                if (members > 1) {
+                    values["device.count"] = std::to_string(members - 1);
+                    checkDaisychainMapping(mapping, values, members - 1);
+                }
+            }
+        }
+
+        // Corner cases of daisy-chain folding and overrides, with and without the empty key mapped.
+        fty::nut::KeyValues mapping = {
+            { "", "folded" },
+            { "device.model", "" },
+            { "model", "model.unreachable" },
+            { "device.mfr", "manufacturer" },
+            { "mfr", "manufacturer.bare" },
+            { "serial", "serial" },
+            { "device.type", "type" },
+            { "device.-type", "dash.type" },
+            { "-type", "dash.type.bare" },
+            { "input.current", "current.input" },
+            { "input.L1.current", "current.input.L1" },
+            { "ups.status", "status" }
+        };
+        fty::nut::KeyValues values = {
+            { "device.count", "3" },
+            { "device.model", "host model" },
+            { "device.1.model", "model 1" },
+            { "device.mfr", "host mfr" },
+            { "device.1.mfr", "mfr 1" },
+            { "device.2.mfr", "mfr 2" },
+            { "device.01.mfr", "mfr 01" },
+            { "device.4.mfr", "mfr 4" },
+            { "device.1.serial", "serial 1" },
+            { "device.type", "host type" },
+            { "device.2.type", "type 2" },
+            { "device.-type", "host dash type" },
+            { "device.3.-type", "dash type 3" },
+            { "input.current", "1" },
+            { "input.L1.current", "2" },
+            { "ups.status", "OL" }
+        };
+        checkDaisychainMapping(mapping, values, 3);
+        mapping.erase("");
+        checkDaisychainMapping(mapping, values, 3);
+        values.erase("input.L1.current");
+        checkDaisychainMapping(mapping, values, 3);
+        values["device.count"] = "oops";
+        checkDaisychainMapping(mapping, values, 0);
+        values.erase("device.count");
+        checkDaisychainMapping(mapping, values, 4);
+        values.erase("device.4.mfr");
+        values["device.1025.mfr"] = "too far";
+        checkDaisychainMapping(mapping, values, 3);
+    }
+
+    // Test statistics of compiled mappings.
+    {
+        const fty::nut::CompiledMapping mapping(fty::nut::KeyValues {
+            { "device.model", "model" },
+            { "input.current", "current.input" },
+            { "input.L1.current", "current.input.L1" },
+            { "ups.status", "" }
+        });
+        const fty::nut::KeyValues values = {
+            { "device.model", "host" },
+            { "device.1.model", "member 1" },
+            { "device.count", "2" },
+            { "input.current", "1" },
+            { "input.L1.current", "2" },
+            { "ups.status", "OL" }
+        };
+        const auto statisticsSum = [](const fty::nut::MappingStatistics &statistics) {
+            uint64_t calls = 0;
+            for (auto bucket : statistics.latency) {
+                calls += bucket;
+            }
+            assert(calls == statistics.calls);
+            return statistics.mapped + statistics.unmapped + statistics.daisychainOverridden + statistics.threePhaseOverridden;
+        };
+
+        fty::nut::performMapping(mapping, values, 1);
+        const fty::nut::CompiledMapping copy = mapping;
+        auto statistics = copy.statistics();
+        assert(statistics.calls == 1);
+        assert(statistics.seen == 6);
+        assert(statistics.mapped == 2);
+        assert(statistics.unmapped == 2);
+        assert(statistics.daisychainOverridden == 1);
+        assert(statistics.threePhaseOverridden == 1);
+        assert(statisticsSum(statistics) == statistics.seen);
+
+        // Host device properties count once per member.
+        mapping.resetStatistics();
+        assert(copy.statistics().calls == 0 && copy.statistics().seen == 0);
+        fty::nut::performDaisychainMapping(mapping, values);
+        statistics = mapping.statistics();
+        assert(statistics.calls == 1);
+        assert(statistics.seen == 6);
+        assert(statistics.mapped == 4);
+        assert(statistics.unmapped == 2);
+        assert(statistics.daisychainOverridden == 1);
+        assert(statistics.threePhaseOverridden == 2);
+
+        // Every variable is accounted for once by single mapping.
+        std::mt19937 generator(17);
+        const auto physicsMapping = fty::nut::loadCompiledMapping("src/selftest-ro/mappingValid.conf", "physicsMapping");
+        uint64_t seen = 0;
+        for (int i = 0; i < 20; i++) {
+            const auto values = generateDeviceDump(generator, i % 4);
+            fty::nut::performMapping(physicsMapping, values, i % 3);
+            seen += values.size();
+        }
+        statistics = physicsMapping.statistics();
+        assert(statistics.calls == 20 && statistics.seen == seen);
+        assert(statisticsSum(statistics) == seen);
+        assert(statistics.mapped > 0 && statistics.unmapped > 0);
+    }
+
+    // Test reverse mapping against forward mapping of each variable of a set of dumps.
+    {
+        const fty::nut::MappingEntries entries = {
+            { "device.model", "model" },
+            { "ups.model", "model" },
+            { "device.1.mfr", "mfr 1" },
+            { "device.mfr", "mfr" },
+            { "ups.mfr", "plain mfr" },
+            { "mfr", "plain mfr" },
+            { "outlet.1.current", "first outlet" },
+            { "outlet.#.current", "current.outlet.#" },
+            { "outlet.2.current", "current.outlet.2" },
+            { "device.outlet.#.id", "id.#" },
+            { "outlet.#.id", "plain id.#" },
+            { "outlet.#.status", "status.outlet.#1" },
+            { "ups.status", "" }
+        };
+        const std::vector<fty::nut::CompiledMapping> mappings = {
+            fty::nut::CompiledMapping(entries),
+            fty::nut::loadCompiledMapping("src/selftest-ro/mappingValid.conf", "physicsMapping"),
+            fty::nut::loadCompiledMapping("src/selftest-ro/mappingValid.conf", "inventoryMapping")
+        };
+
+        std::mt19937 generator(19);
+        std::set<std::string> universe = { "mfr", "device.1.mfr", "device.2.mfr", "device.2.outlet.3.id", "outlet.03.current" };
+        for (int i = 0; i < 10; i++) {
+            for (const auto &value : generateDeviceDump(generator, i % 4)) {
+                universe.insert(value.first);
+            }
+        }
+
+        for (const auto &mapping : mappings) {
+            const fty::nut::ReverseMapping reverse(mapping);
+            for (int daisychain = 0; daisychain <= 3; daisychain++) {
+                std::map<std::string, std::set<std::string>> expected;
+                for (const auto &key : universe) {
+                    for (const auto &mapped : fty::nut::performMapping(mapping, fty::nut::KeyValues { { key, "" } }, daisychain)) {
+                        expected[mapped.first].insert(key);
+                    }
+                }
+
+                for (const auto &i : expected) {
+                    const auto keys = reverse.find(i.first, daisychain);
+                    assert(std::is_sorted(keys.begin(), keys.end()));
+                    std::set<std::string> found;
+                    for (const auto &key : keys) {
+                        assert((fty::nut::performMapping(mapping, fty::nut::KeyValues { { key, "" } }, daisychain).count(i.first)));
+                        if (universe.count(key)) {
+                            found.insert(key);
+                        }
+                    }
+                    assert(found == i.second);
+                }
+            }
+        }
+
+        const fty::nut::ReverseMapping reverse(mappings[0]);
+        assert((reverse.find("current.outlet.7") == std::vector<std::string> { "outlet.7.current" }));
+        assert((reverse.find("current.outlet.2") == std::vector<std::string> { "outlet.2.current" }));
+        assert(reverse.find("current.outlet.1").empty());
+        assert(reverse.find("current.outlet.07").empty());
+        assert((reverse.find("first outlet") == std::vector<std::string> { "outlet.1.current" }));
+        assert((reverse.find("plain mfr") == std::vector<std::string> { "mfr", "ups.mfr" }));
+        assert((reverse.find("mfr", 2) == std::vector<std::string> { "device.2.device.mfr", "device.2.mfr", "device.mfr" }));
+        assert((reverse.find("mfr 1", 1) == std::vector<std::string> { "device.1.1.mfr", "device.1.device.1.mfr" }));
+        assert((reverse.find("mfr 1", 0) == std::vector<std::string> { "device.1.mfr" }));
+        assert((reverse.find("id.12", 3) == std::vector<std::string> { "device.3.device.outlet.12.id", "device.3.outlet.12.id", "device.outlet.12.id" }));
+        assert((reverse.find("plain id.12", 3) == std::vector<std::string> { "outlet.12.id" }));
+        assert((reverse.find("status.outlet.41") == std::vector<std::string> { "outlet.4.status" }));
+        assert(reverse.find("").empty());
+        assert(fty::nut::ReverseMapping().find("model").empty());
+
+        assert((fty::nut::loadReverseMapping("src/selftest-ro/mappingValid.conf", "inventoryMapping").find("model", 1) ==
+            std::vector<std::string> { "device.1.device.model", "device.1.model", "device.1.ups.model", "device.model", "ups.model" }));
+    }
+
+    // Test batch mapping against mapping of each input.
+    {
+        std::mt19937 generator(16);
+        const auto mapping = fty::nut::loadCompiledMapping("src/selftest-ro/mappingValid.conf", "physicsMapping");
+
+        std::vector<fty::nut::KeyValues> dumps;
+        std::vector<fty::nut::MappingInput> inputs;
+        std::vector<fty::nut::KeyValues> expected;
+        for (int i = 0; i < 100; i++) {
+            dumps.emplace_back(generateDeviceDump(generator, i % 4));
+        }
+        for (int i = 0; i < 100; i++) {
+            inputs.push_back({ &dumps[i], i % 5 });
+            expected.emplace_back(fty::nut::performMapping(mapping, dumps[i], i % 5));
+        }
+
+        for (unsigned threads : { 0, 1, 2, 3, 8, 200 }) {
+            assert(fty::nut::performBatchMapping(mapping, inputs, threads) == expected);
+            assert((fty::nut::performBatchMapping(mapping, inputs.data() + 10, 7, threads) == std::vector<fty::nut::KeyValues>(expected.begin() + 10, expected.begin() + 17)));
+        }
+        assert(fty::nut::performBatchMapping(mapping, std::vector<fty::nut::MappingInput>(), 4).empty());
+    }
+
+    // Test binary mapping images.
+    {
+        const std::string source = "src/selftest-rw/mapping.conf";
+        const std::string image = "src/selftest-rw/mapping.bin";
+        const auto copyFile = [](const std::string &from, const std::string &to) {
+            std::ifstream input(from, std::ios::binary);
+            std::ofstream output(to, std::ios::binary | std::ios::trunc);
+            output << input.rdbuf();
+        };
+        const auto writeFile = [](const std::string &path, const std::string &contents) {
+            std::ofstream output(path, std::ios::binary | std::ios::trunc);
+            output << contents;
+        };
+
+        copyFile("src/selftest-ro/mappingValid.conf", source);
+        fty::nut::compileMappingImage(source, image);
+
+        std::mt19937 generator(13);
+        for (const auto &type : { "physicsMapping", "inventoryMapping" }) {
+            const auto mapping = fty::nut::loadCompiledMapping(source, type);
+            const auto imageMapping = fty::nut::loadCompiledMapping(source, type, image);
+            assert(imageMapping.toKeyValues() == mapping.toKeyValues());
+            assert(imageMapping.size() == mapping.size());
+
+            for (int i = 0; i < 20; i++) {
+                const auto values = generateDeviceDump(generator, i % 4);
+                for (int daisychain = 0; daisychain <= 4; daisychain++) {
+                    assert(fty::nut::performMapping(imageMapping, values, daisychain) == fty::nut::performMapping(mapping, values, daisychain));
+                }
+                assert(fty::nut::performDaisychainMapping(imageMapping, values) == fty::nut::performDaisychainMapping(mapping, values));
+            }
+        }
+
+        // Concurrent compilers don't collide and leave no temporary file behind.
+        {
+            std::vector<std::thread> compilers;
+            for (int i = 0; i < 4; i++) {
+                compilers.emplace_back([&source, &image]() { fty::nut::compileMappingImage(source, image); });
+            }
+            for (auto &compiler : compilers) {
+                compiler.join();
+            }
+            assert(fty::nut::loadCompiledMapping(source, "physicsMapping", image).toKeyValues() == fty::nut::loadCompiledMapping(source, "physicsMapping").toKeyValues());
+
+            size_t entries = 0;
+            DIR *dir = opendir("src/selftest-rw");
+            assert(dir);
+            while (struct dirent *entry = readdir(dir)) {
+                if (strncmp(entry->d_name, "mapping.bin", 11) == 0) {
+                    entries++;
+                }
+            }
+            closedir(dir);
+            assert(entries == 1);
+        }
+
+        // Image is used as is without mapping file, and only for its own types.
+        std::remove(source.c_str());
+        const auto physicsImage = fty::nut::loadCompiledMapping(source, "physicsMapping", image);
+        assert(physicsImage.toKeyValues() == fty::nut::loadMapping("src/selftest-ro/mappingValid.conf", "physicsMapping"));
+        for (const auto &type : { "emptyMapping", "badMapping", "noSuchMapping" }) {
+            bool caughtException = false;
+            try {
+                fty::nut::loadCompiledMapping(source, type, image);
+            }
+            catch (std::runtime_error &) {
+                caughtException = true;
+            }
+            assert(caughtException);
+        }
+
+        // Stale images fall back to mapping file.
+        const std::string changedMapping = "{ \"physicsMapping\" : { \"ups.load\" : \"load.default\" } }";
+        writeFile(source, changedMapping);
+        assert((fty::nut::loadCompiledMapping(source, "physicsMapping", image).toKeyValues() == fty::nut::KeyValues{ { "ups.load", "load.default" } }));
+
+        // Mapped image outlives reuse of its path.
+        fty::nut::compileMappingImage(source, image);
+        const auto changedImage = fty::nut::loadCompiledMapping(source, "physicsMapping", image);
+        copyFile("src/selftest-ro/mappingValid.conf", source);
+        fty::nut::compileMappingImage(source, image);
+        assert((changedImage.toKeyValues() == fty::nut::KeyValues{ { "ups.load", "load.default" } }));
+        assert(physicsImage.toKeyValues() == fty::nut::loadCompiledMapping(source, "physicsMapping", image).toKeyValues());
+
+        // Invalid images fall back to mapping file.
+        std::string contents;
+        {
+            std::ifstream input(image, std::ios::binary);
+            contents.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+        const auto expectedPhysics = fty::nut::loadCompiledMapping(source, "physicsMapping").toKeyValues();
+        const auto expected = fty::nut::loadCompiledMapping(source, "inventoryMapping").toKeyValues();
+        const std::vector<std::string> invalidImages = {
+            "",
+            "FTYNUTMB",
+            contents.substr(0, contents.size() / 2),
+            std::string(contents).replace(0, 8, "FTYNUTMA"),
+            std::string(contents).replace(8, 1, "\x7f"),
+            std::string(contents).replace(contents.size() - 4, 4, "\xff\xff\xff\x7f"),
+            std::string(contents).replace(56, 8, 8, '\xff'),
+            std::string(contents).replace(sizeof(fty::nut::MappingImageHeader) + sizeof(fty::nut::MappingImageType) + 8, 8, 8, '\xff')
+        };
+        for (const auto &invalidImage : invalidImages) {
+            writeFile(image, invalidImage);
+            assert(fty::nut::loadCompiledMapping(source, "physicsMapping", image).toKeyValues() == expectedPhysics);
+            assert(fty::nut::loadCompiledMapping(source, "inventoryMapping", image).toKeyValues() == expected);
+        }
+
+        // Missing images fall back to mapping file.
+        std::remove(image.c_str());
+        assert(fty::nut::loadCompiledMapping(source, "inventoryMapping", image).toKeyValues() == expected);
+
+        // Missing images and mapping files are an error.
+        std::remove(source.c_str());
+        bool caughtException = false;
+        try {
+            fty::nut::loadCompiledMapping(source, "inventoryMapping", image);
+        }
+        catch (std::runtime_error &) {
+            caughtException = true;
+        }
+        assert(caughtException);
+
+        // Unwritable images are an error.
+        caughtException = false;
+        try {
+            fty::nut::compileMappingImage("src/selftest-ro/mappingValid.conf", "src/selftest-rw/nosuchdir/mapping.bin");
+        }
+        catch (std::runtime_error &) {
+            caughtException = true;
+        }
+        assert(caughtException);
+    }
 
     std::cout << "OK" << std::endl;
 }
@@ -0,0 +1,269 @@
+/*  =========================================================================
+    fty_common_nut_delta - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_delta -
+@discuss
+    Stateful mapping of successive dumps of a device, reporting only changes.
+@end
+*/
+
+#include "fty_common_nut_classes.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <type_traits>
+
+namespace fty {
+namespace nut {
+
+DeltaMapper::DeltaMapper(const CompiledMapping &mapping, int daisychain) :
+    m_mapping(mapping),
+    m_daisychain(daisychain)
+{
+}
+
+MappingDelta DeltaMapper::update(const KeyValues &values)
+{
+    MappingDelta delta;
+
+    const bool sameKeys = values.size() == m_values.size() &&
+        std::equal(values.begin(), values.end(), m_values.begin(), [](const KeyValues::value_type &a, const KeyValues::value_type &b) {
+            return a.first == b.first;
+        });
+
+    if (!sameKeys) {
+        rebuild(values, delta);
+        return delta;
+    }
+
+    // Same variables as last dump, so same mapping outcome: only propagate changed values.
+    auto previous = m_values.begin();
+    size_t i = 0;
+    for (const auto &value : values) {
+        if (previous->second != value.second) {
+            previous->second = value.second;
+            if (m_plan[i]) {
+                m_plan[i]->second = value.second;
+                delta.changed.emplace(m_plan[i]->first, value.second);
+            }
+        }
+        ++previous;
+        ++i;
+    }
+
+    return delta;
+}
+
+void DeltaMapper::rebuild(const KeyValues &values, MappingDelta &delta)
+{
+    std::vector<const std::string *> texts;
+    texts.reserve(values.size());
+    for (const auto &value : values) {
+        texts.push_back(&value.second);
+    }
+
+    const MappingPlan mappingPlan(m_mapping, values, m_daisychain);
+    KeyValues state;
+    std::vector<KeyValues::value_type *> plan(values.size(), nullptr);
+    for (const auto &target : mappingPlan.targets()) {
+        plan[target.index] = &*state.emplace_hint(state.end(), target.key, *texts[target.index]);
+    }
+
+    // Compare with previous mapped values, both sorted by key.
+    auto oldValue = m_state.cbegin();
+    auto newValue = state.cbegin();
+    while (oldValue != m_state.cend() || newValue != state.cend()) {
+        if (newValue == state.cend() || (oldValue != m_state.cend() && oldValue->first < newValue->first)) {
+            delta.removed.push_back(oldValue->first);
+            ++oldValue;
+        }
+        else if (oldValue == m_state.cend() || newValue->first < oldValue->first) {
+            delta.added.emplace_hint(delta.added.end(), *newValue);
+            ++newValue;
+        }
+        else {
+            if (oldValue->second != newValue->second) {
+                delta.changed.emplace_hint(delta.changed.end(), *newValue);
+            }
+            ++oldValue;
+            ++newValue;
+        }
+    }
+
+    // Swapping maps keeps pointers to their elements valid.
+    m_values = values;
+    m_state.swap(state);
+    m_plan.swap(plan);
+}
+
+void DeltaMapper::reset()
+{
+    m_values.clear();
+    m_state.clear();
+    m_plan.clear();
+}
+
+}
+}
+
+/**
+ * \brief Check a delta against the mapped values before and after it.
+ */
+static void checkDelta(const fty::nut::KeyValues &before, const fty::nut::MappingDelta &delta, const fty::nut::KeyValues &after)
+{
+    fty::nut::KeyValues applied = before;
+
+    for (const auto &value : delta.added) {
+        assert(!before.count(value.first));
+        applied.insert(value);
+    }
+    for (const auto &value : delta.changed) {
+        assert(before.count(value.first) && before.at(value.first) != value.second);
+        applied[value.first] = value.second;
+    }
+    for (const auto &key : delta.removed) {
+        assert(before.count(key) && !after.count(key));
+        applied.erase(key);
+    }
+
+    assert(applied == after);
+}
+
+void fty_common_nut_delta_test(bool verbose)
+{
+    std::cout << " * fty_common_nut_delta: ";
+
+    const fty::nut::CompiledMapping mapping(fty::nut::MappingEntries {
+        { "device.model", "model" },
+        { "ups.model", "model" },
+        { "device.mfr", "manufacturer" },
+        { "input.current", "current.input" },
+        { "input.L1.current", "current.input.L1" },
+        { "outlet.#.current", "current.outlet.#" },
+        { "ups.status", "status.ups" }
+    });
+
+    static const std::vector<std::string> keys = {
+        "device.model", "ups.model", "device.mfr", "device.1.mfr", "device.2.model", "device.count",
+        "input.current", "input.L1.current", "outlet.1.current", "outlet.2.current", "outlet.10.current",
+        "ups.status", "unmapped.key"
+    };
+    static const std::vector<std::string> texts = { "a", "b", "c" };
+
+    // Mutate a dump, either its values only or its set of variables, and compare with regular mapping.
+    std::mt19937 generator(15);
+    for (int daisychain = 0; daisychain <= 2; daisychain++) {
+        fty::nut::DeltaMapper mapper(mapping, daisychain);
+        fty::nut::KeyValues values;
+        fty::nut::KeyValues before;
+
+        for (int i = 0; i < 2000; i++) {
+            if (generator() % 4 == 0) {
+                const std::string &key = keys[generator() % keys.size()];
+                if (!values.erase(key)) {
+                    values[key] = texts[generator() % texts.size()];
+                }
+            }
+            else {
+                for (auto &value : values) {
+                    if (generator() % 3 == 0) {
+                        value.second = texts[generator() % texts.size()];
+                    }
+                }
+            }
+
+            const auto delta = mapper.update(values);
+            const auto expected = fty::nut::performMapping(mapping, values, daisychain);
+            assert(mapper.state() == expected);
+            checkDelta(before, delta, expected);
+            before = expected;
+
+            assert(mapper.update(values).empty());
+        }
+
+        // Everything is new after a reset.
+        mapper.reset();
+        assert(mapper.state().empty());
+        const auto delta = mapper.update(values);
+        assert(delta.added == before && delta.changed.empty() && delta.removed.empty());
+    }
+
+    // Values mapped through an unchanged set of variables.
+    {
+        fty::nut::DeltaMapper mapper(fty::nut::loadCompiledMapping("src/selftest-ro/mappingValid.conf", "inventoryMapping"), 0);
+        fty::nut::KeyValues values = {
+            { "device.model", "ePDU" },
+            { "ups.model", "UPS" },
+            { "ups.status", "OL" },
+            { "outlet.1.status", "on" }
+        };
+
+        auto delta = mapper.update(values);
+        assert((delta.added == fty::nut::KeyValues { { "model", "ePDU" }, { "status.ups", "OL" }, { "status.outlet.1", "on" } }));
+
+        values["ups.model"] = "other UPS";
+        values["outlet.1.status"] = "off";
+        delta = mapper.update(values);
+        assert(delta.added.empty() && delta.removed.empty());
+        assert((delta.changed == fty::nut::KeyValues { { "status.outlet.1", "off" } }));
+
+        values.erase("device.model");
+        delta = mapper.update(values);
+        assert(delta.added.empty() && delta.removed.empty());
+        assert((delta.changed == fty::nut::KeyValues { { "model", "other UPS" } }));
+
+        delta = mapper.update({});
+        assert((delta.removed == std::vector<std::string> { "model", "status.outlet.1", "status.ups" }));
+        assert(mapper.state().empty());
+    }
+
+    // Mappers can't be copied, moved ones keep working on their own state.
+    {
+        static_assert(!std::is_copy_constructible<fty::nut::DeltaMapper>::value && !std::is_copy_assignable<fty::nut::DeltaMapper>::value,
+            "DeltaMapper points into its own state");
+
+        fty::nut::KeyValues values = { { "ups.model", "UPS" }, { "ups.status", "OL" } };
+        std::map<int, fty::nut::DeltaMapper> mappers;
+        {
+            fty::nut::DeltaMapper mapper(mapping, 0);
+            mapper.update(values);
+            mappers.emplace(1, std::move(mapper));
+        }
+
+        values["ups.status"] = "OB";
+        auto delta = mappers.at(1).update(values);
+        assert((delta.changed == fty::nut::KeyValues { { "status.ups", "OB" } }));
+        assert(mappers.at(1).state() == fty::nut::performMapping(mapping, values, 0));
+
+        fty::nut::DeltaMapper other(mapping, 0);
+        other = std::move(mappers.at(1));
+        mappers.erase(1);
+        values["ups.status"] = "OL";
+        delta = other.update(values);
+        assert((delta.changed == fty::nut::KeyValues { { "status.ups", "OL" } }));
+        assert(other.state() == fty::nut::performMapping(mapping, values, 0));
+    }
+
+    std::cout << "OK" << std::endl;
+}
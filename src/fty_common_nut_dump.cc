@@ -28,14 +28,15 @@
 
 #include "fty_common_nut_classes.h"
 
+#include <future>
+
 namespace fty {
 namespace nut {
 
-KeyValues dumpDevice(
+static MlmSubprocess::Argv buildDumpCommand(
     const std::string& driver,
     const std::string& port,
     unsigned loopNb,
-    unsigned loopIterTime,
     const std::vector<secw::DocumentPtr>& documents,
     const KeyValues& extra)
 {
@@ -48,7 +49,6 @@ KeyValues dumpDevice(
     data.emplace("port", port);
 
     // Build command invocation.
-    std::string stdout, stderr;
     MlmSubprocess::Argv args {
         "/lib/nut/"+driver,
         "-d", std::to_string(loopNb),
@@ -61,9 +61,289 @@ KeyValues dumpDevice(
         args.emplace_back(it.first+"="+it.second);
     }
 
-    // Invoke command.
-    (void)priv::runCommand(args, stdout, stderr, loopNb*loopIterTime);
-    return parseDumpOutput(stdout);
+    return args;
+}
+
+/**
+ * \brief State of an asynchronous dump, shared by its handle and the event loop.
+ */
+struct DumpHandle::Task
+{
+    Task() :
+        parser([this](const std::string& key, const std::string& value) { result.values.emplace(key, value); }),
+        future(promise.get_future().share())
+    {
+    }
+
+    DumpResult result;
+    DumpOutputParser parser;
+    std::promise<DumpResult> promise;
+    std::shared_future<DumpResult> future;
+    priv::CommandPtr command;
+};
+
+DumpHandle::DumpHandle(std::shared_ptr<Task> task) :
+    m_task(task),
+    m_result(task->future)
+{
+}
+
+void DumpHandle::cancel()
+{
+    if (m_task) {
+        priv::cancelCommand(m_task->command);
+    }
+}
+
+bool DumpHandle::finished() const
+{
+    return m_result.valid() && m_result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+const DumpResult& DumpHandle::wait() const
+{
+    if (!m_result.valid()) {
+        throw std::runtime_error("No dump to wait for");
+    }
+    return m_result.get();
+}
+
+DumpHandle dumpDeviceAsync(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const DumpCompletion& completion,
+    std::chrono::steady_clock::time_point deadline)
+{
+    const MlmSubprocess::Argv args = buildDumpCommand(driver, port, loopNb, documents, extra);
+
+    if (deadline == std::chrono::steady_clock::time_point()) {
+        deadline = loopNb*loopIterTime > 0 ?
+            std::chrono::steady_clock::now() + std::chrono::seconds(loopNb*loopIterTime) :
+            std::chrono::steady_clock::time_point::max();
+    }
+
+    // Callbacks hold the task until the event loop is done with the command.
+    auto task = std::make_shared<DumpHandle::Task>();
+    DumpHandle handle(task);
+
+    task->command = priv::runCommandAsync(
+        args,
+        [task](const char *data, size_t length) { task->parser.feed(data, length); },
+        [](const char *, size_t) {},
+        [task, completion, driver](priv::CommandStatus status, int ret) {
+            task->parser.finish();
+            switch (status) {
+                case priv::CommandStatus::Exited:        task->result.status = DumpStatus::Completed; break;
+                case priv::CommandStatus::FailedToStart: task->result.status = DumpStatus::FailedToStart; break;
+                case priv::CommandStatus::TimedOut:      task->result.status = DumpStatus::TimedOut; break;
+                case priv::CommandStatus::Cancelled:     task->result.status = DumpStatus::Cancelled; break;
+            }
+            task->result.returnCode = ret;
+
+            // Release waiters first, a throwing completion mustn't leave them blocked.
+            task->promise.set_value(std::move(task->result));
+            if (completion) {
+                try {
+                    completion(task->future.get());
+                }
+                catch (...) {
+                    log_error("Completion of dump with driver %s threw an exception.", driver.c_str());
+                }
+            }
+        },
+        deadline
+    );
+
+    return handle;
+}
+
+/**
+ * \brief Run a dump command, ending it as soon as its output handler has all it needs.
+ *
+ * The output handler runs on the calling thread, its exceptions are propagated.
+ *
+ * \param args Command to run.
+ * \param timeout Timeout in seconds after which the command is terminated (0 for none).
+ * \param feed Output handler, returning true once no more output is needed.
+ * \param stopped Set to true if command was ended by the output handler.
+ * \return Return code of driver (0 if ended by the output handler).
+ */
+static int runDumpCommand(
+    const MlmSubprocess::Argv& args,
+    int timeout,
+    const priv::StoppingOutputCallback& feed,
+    bool& stopped)
+{
+    std::string stderr;
+    const int ret = priv::runCommandUntil(args, feed, stderr, timeout, stopped);
+    if (stopped) {
+        log_info("Ended driver %s early, all needed data was received.", args[0].c_str());
+        return 0;
+    }
+    return ret;
+}
+
+KeyValues dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra)
+{
+    KeyValues result;
+
+    (void)dumpDevice(driver, port, loopNb, loopIterTime, documents, extra,
+        [&result](const std::string& key, const std::string& value) {
+            result.emplace(key, value);
+        }
+    );
+
+    return result;
+}
+
+int dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const DumpOutputParser::Callback& callback)
+{
+    const MlmSubprocess::Argv args = buildDumpCommand(driver, port, loopNb, documents, extra);
+
+    // Invoke command, parsing output as it comes.
+    DumpOutputParser parser(callback);
+    std::string stderr;
+    int ret = priv::runCommand(
+        args,
+        [&parser](const char *data, size_t length) { parser.feed(data, length); },
+        stderr,
+        loopNb*loopIterTime
+    );
+    parser.finish();
+
+    return ret;
+}
+
+KeyValues dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const std::set<std::string>& requiredKeys)
+{
+    const MlmSubprocess::Argv args = buildDumpCommand(driver, port, loopNb, documents, extra);
+
+    KeyValues result;
+    size_t missing = requiredKeys.size();
+    DumpOutputParser parser([&result, &requiredKeys, &missing](const std::string& key, const std::string& value) {
+        if (result.emplace(key, value).second && requiredKeys.count(key)) {
+            missing--;
+        }
+    });
+
+    bool stopped;
+    (void)runDumpCommand(args, loopNb*loopIterTime,
+        [&parser, &missing, &requiredKeys](const char *data, size_t length) {
+            parser.feed(data, length);
+            return !requiredKeys.empty() && missing == 0;
+        },
+        stopped
+    );
+    // Trailing partial line of an ended driver is incomplete.
+    if (!stopped) {
+        parser.finish();
+    }
+
+    return result;
+}
+
+KeyValues dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const CompiledMapping& mapping,
+    int daisychain)
+{
+    const MlmSubprocess::Argv args = buildDumpCommand(driver, port, loopNb, documents, extra);
+
+    KeyValues firstLoop;
+    bool complete = false;
+    DumpLoopParser parser([&firstLoop, &complete](unsigned loop, const KeyValues& values) {
+        if (loop == 0) {
+            firstLoop = values;
+        }
+        complete = true;
+    });
+
+    bool stopped;
+    (void)runDumpCommand(args, loopNb*loopIterTime,
+        [&parser, &complete](const char *data, size_t length) {
+            parser.feed(data, length);
+            return complete;
+        },
+        stopped
+    );
+    if (!stopped) {
+        parser.finish();
+    }
+
+    return performMapping(mapping, firstLoop, daisychain);
+}
+
+int dumpDeviceLoops(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    const DumpLoopParser::Callback& callback)
+{
+    const MlmSubprocess::Argv args = buildDumpCommand(driver, port, loopNb, documents, extra);
+
+    // Invoke command, splitting output into loops as it comes.
+    DumpLoopParser parser(callback);
+    std::string stderr;
+    int ret = priv::runCommand(
+        args,
+        [&parser](const char *data, size_t length) { parser.feed(data, length); },
+        stderr,
+        loopNb*loopIterTime
+    );
+    parser.finish();
+
+    return ret;
+}
+
+int dumpDevice(
+    const std::string& driver,
+    const std::string& port,
+    unsigned loopNb,
+    unsigned loopIterTime,
+    const std::vector<secw::DocumentPtr>& documents,
+    const KeyValues& extra,
+    DumpSnapshot& snapshot)
+{
+    const MlmSubprocess::Argv args = buildDumpCommand(driver, port, loopNb, documents, extra);
+
+    // Invoke command, keeping raw output for the snapshot.
+    std::string stdout, stderr;
+    int ret = priv::runCommand(args, stdout, stderr, loopNb*loopIterTime);
+    parseDumpOutput(std::move(stdout), snapshot);
+
+    return ret;
 }
 
 }
@@ -0,0 +1,270 @@
+/*  =========================================================================
+    fty_common_nut_intern - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_intern -
+@discuss
+    Interning of NUT variable names and low-cardinality values, which are
+    repeated verbatim across thousands of devices.
+@end
+*/
+
+#include "fty_common_nut_classes.h"
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <thread>
+
+namespace fty {
+namespace nut {
+
+static const std::string s_emptyString;
+
+InternedString::InternedString() :
+    m_str(&s_emptyString)
+{
+}
+
+const size_t StringPool::SHARD_COUNT;
+
+StringPool& StringPool::instance()
+{
+    static StringPool pool;
+    return pool;
+}
+
+size_t StringPool::hash(const char *str, size_t length)
+{
+    // FNV-1a.
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= static_cast<unsigned char>(str[i]);
+        h *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(h);
+}
+
+InternedString StringPool::intern(const char *str, size_t length)
+{
+    const Key key { str, length, hash(str, length) };
+    Shard &shard = m_shards[(key.hash >> 8) % SHARD_COUNT];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        return InternedString(it->second);
+    }
+
+    // Deque elements are never moved, so the index can point into them.
+    shard.strings.emplace_back(str, length);
+    const std::string *interned = &shard.strings.back();
+    shard.index.emplace(Key { interned->data(), interned->size(), key.hash }, interned);
+
+    return InternedString(interned);
+}
+
+bool StringPool::find(const char *str, size_t length, InternedString &handle) const
+{
+    const Key key { str, length, hash(str, length) };
+    const Shard &shard = m_shards[(key.hash >> 8) % SHARD_COUNT];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return false;
+    }
+
+    handle = InternedString(it->second);
+    return true;
+}
+
+size_t StringPool::size() const
+{
+    size_t result = 0;
+    for (const auto &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        result += shard.strings.size();
+    }
+    return result;
+}
+
+InternedKeyValues intern(const KeyValues &values, StringPool &pool)
+{
+    InternedKeyValues result;
+    for (const auto &value : values) {
+        result.emplace_hint(result.end(), pool.intern(value.first), pool.intern(value.second));
+    }
+    return result;
+}
+
+bool isLowCardinalityValue(const std::string &key, const char *value, size_t length)
+{
+    static const std::set<std::string> identificationProperties = {
+        "model", "mfr", "serial", "firmware", "type", "version"
+    };
+
+    if (std::none_of(value, value + length, [](char c) { return c >= '0' && c <= '9'; })) {
+        return true;
+    }
+
+    const size_t dot = key.rfind('.');
+    return identificationProperties.count(dot == std::string::npos ? key : key.substr(dot + 1));
+}
+
+PooledKeyValues internVariables(const KeyValues &values, StringPool &pool)
+{
+    PooledKeyValues result;
+    for (const auto &value : values) {
+        const std::string &text = value.second;
+        result.emplace_hint(result.end(), pool.intern(value.first),
+            isLowCardinalityValue(value.first, text.data(), text.size()) ? PooledValue(pool.intern(text)) : PooledValue(text));
+    }
+    return result;
+}
+
+KeyValues toKeyValues(const PooledKeyValues &values)
+{
+    KeyValues result;
+    for (const auto &value : values) {
+        result.emplace_hint(result.end(), value.first.str(), value.second.str());
+    }
+    return result;
+}
+
+KeyValues toKeyValues(const InternedKeyValues &values)
+{
+    KeyValues result;
+    for (const auto &value : values) {
+        result.emplace_hint(result.end(), value.first.str(), value.second.str());
+    }
+    return result;
+}
+
+}
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void fty_common_nut_intern_test(bool verbose)
+{
+    std::cout << " * fty_common_nut_intern: ";
+
+    // Interning and look-ups.
+    {
+        fty::nut::StringPool pool;
+
+        auto a = pool.intern("outlet.12.realpower");
+        auto b = pool.intern(std::string("outlet.12.realpower"));
+        auto c = pool.intern("ups.status");
+        assert(&a.str() == &b.str());
+        assert(a == b);
+        assert(a != c);
+        assert(a < c && !(c < a) && !(a < b));
+        assert(a.str() == "outlet.12.realpower");
+        assert(pool.size() == 2);
+
+        fty::nut::InternedString found;
+        assert(pool.find("ups.status", found) && found == c);
+        assert(!pool.find("ups.mfr", found));
+        assert(pool.size() == 2);
+
+        // Default handle is the empty string.
+        fty::nut::InternedString empty;
+        assert(empty.empty() && empty == pool.intern(""));
+    }
+
+    // Conversions.
+    {
+        fty::nut::StringPool pool;
+        const fty::nut::KeyValues values = {
+            { "device.mfr", "EATON" },
+            { "outlet.1.status", "on" },
+            { "outlet.2.status", "on" },
+            { "ups.status", "OL" }
+        };
+
+        auto interned = fty::nut::intern(values, pool);
+        assert(fty::nut::toKeyValues(interned) == values);
+        assert(pool.size() == 7);
+        assert(&interned.begin()->second.str() == &pool.intern("EATON").str());
+    }
+
+    // Only low-cardinality values of NUT variables are interned.
+    {
+        fty::nut::StringPool pool;
+        fty::nut::KeyValues values = {
+            { "device.mfr", "EATON" },
+            { "device.model", "ePDU MA 0U (C20 16A 1P)20XC13:4XC19" },
+            { "device.1.serial", "G123A45678" },
+            { "outlet.1.current", "0.42" },
+            { "outlet.1.status", "on" },
+            { "ups.date", "2020/01/02" }
+        };
+
+        auto pooled = fty::nut::internVariables(values, pool);
+        assert(fty::nut::toKeyValues(pooled) == values);
+        for (const auto &value : pooled) {
+            const std::string &key = value.first.str();
+            assert(value.second.interned() == (key == "device.mfr" || key == "device.model" || key == "device.1.serial" || key == "outlet.1.status"));
+        }
+
+        // Polls with changing measurements don't grow the pool.
+        const size_t poolSize = pool.size();
+        for (int i = 0; i < 100; i++) {
+            values["outlet.1.current"] = std::to_string(i) + ".5";
+            values["ups.date"] = "2020/01/" + std::to_string(i);
+            assert(fty::nut::toKeyValues(fty::nut::internVariables(values, pool)) == values);
+        }
+        assert(pool.size() == poolSize);
+    }
+
+    // Concurrent interning.
+    {
+        fty::nut::StringPool pool;
+        std::vector<std::thread> threads;
+        std::vector<std::vector<fty::nut::InternedString>> results(4);
+
+        for (size_t i = 0; i < results.size(); i++) {
+            threads.emplace_back([&pool, &results, i]() {
+                for (int j = 0; j < 1000; j++) {
+                    results[i].push_back(pool.intern("outlet." + std::to_string(j) + ".current"));
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+
+        assert(pool.size() == 1000);
+        for (size_t i = 1; i < results.size(); i++) {
+            for (size_t j = 0; j < results[i].size(); j++) {
+                assert(&results[i][j].str() == &results[0][j].str());
+            }
+        }
+    }
+
+    std::cout << "OK" << std::endl;
+}
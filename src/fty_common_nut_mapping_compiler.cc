@@ -0,0 +1,77 @@
+/*  =========================================================================
+    fty_common_nut_mapping_compiler - compiler of mapping files into binary images
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_mapping_compiler - compiler of mapping files into binary images
+@discuss
+    Compiles all mapping types of a mapping file into a binary image, to be
+    loaded with fty::nut::loadCompiledMapping() at startup instead of parsing
+    the mapping file. The image is written next to the mapping file with a
+    ".bin" extension, unless an output path is given. Images are tied to the
+    mapping file they were compiled from and are ignored once it changes, so
+    they must be regenerated whenever the mapping file is updated.
+@end
+*/
+
+#include "fty_common_nut_classes.h"
+
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+    std::string output;
+    std::string input;
+
+    for (int argn = 1; argn < argc; argn++) {
+        if (streq(argv[argn], "-o") && argn + 1 < argc) {
+            output = argv[++argn];
+        }
+        else if (input.empty() && argv[argn][0] != '-') {
+            input = argv[argn];
+        }
+        else {
+            input.clear();
+            break;
+        }
+    }
+
+    if (input.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [-o image] mapping-file" << std::endl;
+        return 1;
+    }
+
+    if (output.empty()) {
+        const size_t extension = input.rfind('.');
+        const size_t directory = input.rfind('/');
+        output = input.substr(0, extension != std::string::npos && (directory == std::string::npos || extension > directory) ? extension : std::string::npos) + ".bin";
+    }
+
+    try {
+        fty::nut::compileMappingImage(input, output);
+    }
+    catch (std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
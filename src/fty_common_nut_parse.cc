@@ -28,27 +28,898 @@
 
 #include "fty_common_nut_classes.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <locale.h>
+#include <random>
 #include <regex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
 
 namespace fty {
 namespace nut {
 
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static inline bool isAlpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static const char *skipBlanks(const char *it, const char *end)
+{
+    while (it != end && isBlank(*it)) {
+        it++;
+    }
+    return it;
+}
+
+/**
+ * \brief Match a configuration line against the section grammar
+ * "[[:blank:]]*\[([[:alnum:]_-]+)\][[:blank:]]*".
+ */
+static bool matchSection(const char *begin, const char *end, const char *&nameBegin, const char *&nameEnd)
+{
+    const char *it = skipBlanks(begin, end);
+    if (it == end || *it != '[') {
+        return false;
+    }
+
+    nameBegin = ++it;
+    while (it != end && (isAlpha(*it) || isDigit(*it) || *it == '_' || *it == '-')) {
+        it++;
+    }
+    nameEnd = it;
+
+    if (nameBegin == nameEnd || it == end || *it != ']') {
+        return false;
+    }
+    return skipBlanks(it + 1, end) == end;
+}
+
+/**
+ * \brief Match a configuration line against the option grammars.
+ *
+ * This replicates, including backtracking corner cases, the behaviour of
+ * matching first against the quoted grammar
+ * "[[:blank:]]*([[:alpha:]_-]+)[[:blank:]]*=[[:blank:]]*\"([^\"]+)\"[[:blank:]]*"
+ * and then against the unquoted grammar
+ * "[[:blank:]]*([[:alpha:]_-]+)[[:blank:]]*=[[:blank:]]*([^\"].*)".
+ */
+static bool matchOption(const char *begin, const char *end,
+    const char *&keyBegin, const char *&keyEnd, const char *&valueBegin, const char *&valueEnd)
+{
+    const char *it = skipBlanks(begin, end);
+
+    keyBegin = it;
+    while (it != end && (isAlpha(*it) || *it == '_' || *it == '-')) {
+        it++;
+    }
+    keyEnd = it;
+
+    if (keyBegin == keyEnd) {
+        return false;
+    }
+
+    it = skipBlanks(it, end);
+    if (it == end || *it != '=') {
+        return false;
+    }
+
+    const char *afterEqual = it + 1;
+    const char *valueStart = skipBlanks(afterEqual, end);
+
+    // Quoted value, it must be non-empty and followed only by blanks.
+    if (valueStart != end && *valueStart == '"') {
+        const char *closingQuote = static_cast<const char *>(std::memchr(valueStart + 1, '"', end - valueStart - 1));
+        if (closingQuote && closingQuote != valueStart + 1 && skipBlanks(closingQuote + 1, end) == end) {
+            valueBegin = valueStart + 1;
+            valueEnd = closingQuote;
+            return true;
+        }
+    }
+
+    // Unquoted value, the first character is anything but a quote and the
+    // rest can't contain a carriage return (ECMAScript's '.'). If the value
+    // starts with a quote, the regex backtracks and starts it on the last blank.
+    if (valueStart != end && *valueStart != '"') {
+        valueBegin = valueStart;
+    }
+    else if (valueStart != afterEqual) {
+        valueBegin = valueStart - 1;
+    }
+    else {
+        return false;
+    }
+
+    if (std::memchr(valueBegin + 1, '\r', end - valueBegin - 1)) {
+        return false;
+    }
+
+    valueEnd = end;
+    return true;
+}
+
 DeviceConfigurations parseConfigurationFile(const std::string& in)
+{
+    return parseConfigurationFile(in.data(), in.size(), nullptr);
+}
+
+DeviceConfigurations parseConfigurationFile(const char *in, size_t length, std::vector<size_t> *rejectedLines)
+{
+    DeviceConfigurations devices;
+    DeviceConfiguration device;
+
+    const char *it = in;
+    const char *end = in + length;
+    size_t lineNumber = 0;
+
+    while (it != end) {
+        const char *eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        if (!eol) {
+            eol = end;
+        }
+        lineNumber++;
+
+        const char *b1, *e1, *b2, *e2;
+        if (matchSection(it, eol, b1, e1)) {
+            // Section matched, flush current device if applicable and start anew.
+            if (!device.empty()) {
+                devices.emplace_back(std::move(device));
+            }
+            device.clear();
+            device.emplace(std::piecewise_construct, std::forward_as_tuple("name"), std::forward_as_tuple(b1, e1));
+        }
+        else if (matchOption(it, eol, b1, e1, b2, e2)) {
+            // Key-value pair matched, add it to the list.
+            device.emplace(std::piecewise_construct, std::forward_as_tuple(b1, e1), std::forward_as_tuple(b2, e2));
+        }
+        else if (rejectedLines) {
+            // Don't bother reporting blank lines and comments.
+            const char *first = skipBlanks(it, eol);
+            if (first != eol && *first != '#') {
+                rejectedLines->push_back(lineNumber);
+            }
+        }
+
+        it = eol == end ? end : eol + 1;
+    }
+
+    // Flush current device if applicable.
+    if (!device.empty()) {
+        devices.emplace_back(std::move(device));
+    }
+
+    return devices;
+}
+
+DeviceConfigurations readConfigurationFile(const std::string& path, std::vector<size_t> *rejectedLines)
+{
+    std::stringstream err;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err << "Error opening file '" << path << "': " << strerror(errno) << ".";
+        throw std::runtime_error(err.str());
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        err << "Error reading file '" << path << "': " << strerror(errno) << ".";
+        ::close(fd);
+        throw std::runtime_error(err.str());
+    }
+
+    if (st.st_size == 0) {
+        ::close(fd);
+        return {};
+    }
+
+    void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        err << "Error mapping file '" << path << "': " << strerror(errno) << ".";
+        throw std::runtime_error(err.str());
+    }
+    ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    DeviceConfigurations devices;
+    try {
+        devices = parseConfigurationFile(static_cast<const char *>(data), st.st_size, rejectedLines);
+    }
+    catch (...) {
+        ::munmap(data, st.st_size);
+        throw;
+    }
+    ::munmap(data, st.st_size);
+
+    return devices;
+}
+
+static bool isValidName(const std::string &name, bool allowDigits)
+{
+    if (name.empty()) {
+        return false;
+    }
+    for (char c : name) {
+        if (!(isAlpha(c) || (allowDigits && isDigit(c)) || c == '_' || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Render a device configuration in ups.conf format, appending it to a buffer.
+ *
+ * Values are always quoted, so that NUT neither takes '#' for a comment nor
+ * strips blanks. Inside quotes NUT reads '\\' as an escape and '"' as the end
+ * of the value while this library doesn't, so values containing them can't be
+ * read back identically by both and are rejected. Every rendered option is matched back against the
+ * option grammar to make sure it reads back identically.
+ *
+ * \throw std::runtime_error if the configuration can't be represented.
+ */
+static void renderDeviceConfiguration(std::string &out, const DeviceConfiguration &cfg)
+{
+    const auto name = cfg.find("name");
+    if (name == cfg.end() || !isValidName(name->second, true)) {
+        throw std::runtime_error("Device configuration has no valid name.");
+    }
+
+    out += '[';
+    out += name->second;
+    out += "]\n";
+
+    for (const auto &i : cfg) {
+        if (i.first == "name") {
+            continue;
+        }
+
+        const std::string &value = i.second;
+        if (!isValidName(i.first, false) || value.empty() || value.find_first_of("\n\"\\") != std::string::npos) {
+            throw std::runtime_error("Device configuration '" + name->second + "' has unrepresentable option '" + i.first + "'.");
+        }
+
+        const size_t lineStart = out.size();
+        out += '\t';
+        out += i.first;
+        out += " = \"";
+        out += value;
+        out += '"';
+
+        const char *keyBegin, *keyEnd, *valueBegin, *valueEnd;
+        if (!matchOption(out.data() + lineStart, out.data() + out.size(), keyBegin, keyEnd, valueBegin, valueEnd) ||
+            value.compare(0, std::string::npos, valueBegin, valueEnd - valueBegin) != 0) {
+            throw std::runtime_error("Device configuration '" + name->second + "' has unrepresentable option '" + i.first + "'.");
+        }
+        out += '\n';
+    }
+}
+
+void writeConfigurationFile(const std::string& path, const DeviceConfigurations& devices)
+{
+    std::string buffer;
+    for (const auto &device : devices) {
+        if (!buffer.empty()) {
+            buffer += '\n';
+        }
+        renderDeviceConfiguration(buffer, device);
+    }
+
+    priv::writeFileAtomically(path, buffer.data(), buffer.size());
+}
+
+/**
+ * \brief Feed a chunk of output to a line-oriented parser.
+ *
+ * Complete lines are handed to the handler straight out of the chunk, the
+ * trailing partial line is kept in partialLine until the next chunk.
+ */
+template <typename LineHandler>
+static void feedLines(std::string &partialLine, const char *data, size_t length, LineHandler handler)
+{
+    const char *it = data;
+    const char *end = data + length;
+
+    // Complete the partial line left over from the previous chunk.
+    if (!partialLine.empty()) {
+        const char *eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        if (!eol) {
+            partialLine.append(it, end);
+            return;
+        }
+
+        partialLine.append(it, eol);
+        handler(partialLine.data(), partialLine.data() + partialLine.size());
+        partialLine.clear();
+        it = eol + 1;
+    }
+
+    // Parse complete lines straight out of the chunk.
+    while (it != end) {
+        const char *eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        if (!eol) {
+            partialLine.assign(it, end);
+            break;
+        }
+
+        handler(it, eol);
+        it = eol + 1;
+    }
+}
+
+/**
+ * \brief Flush the trailing partial line of a line-oriented parser.
+ */
+template <typename LineHandler>
+static void finishLines(std::string &partialLine, LineHandler handler)
+{
+    if (!partialLine.empty()) {
+        handler(partialLine.data(), partialLine.data() + partialLine.size());
+        partialLine.clear();
+    }
+}
+
+/**
+ * \brief Match name="value" at a position of a scanner output line.
+ * \return End of match, or nullptr if no match.
+ */
+static const char *matchScannerKeyValue(const char *it, const char *end,
+    const char *&keyBegin, const char *&keyEnd, const char *&valueBegin, const char *&valueEnd)
+{
+    keyBegin = it;
+    while (it != end && (isAlpha(*it) || *it == '_' || *it == '-')) {
+        it++;
+    }
+    keyEnd = it;
+
+    if (keyBegin == keyEnd || end - it < 2 || it[0] != '=' || it[1] != '"') {
+        return nullptr;
+    }
+
+    valueBegin = it + 2;
+    valueEnd = static_cast<const char *>(std::memchr(valueBegin, '"', end - valueBegin));
+    if (!valueEnd) {
+        return nullptr;
+    }
+
+    it = valueEnd + 1;
+    if (it != end && *it == ',') {
+        it++;
+    }
+    return it;
+}
+
+/**
+ * \brief Parse a line of scanner output.
+ *
+ * This searches the line for successive matches of the
+ * "(?:[[:alpha:]]+:)?([[:alpha:]_-]+)="([^"]*)",?" grammar, which matches
+ * data in the form of (ignored:)name="value"(,) and thus matches one
+ * key-value pair, with the same semantics as std::regex_search.
+ */
+static DeviceConfiguration parseScannerLine(const char *begin, const char *end)
+{
+    DeviceConfiguration device;
+
+    const char *it = begin;
+    while (it != end) {
+        const char *keyBegin, *keyEnd, *valueBegin, *valueEnd;
+        const char *matchEnd = nullptr;
+
+        // Try first with the optional "ignored:" prefix.
+        const char *prefixEnd = it;
+        while (prefixEnd != end && isAlpha(*prefixEnd)) {
+            prefixEnd++;
+        }
+        if (prefixEnd != it && prefixEnd != end && *prefixEnd == ':') {
+            matchEnd = matchScannerKeyValue(prefixEnd + 1, end, keyBegin, keyEnd, valueBegin, valueEnd);
+        }
+        if (!matchEnd) {
+            matchEnd = matchScannerKeyValue(it, end, keyBegin, keyEnd, valueBegin, valueEnd);
+        }
+
+        if (matchEnd) {
+            device.emplace(std::piecewise_construct, std::forward_as_tuple(keyBegin, keyEnd), std::forward_as_tuple(valueBegin, valueEnd));
+            it = matchEnd;
+        }
+        else {
+            it++;
+        }
+    }
+
+    return device;
+}
+
+DeviceConfigurations parseScannerOutput(const std::string& in)
+{
+    DeviceConfigurations devices;
+
+    ScannerOutputParser parser([&devices](DeviceConfiguration&& device) {
+        devices.emplace_back(std::move(device));
+    });
+    parser.feed(in);
+    parser.finish();
+
+    return devices;
+}
+
+ScannerOutputParser::ScannerOutputParser(Callback callback) :
+    m_callback(std::move(callback))
+{
+}
+
+void ScannerOutputParser::feed(const char *data, size_t length)
+{
+    feedLines(m_partialLine, data, length, [this](const char *begin, const char *end) { parseLine(begin, end); });
+}
+
+void ScannerOutputParser::feed(const std::string &data)
+{
+    feed(data.data(), data.size());
+}
+
+void ScannerOutputParser::finish()
+{
+    finishLines(m_partialLine, [this](const char *begin, const char *end) { parseLine(begin, end); });
+}
+
+void ScannerOutputParser::parseLine(const char *begin, const char *end)
+{
+    DeviceConfiguration device = parseScannerLine(begin, end);
+    if (!device.empty()) {
+        m_callback(std::move(device));
+    }
+}
+
+/**
+ * \brief Match a line of driver dump output against the "([a-z0-9.]+): (.*)" grammar.
+ *
+ * This is a hand-written equivalent of the regular expression, which was by
+ * far the most expensive part of parsing driver output.
+ *
+ * \param begin Start of line.
+ * \param end End of line (newline excluded).
+ * \param separator Set to the position of the ": " separator on match.
+ * \return True if the line is a key-value entry.
+ */
+static bool matchDumpLine(const char *begin, const char *end, const char *&separator)
+{
+    const char *it = begin;
+    while (it != end && ((*it >= 'a' && *it <= 'z') || (*it >= '0' && *it <= '9') || *it == '.')) {
+        it++;
+    }
+
+    if (it == begin || end - it < 2 || it[0] != ':' || it[1] != ' ') {
+        return false;
+    }
+
+    // ECMAScript's '.' doesn't match line terminators, so neither do we.
+    if (std::memchr(it + 2, '\r', end - it - 2)) {
+        return false;
+    }
+
+    separator = it;
+    return true;
+}
+
+KeyValues parseDumpOutput(const std::string& in)
+{
+    KeyValues entries;
+
+    const char *it = in.data();
+    const char *end = it + in.size();
+
+    while (it != end) {
+        const char *eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        if (!eol) {
+            eol = end;
+        }
+
+        const char *separator;
+        if (matchDumpLine(it, eol, separator)) {
+            entries.emplace_hint(entries.end(), std::piecewise_construct,
+                std::forward_as_tuple(it, separator),
+                std::forward_as_tuple(separator + 2, eol));
+        }
+
+        it = eol == end ? end : eol + 1;
+    }
+
+    return entries;
+}
+
+PooledKeyValues parseDumpOutput(const std::string& in, StringPool& pool)
+{
+    PooledKeyValues entries;
+
+    const char *it = in.data();
+    const char *end = it + in.size();
+
+    while (it != end) {
+        const char *eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        if (!eol) {
+            eol = end;
+        }
+
+        const char *separator;
+        if (matchDumpLine(it, eol, separator)) {
+            const InternedString key = pool.intern(it, separator - it);
+            const char *value = separator + 2;
+            entries.emplace_hint(entries.end(), key, isLowCardinalityValue(key.str(), value, eol - value) ?
+                PooledValue(pool.intern(value, eol - value)) : PooledValue(std::string(value, eol)));
+        }
+
+        it = eol == end ? end : eol + 1;
+    }
+
+    return entries;
+}
+
+TypedValue classifyValue(std::string text)
+{
+    static const locale_t cLocale = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+
+    TypedValue value;
+    value.text = std::move(text);
+
+    const char *begin = value.text.data();
+    const char *end = begin + value.text.size();
+    const char *it = begin;
+
+    const bool negative = it != end && *it == '-';
+    if (negative) {
+        it++;
+    }
+
+    // Integer part.
+    const char *integerBegin = it;
+    while (it != end && isDigit(*it)) {
+        it++;
+    }
+    const char *integerEnd = it;
+
+    if (integerBegin != integerEnd && it == end) {
+        // Accumulate negatively, so that INT64_MIN fits.
+        int64_t accumulator = 0;
+        bool overflow = false;
+        for (const char *digit = integerBegin; digit != integerEnd; digit++) {
+            const int d = *digit - '0';
+            if (accumulator < (std::numeric_limits<int64_t>::min() + d) / 10) {
+                overflow = true;
+                break;
+            }
+            accumulator = accumulator * 10 - d;
+        }
+        if (!negative && accumulator == std::numeric_limits<int64_t>::min()) {
+            overflow = true;
+        }
+
+        if (!overflow) {
+            value.type = TypedValue::TYPE_INTEGER;
+            value.integer = negative ? accumulator : -accumulator;
+            value.number = static_cast<double>(value.integer);
+            return value;
+        }
+    }
+
+    // Fractional part.
+    bool hasDigits = integerBegin != integerEnd;
+    if (it != end && *it == '.') {
+        it++;
+        const char *fractionBegin = it;
+        while (it != end && isDigit(*it)) {
+            it++;
+        }
+        hasDigits = hasDigits || it != fractionBegin;
+    }
+    if (!hasDigits) {
+        return value;
+    }
+
+    // Exponent.
+    if (it != end && (*it == 'e' || *it == 'E')) {
+        it++;
+        if (it != end && (*it == '+' || *it == '-')) {
+            it++;
+        }
+        const char *exponentBegin = it;
+        while (it != end && isDigit(*it)) {
+            it++;
+        }
+        if (it == exponentBegin) {
+            return value;
+        }
+    }
+
+    if (it != end) {
+        return value;
+    }
+
+    errno = 0;
+    const double number = strtod_l(begin, nullptr, cLocale);
+    if (errno != ERANGE) {
+        value.type = TypedValue::TYPE_FLOAT;
+        value.number = number;
+    }
+    return value;
+}
+
+TypedKeyValues classifyValues(const KeyValues &values)
+{
+    TypedKeyValues result;
+    for (const auto &value : values) {
+        result.emplace_hint(result.end(), value.first, classifyValue(value.second));
+    }
+    return result;
+}
+
+void parseDumpOutput(const std::string& in, TypedKeyValues& values)
+{
+    values.clear();
+
+    const char *it = in.data();
+    const char *end = it + in.size();
+
+    while (it != end) {
+        const char *eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        if (!eol) {
+            eol = end;
+        }
+
+        const char *separator;
+        if (matchDumpLine(it, eol, separator)) {
+            std::string key(it, separator);
+            if (!values.count(key)) {
+                values.emplace_hint(values.end(), std::move(key), classifyValue(std::string(separator + 2, eol)));
+            }
+        }
+
+        it = eol == end ? end : eol + 1;
+    }
+}
+
+/**
+ * \brief Compare two keys with the same ordering as std::string.
+ */
+static int compareKeys(const char *a, size_t aLength, const char *b, size_t bLength)
+{
+    int r = std::memcmp(a, b, std::min(aLength, bLength));
+    if (r == 0) {
+        r = aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+    }
+    return r;
+}
+
+const size_t DumpSnapshot::npos;
+
+DumpSnapshot::DumpSnapshot(std::string buffer) :
+    m_buffer(std::move(buffer))
+{
+    if (m_buffer.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::length_error("Driver output too large for dump snapshot.");
+    }
+
+    const char *begin = m_buffer.data();
+    const char *it = begin;
+    const char *end = it + m_buffer.size();
+
+    while (it != end) {
+        const char *eol = static_cast<const char *>(std::memchr(it, '\n', end - it));
+        if (!eol) {
+            eol = end;
+        }
+
+        const char *separator;
+        if (matchDumpLine(it, eol, separator)) {
+            m_entries.push_back({
+                static_cast<uint32_t>(it - begin),
+                static_cast<uint32_t>(separator - it),
+                static_cast<uint32_t>(separator + 2 - begin),
+                static_cast<uint32_t>(eol - separator - 2)
+            });
+        }
+
+        it = eol == end ? end : eol + 1;
+    }
+
+    // Sort entries by key, keeping only the first occurrence of duplicated keys.
+    auto less = [begin](const Entry &a, const Entry &b) {
+        return compareKeys(begin + a.keyOffset, a.keyLength, begin + b.keyOffset, b.keyLength) < 0;
+    };
+    auto equal = [begin](const Entry &a, const Entry &b) {
+        return compareKeys(begin + a.keyOffset, a.keyLength, begin + b.keyOffset, b.keyLength) == 0;
+    };
+    if (!std::is_sorted(m_entries.begin(), m_entries.end(), less)) {
+        std::stable_sort(m_entries.begin(), m_entries.end(), less);
+    }
+    m_entries.erase(std::unique(m_entries.begin(), m_entries.end(), equal), m_entries.end());
+    m_entries.shrink_to_fit();
+}
+
+std::string DumpSnapshot::key(size_t index) const
+{
+    return std::string(keyData(index), keyLength(index));
+}
+
+std::string DumpSnapshot::value(size_t index) const
+{
+    return std::string(valueData(index), valueLength(index));
+}
+
+size_t DumpSnapshot::indexOf(const char *key, size_t length) const
+{
+    const char *begin = m_buffer.data();
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), 0,
+        [begin, key, length](const Entry &entry, int) {
+            return compareKeys(begin + entry.keyOffset, entry.keyLength, key, length) < 0;
+        }
+    );
+
+    if (it == m_entries.end() || compareKeys(begin + it->keyOffset, it->keyLength, key, length) != 0) {
+        return npos;
+    }
+    return it - m_entries.begin();
+}
+
+bool DumpSnapshot::find(const std::string &key, std::string &value) const
+{
+    size_t index = indexOf(key);
+    if (index == npos) {
+        return false;
+    }
+
+    value.assign(valueData(index), valueLength(index));
+    return true;
+}
+
+KeyValues DumpSnapshot::toKeyValues() const
+{
+    KeyValues result;
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        result.emplace_hint(result.end(), std::piecewise_construct,
+            std::forward_as_tuple(keyData(i), keyLength(i)),
+            std::forward_as_tuple(valueData(i), valueLength(i)));
+    }
+    return result;
+}
+
+void parseDumpOutput(std::string in, DumpSnapshot& snapshot)
+{
+    snapshot = DumpSnapshot(std::move(in));
+}
+
+DumpOutputParser::DumpOutputParser(Callback callback) :
+    m_callback(std::move(callback))
+{
+}
+
+void DumpOutputParser::feed(const char *data, size_t length)
+{
+    feedLines(m_partialLine, data, length, [this](const char *begin, const char *end) { parseLine(begin, end); });
+}
+
+void DumpOutputParser::feed(const std::string &data)
+{
+    feed(data.data(), data.size());
+}
+
+void DumpOutputParser::finish()
+{
+    finishLines(m_partialLine, [this](const char *begin, const char *end) { parseLine(begin, end); });
+}
+
+void DumpOutputParser::parseLine(const char *begin, const char *end)
+{
+    const char *separator;
+    if (matchDumpLine(begin, end, separator)) {
+        m_key.assign(begin, separator);
+        m_value.assign(separator + 2, end);
+        m_callback(m_key, m_value);
+    }
+}
+
+DumpLoopParser::DumpLoopParser(Callback callback) :
+    m_callback(std::move(callback)),
+    m_parser([this](const std::string &key, const std::string &value) { entry(key, value); }),
+    m_loop(0)
+{
+}
+
+void DumpLoopParser::feed(const char *data, size_t length)
+{
+    m_parser.feed(data, length);
+}
+
+void DumpLoopParser::feed(const std::string &data)
+{
+    m_parser.feed(data);
+}
+
+void DumpLoopParser::finish()
+{
+    m_parser.finish();
+    if (!m_values.empty()) {
+        m_callback(m_loop++, m_values);
+        m_values.clear();
+    }
+}
+
+void DumpLoopParser::entry(const std::string &key, const std::string &value)
+{
+    auto it = m_values.lower_bound(key);
+    if (it != m_values.end() && it->first == key) {
+        // Key already seen, this is the start of the next loop.
+        m_callback(m_loop++, m_values);
+        m_values.clear();
+        it = m_values.end();
+    }
+    m_values.emplace_hint(it, key, value);
+}
+
+}
+}
+
+std::ostream& operator<<(std::ostream &out, const fty::nut::DeviceConfiguration &cfg)
+{
+    std::string name = "<unknown>";
+    if (cfg.count("name")) {
+        name = cfg.at("name");
+    }
+
+    out << "[" << name << "]\n";
+    for (const auto &i : cfg) {
+        if (i.first == "name") {
+            continue;
+        }
+
+        out << "\t" << i.first << " = \"" << i.second << "\"\n";
+    }
+
+    return out;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+/**
+ * \brief Reference regex-based implementation of fty::nut::parseConfigurationFile,
+ * used for differential testing.
+ */
+static fty::nut::DeviceConfigurations parseConfigurationFileRegex(const std::string& in, std::vector<size_t> &rejectedLines)
 {
     static const std::regex regexSection(R"xxx([[:blank:]]*\[([[:alnum:]_-]+)\][[:blank:]]*)xxx", std::regex::optimize);
     static const std::regex regexOptionQuoted(R"xxx([[:blank:]]*([[:alpha:]_-]+)[[:blank:]]*=[[:blank:]]*"([^"]+)"[[:blank:]]*)xxx", std::regex::optimize);
     static const std::regex regexOptionUnquoted(R"xxx([[:blank:]]*([[:alpha:]_-]+)[[:blank:]]*=[[:blank:]]*([^"].*))xxx", std::regex::optimize);
+    static const std::regex regexIgnored(R"xxx([[:blank:]]*(#.*)?)xxx", std::regex::optimize);
     std::smatch matches;
     std::stringstream inStream(in);
     std::string line;
+    size_t lineNumber = 0;
 
-    DeviceConfigurations devices;
-    DeviceConfiguration device;
+    fty::nut::DeviceConfigurations devices;
+    fty::nut::DeviceConfiguration device;
 
     while (std::getline(inStream, line)) {
+        lineNumber++;
         if (std::regex_match(line, matches, regexSection)) {
-            // Section matched, flush current device if applicable and start anew.
             if (!device.empty()) {
                 devices.emplace_back(device);
             }
@@ -56,12 +927,13 @@ DeviceConfigurations parseConfigurationFile(const std::string& in)
             device.emplace("name", matches[1].str());
         }
         else if (std::regex_match(line, matches, regexOptionQuoted) || std::regex_match(line, matches, regexOptionUnquoted)) {
-            // Key-value pair matched, add it to the list.
             device.emplace(matches[1].str(), matches[2].str());
         }
+        else if (line.find_first_not_of(" \t") != std::string::npos && line[line.find_first_not_of(" \t")] != '#') {
+            rejectedLines.push_back(lineNumber);
+        }
     }
 
-    // Flush current device if applicable.
     if (!device.empty()) {
         devices.emplace_back(device);
     }
@@ -69,42 +941,115 @@ DeviceConfigurations parseConfigurationFile(const std::string& in)
     return devices;
 }
 
-DeviceConfigurations parseScannerOutput(const std::string& in)
+/**
+ * \brief Generate a synthetic configuration file, mixing valid lines with
+ * near misses of the section and option grammars.
+ */
+static std::string generateConfigurationFile(std::mt19937 &generator, size_t lines)
+{
+    static const std::vector<std::string> blanks = { "", "", " ", "\t", "  \t" };
+    static const std::vector<std::string> names = { "nutdev1", "ups_2", "epdu-3", "", "a b", "x.y" };
+    static const std::vector<std::string> keys = { "driver", "port", "desc", "mibs", "secName", "name", "community2", "", "_-" };
+    static const std::vector<std::string> values = {
+        "\"snmp-ups\"", "snmp-ups", "\"\"", "\"", "\"a\"b", "\"unterminated", "\"a b\" ", "\"x\" # c",
+        "10.130.32.117", "", " ", "\r", "\"a\rb\"", "a\rb", "\"a\"\r", "Eaton ePDU MA 1P IN:C20 16A OUT:20xC13, 4xC19M"
+    };
+    static const std::vector<std::string> misc = { "", "# comment", "  # key = value", "garbage", "[", "[]", "=value" };
+
+    auto pick = [&generator](const std::vector<std::string> &v) -> const std::string & {
+        return v[generator() % v.size()];
+    };
+
+    std::string output;
+    for (size_t i = 0; i < lines; i++) {
+        switch (generator() % 8) {
+            case 0:
+                output += pick(blanks) + "[" + pick(names) + "]" + pick(blanks);
+                break;
+            case 1:
+                output += pick(misc);
+                break;
+            default:
+                output += pick(blanks) + pick(keys) + pick(blanks) + "=" + pick(blanks) + pick(values) + pick(blanks);
+                break;
+        }
+        output += '\n';
+    }
+
+    return output;
+}
+
+/**
+ * \brief Reference regex-based implementation of fty::nut::parseScannerOutput,
+ * used for differential testing.
+ */
+static fty::nut::DeviceConfigurations parseScannerOutputRegex(const std::string& in)
 {
-    /**
-     * This regex matches data in the form of (ignored:)name="value"(,) and thus matches
-     * one key-value pair.
-     */
     static const std::regex regexEntry(R"xxx((?:[[:alpha:]]+:)?([[:alpha:]_-]+)="([^"]*)",?)xxx", std::regex::optimize);
-    std::smatch matches;
     std::stringstream inStream(in);
     std::string line;
 
-    DeviceConfigurations devices;
+    fty::nut::DeviceConfigurations devices;
 
     while (std::getline(inStream, line)) {
-        DeviceConfiguration device;
+        fty::nut::DeviceConfiguration device;
 
         auto begin = std::sregex_iterator(line.begin(), line.end(), regexEntry);
         for (auto it = begin; it != std::sregex_iterator(); it++) {
-            // Iterate over all key-value pairs matches.
             device.emplace((*it)[1].str(), (*it)[2].str());
         }
 
-        devices.emplace_back(device);
+        // Empty configurations are skipped.
+        if (!device.empty()) {
+            devices.emplace_back(device);
+        }
     }
 
     return devices;
 }
 
-KeyValues parseDumpOutput(const std::string& in)
+/**
+ * \brief Generate synthetic scanner output, mixing valid entries with
+ * near misses of the name="value" grammar.
+ */
+static std::string generateScannerOutput(std::mt19937 &generator, size_t lines)
+{
+    static const std::vector<std::string> prefixes = { "", "XML:", "SNMP:", "SNMP:XML:", "1:", ":", "a b:" };
+    static const std::vector<std::string> keys = { "driver", "port", "desc", "sec_Name", "-", "", "mi bs", "x:y", "a1" };
+    static const std::vector<std::string> values = {
+        "\"snmp-ups\"", "\"\"", "\"10.130.33.7\"", "\"a,b=\\\"c\"", "\"unterminated", "snmp-ups", "\"x\r\""
+    };
+    static const std::vector<std::string> separators = { ",", ",", ",,", "", " ", ", " };
+
+    auto pick = [&generator](const std::vector<std::string> &v) -> const std::string & {
+        return v[generator() % v.size()];
+    };
+
+    std::string output;
+    for (size_t i = 0; i < lines; i++) {
+        output += pick(prefixes);
+        const size_t nb = generator() % 8;
+        for (size_t j = 0; j < nb; j++) {
+            output += pick(keys) + "=" + pick(values) + pick(separators);
+        }
+        output += '\n';
+    }
+
+    return output;
+}
+
+/**
+ * \brief Reference regex-based implementation of fty::nut::parseDumpOutput,
+ * used for differential testing.
+ */
+static fty::nut::KeyValues parseDumpOutputRegex(const std::string& in)
 {
     static const std::regex regexEntry(R"xxx(([a-z0-9.]+): (.*))xxx", std::regex::optimize);
     std::smatch matches;
     std::stringstream inStream(in);
     std::string line;
 
-    KeyValues entries;
+    fty::nut::KeyValues entries;
 
     while (std::getline(inStream, line)) {
         if (std::regex_match(line, matches, regexEntry)) {
@@ -115,30 +1060,45 @@ KeyValues parseDumpOutput(const std::string& in)
     return entries;
 }
 
-}
-}
-
-std::ostream& operator<<(std::ostream &out, const fty::nut::DeviceConfiguration &cfg)
+/**
+ * \brief Generate a synthetic driver dump, mixing valid entries with lines
+ * that are near misses of the "key: value" grammar.
+ */
+static std::string generateDumpOutput(std::mt19937 &generator, size_t lines)
 {
-    std::string name = "<unknown>";
-    if (cfg.count("name")) {
-        name = cfg.at("name");
-    }
+    static const std::vector<std::string> keyParts = {
+        "device", "ups", "input", "output", "outlet", "battery", "ambient", "L1", "l2",
+        "1", "12", "98", "voltage", "current", "realpower", "status", "mfr", "Model", ""
+    };
+    static const std::vector<std::string> separators = {
+        ": ", ": ", ": ", ":", " : ", ":  ", ": \r", ":\t", "= ", ""
+    };
+    static const std::vector<std::string> values = {
+        "244", "on", "yes", "EATON", "", " ", "offline / line interactive", "a: b", "x\r",
+        "\ry", std::string("nul\0l", 5), "http://10.130.33.199", "\t\t", "#"
+    };
 
-    out << "[" << name << "]" << std::endl;
-    for (const auto &i : cfg) {
-        if (i.first == "name") {
-            continue;
-        }
+    std::uniform_int_distribution<size_t> partNb(1, 4);
+    std::string output;
 
-        out << "\t" << i.first << " = \"" << i.second << "\"" << std::endl;
+    for (size_t i = 0; i < lines; i++) {
+        std::string key;
+        const size_t nb = partNb(generator);
+        for (size_t j = 0; j < nb; j++) {
+            if (j) {
+                key += '.';
+            }
+            key += keyParts[generator() % keyParts.size()];
+        }
+        output += key + separators[generator() % separators.size()] + values[generator() % values.size()];
+        if (generator() % 16) {
+            output += '\n';
+        }
     }
 
-    return out;
+    return output;
 }
 
-//  --------------------------------------------------------------------------
-//  Self test of this class
 
 void fty_common_nut_parse_test(bool verbose)
 {
@@ -205,6 +1165,162 @@ void fty_common_nut_parse_test(bool verbose)
         }
     }
 
+    // fty::nut::parseConfigurationFile (differential test against regex implementation)
+    {
+        std::mt19937 generator(4);
+
+        const std::vector<std::string> corpus = {
+            "",
+            "key = value",
+            "[dev]\nkey = \"a\" # trailing\nkey2 =  \"b\nkey3 = \"\"\nkey4 = \r\n",
+            generateConfigurationFile(generator, 16),
+            generateConfigurationFile(generator, 20000)
+        };
+
+        for (const auto &input : corpus) {
+            std::vector<size_t> rejectedLines, expectedRejectedLines;
+            auto result = fty::nut::parseConfigurationFile(input.data(), input.size(), &rejectedLines);
+            assert(result == parseConfigurationFileRegex(input, expectedRejectedLines));
+            assert(rejectedLines == expectedRejectedLines);
+            assert(fty::nut::parseConfigurationFile(input) == result);
+        }
+    }
+
+    // fty::nut::readConfigurationFile
+    {
+        static const std::string path = "src/selftest-rw/ups.conf";
+        static const std::string configurationFile = "[nutdev1]\n\tdriver = \"netxml-ups\"\n\tport = \"http://10.130.33.199\"\noops\n";
+
+        {
+            std::ofstream out(path);
+            out << configurationFile;
+        }
+
+        std::vector<size_t> rejectedLines;
+        auto result = fty::nut::readConfigurationFile(path, &rejectedLines);
+        assert(result == fty::nut::parseConfigurationFile(configurationFile));
+        assert(result.size() == 1);
+        assert(rejectedLines == std::vector<size_t>({ 4 }));
+        std::remove(path.c_str());
+
+        bool caughtException = false;
+        try {
+            fty::nut::readConfigurationFile(path);
+        }
+        catch (std::runtime_error &) {
+            caughtException = true;
+        }
+        assert(caughtException);
+    }
+
+    // fty::nut::writeConfigurationFile
+    {
+        static const std::string path = "src/selftest-rw/ups.conf";
+
+        // New file honours the umask, replaced file keeps its permissions.
+        {
+            std::remove(path.c_str());
+            const mode_t mask = umask(0);
+            umask(mask);
+            struct stat st;
+            fty::nut::writeConfigurationFile(path, {});
+            int ret = stat(path.c_str(), &st);
+            assert(ret == 0 && (st.st_mode & 07777) == (0666 & ~mask));
+            ret = chmod(path.c_str(), 0640);
+            assert(ret == 0);
+            fty::nut::writeConfigurationFile(path, {});
+            ret = stat(path.c_str(), &st);
+            assert(ret == 0 && (st.st_mode & 07777) == 0640);
+        }
+
+        // Round-trip of generated configurations.
+        std::mt19937 generator(9);
+        auto devices = fty::nut::parseConfigurationFile(generateConfigurationFile(generator, 20000));
+        // Options before the first section yield a device without a proper section name.
+        // Values with quotes or backslashes can't be written.
+        devices.erase(std::remove_if(devices.begin(), devices.end(), [](const fty::nut::DeviceConfiguration &device) {
+            return !device.count("name") || !fty::nut::parseConfigurationFile("[" + device.at("name") + "]").size() ||
+                std::any_of(device.begin(), device.end(), [](const fty::nut::DeviceConfiguration::value_type &option) {
+                    return option.second.find_first_of("\"\\") != std::string::npos;
+                });
+        }), devices.end());
+        assert(devices.size() > 100);
+        fty::nut::writeConfigurationFile(path, devices);
+        std::vector<size_t> rejectedLines;
+        assert(fty::nut::readConfigurationFile(path, &rejectedLines) == devices);
+        assert(rejectedLines.empty());
+
+        // Values which need special care, always quoted so that NUT reads them identically.
+        const fty::nut::DeviceConfigurations tricky = {
+            {
+                { "name", "nutdev-1_A" },
+                { "desc", "  padded # not a comment  " },
+                { "path", "C:/x" },
+                { "equal", "a = b" },
+                { "cr", "a\rb" }
+            }
+        };
+        fty::nut::writeConfigurationFile(path, tricky);
+        assert(fty::nut::readConfigurationFile(path) == tricky);
+        {
+            std::ifstream in(path);
+            std::string line;
+            while (std::getline(in, line)) {
+                assert(line.empty() || line[0] == '[' || (line.find(" = \"") != std::string::npos && line.back() == '"'));
+            }
+        }
+
+        // Unrepresentable configurations throw and leave the file untouched.
+        const std::vector<fty::nut::DeviceConfigurations> invalids = {
+            { { { "driver", "snmp-ups" } } },
+            { { { "name", "nut dev" } } },
+            { { { "name", "nutdev1" }, { "port1", "10.0.0.1" } } },
+            { { { "name", "nutdev1" }, { "desc", "" } } },
+            { { { "name", "nutdev1" }, { "desc", "two\nlines" } } },
+            { { { "name", "nutdev1" }, { "desc", "\"leading quote" } } },
+            { { { "name", "nutdev1" }, { "desc", " \"quoted\" " } } },
+            { { { "name", "nutdev1" }, { "desc", "quote\"\r" } } },
+            { { { "name", "nutdev1" }, { "desc", "with \"quotes\" inside" } } },
+            { { { "name", "nutdev1" }, { "desc", "a\"b#c" } } },
+            { { { "name", "nutdev1" }, { "desc", "C:\\x" } } },
+            { { { "name", "nutdev1" }, { "desc", "trailing\\" } } }
+        };
+        for (const auto &invalid : invalids) {
+            bool caughtException = false;
+            try {
+                fty::nut::writeConfigurationFile(path, invalid);
+            }
+            catch (std::runtime_error &) {
+                caughtException = true;
+            }
+            assert(caughtException);
+            assert(fty::nut::readConfigurationFile(path) == tricky);
+        }
+
+        // No temporary file is left behind.
+        size_t entries = 0;
+        DIR *dir = opendir("src/selftest-rw");
+        assert(dir);
+        while (struct dirent *entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "ups.conf", 8) == 0) {
+                entries++;
+            }
+        }
+        closedir(dir);
+        assert(entries == 1);
+
+        std::remove(path.c_str());
+
+        bool caughtException = false;
+        try {
+            fty::nut::writeConfigurationFile("src/selftest-rw/nosuchdir/ups.conf", devices);
+        }
+        catch (std::runtime_error &) {
+            caughtException = true;
+        }
+        assert(caughtException);
+    }
+
     // fty::nut::parseScannerOutput
     {
         static const std::string scannerOutput = R"xxx(XML:driver="netxml-ups",port="http://10.130.33.199",desc="Mosaic 4M",name="nutdev1"
@@ -231,6 +1347,48 @@ SNMP:driver="snmp-ups",port="10.130.32.117",desc="Eaton ePDU MA 1P IN:C20 16A OU
         }
     }
 
+    // fty::nut::parseScannerOutput (differential test against regex implementation)
+    {
+        std::mt19937 generator(5);
+
+        const std::vector<std::string> corpus = {
+            "",
+            "\n\n",
+            "XML:driver=\"netxml-ups\"\n\nSNMP:driver=\"snmp-ups\",,port=\"1.2.3.4\"",
+            "ab:cd:ef=\"x\"garbage=\"y\"",
+            generateScannerOutput(generator, 16),
+            generateScannerOutput(generator, 5000)
+        };
+
+        for (const auto &input : corpus) {
+            assert(fty::nut::parseScannerOutput(input) == parseScannerOutputRegex(input));
+        }
+    }
+
+    // fty::nut::ScannerOutputParser
+    {
+        std::mt19937 generator(6);
+        const std::string input = generateScannerOutput(generator, 512);
+        const auto expected = fty::nut::parseScannerOutput(input);
+
+        for (size_t maxChunkSize : { 1, 3, 64, 4096 }) {
+            fty::nut::DeviceConfigurations result;
+            fty::nut::ScannerOutputParser parser([&result](fty::nut::DeviceConfiguration &&device) {
+                result.emplace_back(std::move(device));
+            });
+
+            std::uniform_int_distribution<size_t> chunkSize(0, maxChunkSize);
+            for (size_t i = 0; i < input.size(); ) {
+                const size_t length = std::min(chunkSize(generator), input.size() - i);
+                parser.feed(input.data() + i, length);
+                i += length;
+            }
+            parser.finish();
+
+            assert(result == expected);
+        }
+    }
+
     // fty::nut::parseDumpOutput
     {
         // Launching the command by hand for the NetXML driver resulted in some extra junk at the beginning.
@@ -295,6 +1453,225 @@ ups.type: offline / line interactive
         }
     }
 
+    // fty::nut::parseDumpOutput (differential test against regex implementation)
+    {
+        std::mt19937 generator(42);
+
+        const std::vector<std::string> corpus = {
+            "",
+            "\n",
+            "a: b",
+            "a: ",
+            "a:",
+            ": b",
+            "a: b\r\n",
+            "a: b\rc\n",
+            "a.b.c: d: e\n",
+            "A: b\n",
+            "a: first\na: second\n",
+            generateDumpOutput(generator, 16),
+            generateDumpOutput(generator, 256),
+            generateDumpOutput(generator, 100000)
+        };
+
+        for (const auto &input : corpus) {
+            assert(fty::nut::parseDumpOutput(input) == parseDumpOutputRegex(input));
+        }
+    }
+
+    // fty::nut::parseDumpOutput (interned)
+    {
+        std::mt19937 generator(8);
+        const std::string input = generateDumpOutput(generator, 4096);
+
+        fty::nut::StringPool pool;
+        auto result = fty::nut::parseDumpOutput(input, pool);
+        assert(fty::nut::toKeyValues(result) == fty::nut::parseDumpOutput(input));
+
+        // Parsing the same output again doesn't grow the pool.
+        const size_t poolSize = pool.size();
+        auto result2 = fty::nut::parseDumpOutput(input, pool);
+        assert(pool.size() == poolSize);
+        assert(result2 == result);
+
+        // Polls with changing measurements and timestamps don't grow the pool either.
+        auto poll = [](int i) {
+            std::string output = "device.mfr: EATON\nups.date: 2020/01/" + std::to_string(i) + "\n";
+            for (int outlet = 1; outlet <= 8; outlet++) {
+                output += "outlet." + std::to_string(outlet) + ".status: on\n";
+                output += "outlet." + std::to_string(outlet) + ".current: " + std::to_string(i * outlet) + ".25\n";
+            }
+            return output;
+        };
+        fty::nut::StringPool pollPool;
+        fty::nut::parseDumpOutput(poll(0), pollPool);
+        const size_t pollPoolSize = pollPool.size();
+        for (int i = 1; i < 100; i++) {
+            const auto values = fty::nut::parseDumpOutput(poll(i), pollPool);
+            assert(fty::nut::toKeyValues(values) == fty::nut::parseDumpOutput(poll(i)));
+            assert(values.at(pollPool.intern("device.mfr")).interned());
+            assert(!values.at(pollPool.intern("outlet.1.current")).interned());
+        }
+        assert(pollPool.size() == pollPoolSize);
+    }
+
+    // fty::nut::classifyValue
+    {
+        using Type = fty::nut::TypedValue::Type;
+        const std::vector<std::tuple<std::string, Type, double>> testCases = {
+            std::make_tuple("244", Type::TYPE_INTEGER, 244.0),
+            std::make_tuple("-5", Type::TYPE_INTEGER, -5.0),
+            std::make_tuple("007", Type::TYPE_INTEGER, 7.0),
+            std::make_tuple("9223372036854775807", Type::TYPE_INTEGER, 9223372036854775807.0),
+            std::make_tuple("-9223372036854775808", Type::TYPE_INTEGER, -9223372036854775808.0),
+            std::make_tuple("9223372036854775808", Type::TYPE_FLOAT, 9223372036854775808.0),
+            std::make_tuple("49.9", Type::TYPE_FLOAT, 49.9),
+            std::make_tuple("-0.5", Type::TYPE_FLOAT, -0.5),
+            std::make_tuple("1.", Type::TYPE_FLOAT, 1.0),
+            std::make_tuple(".5", Type::TYPE_FLOAT, 0.5),
+            std::make_tuple("1e3", Type::TYPE_FLOAT, 1000.0),
+            std::make_tuple("2.5E-1", Type::TYPE_FLOAT, 0.25),
+            std::make_tuple("", Type::TYPE_STRING, 0.0),
+            std::make_tuple("-", Type::TYPE_STRING, 0.0),
+            std::make_tuple(".", Type::TYPE_STRING, 0.0),
+            std::make_tuple("+5", Type::TYPE_STRING, 0.0),
+            std::make_tuple(" 5", Type::TYPE_STRING, 0.0),
+            std::make_tuple("5 ", Type::TYPE_STRING, 0.0),
+            std::make_tuple("1e", Type::TYPE_STRING, 0.0),
+            std::make_tuple("1e999", Type::TYPE_STRING, 0.0),
+            std::make_tuple("0x10", Type::TYPE_STRING, 0.0),
+            std::make_tuple("inf", Type::TYPE_STRING, 0.0),
+            std::make_tuple("nan", Type::TYPE_STRING, 0.0),
+            std::make_tuple("1.2.3", Type::TYPE_STRING, 0.0),
+            std::make_tuple("on", Type::TYPE_STRING, 0.0),
+            std::make_tuple("HP R/T3000 HV INTL UPS", Type::TYPE_STRING, 0.0)
+        };
+
+        for (const auto &testCase : testCases) {
+            const auto value = fty::nut::classifyValue(std::get<0>(testCase));
+            assert(value.text == std::get<0>(testCase));
+            assert(value.type == std::get<1>(testCase));
+            assert(value.number == std::get<2>(testCase));
+            if (value.type == Type::TYPE_INTEGER) {
+                assert(static_cast<double>(value.integer) == value.number);
+            }
+        }
+
+        std::mt19937 generator(9);
+        const std::string input = generateDumpOutput(generator, 4096);
+        fty::nut::TypedKeyValues result;
+        fty::nut::parseDumpOutput(input, result);
+        assert(result == fty::nut::classifyValues(fty::nut::parseDumpOutput(input)));
+    }
+
+    // fty::nut::DumpSnapshot
+    {
+        std::mt19937 generator(7);
+
+        const std::vector<std::string> corpus = {
+            "",
+            "b: 2\na: 1\nb: 3\n",
+            generateDumpOutput(generator, 16),
+            generateDumpOutput(generator, 4096)
+        };
+
+        for (const auto &input : corpus) {
+            const fty::nut::KeyValues expected = fty::nut::parseDumpOutput(input);
+
+            fty::nut::DumpSnapshot snapshot;
+            fty::nut::parseDumpOutput(input, snapshot);
+
+            assert(snapshot.size() == expected.size());
+            assert(snapshot.toKeyValues() == expected);
+
+            for (const auto &it : expected) {
+                std::string value;
+                assert(snapshot.contains(it.first));
+                assert(snapshot.find(it.first, value));
+                assert(value == it.second);
+            }
+            assert(!snapshot.contains("no.such.key"));
+            assert(!snapshot.contains(""));
+        }
+    }
+
+    // fty::nut::DumpOutputParser
+    {
+        std::mt19937 generator(1337);
+
+        const std::vector<std::string> corpus = {
+            "",
+            "a: b",
+            "a: b\r\nc: d\n",
+            generateDumpOutput(generator, 16),
+            generateDumpOutput(generator, 4096)
+        };
+
+        for (const auto &input : corpus) {
+            for (size_t maxChunkSize : { 1, 2, 7, 64, 4096 }) {
+                fty::nut::KeyValues result;
+                fty::nut::DumpOutputParser parser([&result](const std::string &key, const std::string &value) {
+                    result.emplace(key, value);
+                });
+
+                std::uniform_int_distribution<size_t> chunkSize(0, maxChunkSize);
+                for (size_t i = 0; i < input.size(); ) {
+                    const size_t length = std::min(chunkSize(generator), input.size() - i);
+                    parser.feed(input.data() + i, length);
+                    i += length;
+                }
+                parser.finish();
+
+                assert(result == fty::nut::parseDumpOutput(input));
+            }
+        }
+    }
+
+    // fty::nut::DumpLoopParser
+    {
+        std::mt19937 generator(2323);
+
+        for (unsigned loopNb : { 0, 1, 2, 5 }) {
+            // Same variables on each loop, with different values.
+            std::vector<fty::nut::KeyValues> loops;
+            std::vector<size_t> loopEnds;
+            std::string input = "Network UPS Tools - Generic SNMP UPS driver\n";
+            for (unsigned loop = 0; loop < loopNb; loop++) {
+                loops.emplace_back();
+                for (int i = 0; i < 64; i++) {
+                    const std::string key = "outlet." + std::to_string(i) + ".current";
+                    const std::string value = std::to_string(generator() % 100);
+                    loops.back().emplace(key, value);
+                    input += key + ": " + value + "\n";
+                }
+                loopEnds.push_back(input.size());
+            }
+
+            for (size_t maxChunkSize : { 1, 7, 4096 }) {
+                std::vector<fty::nut::KeyValues> result;
+                size_t fed = 0;
+                fty::nut::DumpLoopParser parser([&](unsigned loop, const fty::nut::KeyValues &values) {
+                    assert(loop == result.size());
+                    // Loop is delivered as soon as the next one starts, if any.
+                    assert(loop + 1 == loopNb || fed < loopEnds[loop + 1]);
+                    result.push_back(values);
+                });
+
+                std::uniform_int_distribution<size_t> chunkSize(0, maxChunkSize);
+                while (fed < input.size()) {
+                    const size_t length = std::min(chunkSize(generator), input.size() - fed);
+                    parser.feed(input.data() + fed, length);
+                    fed += length;
+                }
+                parser.finish();
+
+                assert(result == loops && parser.loops() == loopNb);
+                // First loop holds the values of the merged dump.
+                assert(loopNb == 0 || result[0] == fty::nut::parseDumpOutput(input));
+            }
+        }
+    }
+
     // operator<< for fty::nut::DeviceConfiguration
     {
         static const std::string outputReference = R"xxx([nutdev6]
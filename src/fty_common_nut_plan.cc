@@ -0,0 +1,280 @@
+/*  =========================================================================
+    fty_common_nut_plan - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_plan -
+@discuss
+    Mapping plans of sets of NUT variables, and their cache.
+@end
+*/
+
+#include "fty_common_nut_classes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace fty {
+namespace nut {
+
+MappingPlan::MappingPlan(const CompiledMapping &mapping, const KeyValues &values, int daisychain)
+{
+    // Map the position of each variable instead of its value, to learn which variable yields which mapped key.
+    KeyValues indexes;
+    m_names.reserve(values.size());
+    for (const auto &value : values) {
+        indexes.emplace_hint(indexes.end(), value.first, std::to_string(m_names.size()));
+        m_names.push_back(value.first);
+    }
+
+    for (const auto &mapped : mapping.resolve(indexes, daisychain)) {
+        m_targets.push_back(Target { std::stoul(mapped.second), mapped.first });
+    }
+}
+
+bool MappingPlan::matches(const KeyValues &values) const
+{
+    return values.size() == m_names.size() &&
+        std::equal(m_names.begin(), m_names.end(), values.begin(), [](const std::string &name, const KeyValues::value_type &value) {
+            return name == value.first;
+        });
+}
+
+KeyValues MappingPlan::apply(const KeyValues &values) const
+{
+    static thread_local std::vector<const std::string *> texts;
+
+    texts.clear();
+    for (const auto &value : values) {
+        texts.push_back(&value.second);
+    }
+
+    // Targets are sorted by mapped key, so each one goes at the end.
+    KeyValues mappedValues;
+    for (const auto &target : m_targets) {
+        mappedValues.emplace_hint(mappedValues.end(), target.key, *texts[target.index]);
+    }
+    return mappedValues;
+}
+
+/**
+ * \brief Fingerprint of variable names and daisy-chain index (FNV-1a).
+ */
+static uint64_t fingerprint(const KeyValues &values, int daisychain)
+{
+    uint64_t hash = 14695981039346656037ull ^ static_cast<uint64_t>(daisychain);
+
+    for (const auto &value : values) {
+        // Names can't contain NUL, so it separates them unambiguously.
+        for (char c : value.first) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+MappingPlanCache::MappingPlanCache(const CompiledMapping &mapping, size_t capacity) :
+    m_mapping(mapping),
+    m_capacity(std::max<size_t>(capacity, 1))
+{
+}
+
+MappingPlanPtr MappingPlanCache::plan(const KeyValues &values, int daisychain)
+{
+    const uint64_t hash = fingerprint(values, daisychain);
+
+    MappingPlanPtr cached;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(hash);
+        if (it != m_index.end()) {
+            m_plans.splice(m_plans.begin(), m_plans, it->second);
+            cached = it->second->second;
+        }
+    }
+    if (cached && cached->matches(values)) {
+        return cached;
+    }
+
+    // Build the plan without holding the lock, replacing any colliding one.
+    auto plan = std::make_shared<const MappingPlan>(m_mapping, values, daisychain);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(hash);
+    if (it != m_index.end()) {
+        it->second->second = plan;
+        m_plans.splice(m_plans.begin(), m_plans, it->second);
+        return plan;
+    }
+
+    m_plans.emplace_front(hash, plan);
+    m_index.emplace(hash, m_plans.begin());
+    if (m_plans.size() > m_capacity) {
+        m_index.erase(m_plans.back().first);
+        m_plans.pop_back();
+    }
+    return plan;
+}
+
+size_t MappingPlanCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_plans.size();
+}
+
+void MappingPlanCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_index.clear();
+    m_plans.clear();
+}
+
+}
+}
+
+/**
+ * \brief Generate values with a random subset of names and random values.
+ */
+static fty::nut::KeyValues generateValues(std::mt19937 &generator)
+{
+    static const std::vector<std::string> keys = {
+        "device.model", "ups.model", "device.mfr", "device.1.mfr", "device.2.model", "device.count",
+        "input.current", "input.L1.current", "outlet.1.current", "outlet.2.current", "outlet.10.current",
+        "ups.status", "unmapped.key"
+    };
+
+    fty::nut::KeyValues values;
+    for (const auto &key : keys) {
+        if (generator() % 2) {
+            values.emplace(key, std::to_string(generator() % 100));
+        }
+    }
+    return values;
+}
+
+void fty_common_nut_plan_test(bool verbose)
+{
+    std::cout << " * fty_common_nut_plan: ";
+
+    const fty::nut::CompiledMapping mapping(fty::nut::MappingEntries {
+        { "device.model", "model" },
+        { "ups.model", "model" },
+        { "device.mfr", "manufacturer" },
+        { "input.current", "current.input" },
+        { "input.L1.current", "current.input.L1" },
+        { "outlet.#.current", "current.outlet.#" },
+        { "ups.status", "status.ups" }
+    });
+
+    // Plans map like performMapping(), for any values with the same names.
+    {
+        std::mt19937 generator(18);
+        for (int i = 0; i < 500; i++) {
+            const auto values = generateValues(generator);
+            const int daisychain = i % 3;
+            const fty::nut::MappingPlan plan(mapping, values, daisychain);
+            assert(plan.matches(values));
+            assert(plan.apply(values) == fty::nut::performMapping(mapping, values, daisychain));
+
+            auto otherValues = values;
+            for (auto &value : otherValues) {
+                value.second += "-other";
+            }
+            assert(plan.matches(otherValues));
+            assert(plan.apply(otherValues) == fty::nut::performMapping(mapping, otherValues, daisychain));
+
+            otherValues["unmapped.other"] = "1";
+            assert(!plan.matches(otherValues));
+        }
+    }
+
+    // Least recently used plans are evicted.
+    {
+        const fty::nut::KeyValues a = { { "device.model", "a" } };
+        const fty::nut::KeyValues b = { { "ups.model", "b" } };
+        const fty::nut::KeyValues c = { { "ups.status", "c" } };
+
+        fty::nut::MappingPlanCache cache(mapping, 2);
+        const auto planA = cache.plan(a, 0);
+        const auto planB = cache.plan(b, 0);
+        assert(cache.size() == 2);
+        assert(cache.plan(a, 0) == planA);
+        assert(cache.plan({ { "device.model", "other a" } }, 0) == planA);
+        cache.plan(c, 0);
+        assert(cache.size() == 2);
+        assert(cache.plan(a, 0) == planA);
+        assert(cache.plan(b, 0) != planB);
+
+        // Daisy-chain index is part of the key.
+        assert(cache.plan(a, 1) != planA);
+        assert(cache.performMapping(a, 1) == fty::nut::performMapping(mapping, a, 1));
+
+        cache.clear();
+        assert(cache.size() == 0);
+        assert(cache.plan(a, 0) != planA);
+    }
+
+    // Plans bypass statistics of the mapping.
+    {
+        const fty::nut::KeyValues values = { { "device.model", "a" }, { "ups.status", "OL" }, { "unmapped.key", "1" } };
+        mapping.resetStatistics();
+        const fty::nut::MappingPlan plan(mapping, values, 0);
+        plan.apply(values);
+        fty::nut::MappingPlanCache cache(mapping);
+        cache.performMapping(values, 1);
+        assert(mapping.statistics().calls == 0 && mapping.statistics().seen == 0);
+    }
+
+    // Concurrent use of a cache smaller than the set of plans.
+    {
+        std::mt19937 generator(19);
+        std::vector<fty::nut::KeyValues> values;
+        for (int i = 0; i < 16; i++) {
+            values.emplace_back(generateValues(generator));
+        }
+
+        fty::nut::MappingPlanCache cache(mapping, 4);
+        std::vector<std::thread> threads;
+        std::atomic<int> failures(0);
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < 500; i++) {
+                    const auto &input = values[(i * 7 + t) % values.size()];
+                    const int daisychain = i % 2;
+                    if (cache.performMapping(input, daisychain) != fty::nut::performMapping(mapping, input, daisychain)) {
+                        failures++;
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        assert(failures == 0);
+        assert(cache.size() <= cache.capacity());
+    }
+
+    std::cout << "OK" << std::endl;
+}
@@ -37,6 +37,9 @@
 void
 fty_common_nut_private_selftest (bool verbose, const char *subtest)
 {
+// Tests for stable private classes:
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_common_nut_utils_private_test"))
+        fty_common_nut_utils_private_test (verbose);
 }
 /*
 ################################################################################
@@ -0,0 +1,474 @@
+/*  =========================================================================
+    fty_common_nut_registry - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_registry -
+@discuss
+    Process-wide cache of mappings, reloaded when their file changes.
+@end
+*/
+
+#include "fty_common_nut_classes.h"
+
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <thread>
+
+namespace fty {
+namespace nut {
+
+/**
+ * \brief Identity of a file, changing whenever the file is modified or replaced.
+ */
+struct FileIdentity
+{
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modification;
+
+    bool operator==(const FileIdentity &other) const
+    {
+        return device == other.device && inode == other.inode && size == other.size &&
+            modification.tv_sec == other.modification.tv_sec && modification.tv_nsec == other.modification.tv_nsec;
+    }
+};
+
+static bool identifyFile(const std::string &file, FileIdentity &identity)
+{
+    struct stat st;
+    if (::stat(file.c_str(), &st) < 0) {
+        return false;
+    }
+
+    identity.device = st.st_dev;
+    identity.inode = st.st_ino;
+    identity.size = st.st_size;
+    identity.modification = st.st_mtim;
+    return true;
+}
+
+/**
+ * \brief Snapshots of all mapping types of a file.
+ */
+struct FileSnapshot
+{
+    FileIdentity identity;
+    std::map<std::string, MappingSnapshotPtr> types;
+};
+
+using FileSnapshotPtr = std::shared_ptr<const FileSnapshot>;
+
+static FileSnapshotPtr loadFileSnapshot(const std::string &file)
+{
+    auto snapshot = std::make_shared<FileSnapshot>();
+
+    // Identify the file before parsing it, so that changes during parsing trigger another reload.
+    if (!identifyFile(file, snapshot->identity)) {
+        throw std::runtime_error("Error opening file '" + file + "'");
+    }
+
+    for (const auto &type : loadMappingFile(file)) {
+        snapshot->types.emplace(type.first, std::make_shared<MappingSnapshot>(type.second));
+    }
+
+    return snapshot;
+}
+
+static int64_t steadyNow()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MappingSnapshot::MappingSnapshot(const MappingEntries &entries) :
+    m_compiled(entries)
+{
+}
+
+const KeyValues& MappingSnapshot::mapping() const
+{
+    std::call_once(m_mappingOnce, [this]() { m_mapping = m_compiled.toKeyValues(); });
+    return m_mapping;
+}
+
+struct MappingRegistry::FileState
+{
+    /// Held while (re)loading the file.
+    std::mutex reloadMutex;
+    /// Current snapshot, only accessed through std::atomic_load() and std::atomic_store().
+    FileSnapshotPtr snapshot;
+    /// Next time to check the file for changes, in milliseconds of the steady clock.
+    std::atomic<int64_t> nextCheck { 0 };
+    /// Set by get() once the check interval is elapsed, until the background thread checks the file.
+    std::atomic<bool> checkScheduled { false };
+    /// Identity of the file on last failed reload, not retried until the file changes again (guarded by reloadMutex).
+    bool failed = false;
+    FileIdentity failedIdentity;
+};
+
+MappingRegistry::MappingRegistry() :
+    m_checkInterval(1000),
+    m_checkScheduled(false),
+    m_stop(false)
+{
+}
+
+MappingRegistry::~MappingRegistry()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_checkMutex);
+        m_stop = true;
+        m_checkCondition.notify_one();
+    }
+    if (m_checkThread.joinable()) {
+        m_checkThread.join();
+    }
+}
+
+MappingRegistry& MappingRegistry::instance()
+{
+    static MappingRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<MappingRegistry::FileState> MappingRegistry::fileState(const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto &state = m_files[file];
+    if (!state) {
+        state = std::make_shared<FileState>();
+    }
+    return state;
+}
+
+MappingSnapshotPtr MappingRegistry::get(const std::string &file, const std::string &type)
+{
+    auto state = fileState(file);
+    const int64_t now = steadyNow();
+
+    FileSnapshotPtr snapshot = std::atomic_load(&state->snapshot);
+    if (!snapshot) {
+        // First load, nothing to serve in the meantime.
+        std::lock_guard<std::mutex> lock(state->reloadMutex);
+        snapshot = std::atomic_load(&state->snapshot);
+        if (!snapshot) {
+            snapshot = loadFileSnapshot(file);
+            std::atomic_store(&state->snapshot, snapshot);
+            state->nextCheck = now + m_checkInterval;
+        }
+    }
+    else if (now >= state->nextCheck && !state->checkScheduled.exchange(true)) {
+        // Let the background thread check for changes, keep serving the current snapshot meanwhile.
+        scheduleCheck();
+    }
+
+    auto it = snapshot->types.find(type);
+    if (it == snapshot->types.end()) {
+        throw std::runtime_error("No mapping type '" + type + "' in mapping file '" + file + "'.");
+    }
+    if (it->second->compiled().empty()) {
+        throw std::runtime_error("Mapping type '" + type + "' in mapping file '" + file + "' is empty.");
+    }
+    return it->second;
+}
+
+void MappingRegistry::checkFile(const std::string &file, FileState &state)
+{
+    std::lock_guard<std::mutex> lock(state.reloadMutex);
+    // Cleared before checking, so that changes made during the check are seen by the next one.
+    state.checkScheduled = false;
+    state.nextCheck = steadyNow() + m_checkInterval;
+
+    const FileSnapshotPtr snapshot = std::atomic_load(&state.snapshot);
+    if (!snapshot) {
+        return;
+    }
+
+    FileIdentity identity;
+    if (identifyFile(file, identity) && !(identity == snapshot->identity) &&
+        !(state.failed && identity == state.failedIdentity)) {
+        try {
+            std::atomic_store(&state.snapshot, loadFileSnapshot(file));
+            state.failed = false;
+            log_info("Reloaded mapping file '%s'.", file.c_str());
+        }
+        catch (std::exception &e) {
+            state.failed = true;
+            state.failedIdentity = identity;
+            log_error("Couldn't reload mapping file '%s', keeping previous mappings: %s", file.c_str(), e.what());
+        }
+    }
+}
+
+void MappingRegistry::scheduleCheck()
+{
+    std::lock_guard<std::mutex> lock(m_checkMutex);
+    if (!m_checkThread.joinable()) {
+        m_checkThread = std::thread(&MappingRegistry::runChecks, this);
+    }
+    m_checkScheduled = true;
+    m_checkCondition.notify_one();
+}
+
+void MappingRegistry::runChecks()
+{
+    std::unique_lock<std::mutex> lock(m_checkMutex);
+    for (;;) {
+        m_checkCondition.wait(lock, [this]() { return m_stop || m_checkScheduled; });
+        if (m_stop) {
+            break;
+        }
+        m_checkScheduled = false;
+        lock.unlock();
+
+        std::vector<std::pair<std::string, std::shared_ptr<FileState>>> files;
+        {
+            std::lock_guard<std::mutex> filesLock(m_mutex);
+            files.assign(m_files.begin(), m_files.end());
+        }
+        for (const auto &file : files) {
+            if (file.second->checkScheduled) {
+                checkFile(file.first, *file.second);
+            }
+        }
+
+        lock.lock();
+    }
+}
+
+void MappingRegistry::check()
+{
+    std::vector<std::pair<std::string, std::shared_ptr<FileState>>> files;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        files.assign(m_files.begin(), m_files.end());
+    }
+    for (const auto &file : files) {
+        checkFile(file.first, *file.second);
+    }
+}
+
+void MappingRegistry::setCheckInterval(std::chrono::milliseconds interval)
+{
+    m_checkInterval = interval.count();
+
+    // Don't wait for a longer previous interval to elapse.
+    const int64_t nextCheck = steadyNow() + interval.count();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &file : m_files) {
+        if (file.second->nextCheck > nextCheck) {
+            file.second->nextCheck = nextCheck;
+        }
+    }
+}
+
+void MappingRegistry::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_files.clear();
+}
+
+}
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+/**
+ * \brief Atomically replace a file with new contents.
+ */
+static void replaceFile(const std::string &path, const std::string &contents)
+{
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath);
+        out << contents;
+    }
+    const int ret = std::rename(tmpPath.c_str(), path.c_str());
+    assert(ret == 0);
+}
+
+void fty_common_nut_registry_test(bool verbose)
+{
+    std::cout << " * fty_common_nut_registry: ";
+
+    static const std::string path = "src/selftest-rw/mapping.conf";
+    static const std::string version1 = R"xxx({
+    "physicsMapping" : {
+        "battery.charge"    : "charge.battery",
+        "outlet.#.current"  : "current.outlet.#"
+    },
+    "inventoryMapping" : {
+        "device.model"      : "model"
+    },
+    "emptyMapping" : {
+    },
+    "badMapping": 123
+})xxx";
+    static const std::string version2 = R"xxx({
+    "physicsMapping" : {
+        "battery.runtime"   : "runtime.battery"
+    },
+    "inventoryMapping" : {
+        "device.mfr"        : "manufacturer"
+    }
+})xxx";
+
+    replaceFile(path, version1);
+
+    // Files are only checked by explicit calls to check() at first.
+    fty::nut::MappingRegistry registry;
+    registry.setCheckInterval(std::chrono::hours(1));
+
+    // Loading and sharing.
+    auto physics1 = registry.get(path, "physicsMapping");
+    assert(physics1->mapping() == fty::nut::loadMapping(path, "physicsMapping"));
+    assert(physics1->compiled().size() == 2);
+    assert(registry.get(path, "physicsMapping") == physics1);
+    assert(registry.get(path, "inventoryMapping")->mapping() == fty::nut::loadMapping(path, "inventoryMapping"));
+
+    for (const auto &type : { "emptyMapping", "badMapping", "noSuchMapping" }) {
+        bool caughtException = false;
+        try {
+            registry.get(path, type);
+        }
+        catch (std::runtime_error &) {
+            caughtException = true;
+        }
+        assert(caughtException);
+    }
+
+    {
+        bool caughtException = false;
+        try {
+            registry.get("src/selftest-rw/nosuchfile.conf", "physicsMapping");
+        }
+        catch (std::runtime_error &) {
+            caughtException = true;
+        }
+        assert(caughtException);
+    }
+
+    // Reload on change, older snapshots stay valid.
+    replaceFile(path, version2);
+    assert(registry.get(path, "physicsMapping") == physics1);
+    registry.check();
+    auto physics2 = registry.get(path, "physicsMapping");
+    assert(physics2 != physics1);
+    assert(physics2->mapping() == fty::nut::loadMapping(path, "physicsMapping"));
+    assert(physics1->mapping().count("battery.charge"));
+    assert(registry.get(path, "inventoryMapping")->mapping().count("device.mfr"));
+
+    // Failed reloads keep the previous snapshots.
+    replaceFile(path, "{ \"physicsMapping\" : ");
+    registry.check();
+    assert(registry.get(path, "physicsMapping") == physics2);
+
+    // Failed file is not parsed again until it changes: fix it in place, keeping its identity.
+    {
+        std::string broken = version2;
+        broken[0] = 'x';
+        replaceFile(path, broken);
+        registry.check();
+        assert(registry.get(path, "physicsMapping") == physics2);
+
+        struct stat st;
+        int ret = stat(path.c_str(), &st);
+        assert(ret == 0);
+        {
+            std::ofstream out(path, std::ios::in | std::ios::out);
+            out << version2;
+        }
+        const struct timespec times[2] = { st.st_atim, st.st_mtim };
+        ret = utimensat(AT_FDCWD, path.c_str(), times, 0);
+        assert(ret == 0);
+        registry.check();
+        assert(registry.get(path, "physicsMapping") == physics2);
+
+        // Changed again, reloaded.
+        const struct timespec later[2] = { st.st_atim, { st.st_mtim.tv_sec + 1, st.st_mtim.tv_nsec } };
+        ret = utimensat(AT_FDCWD, path.c_str(), later, 0);
+        assert(ret == 0);
+        registry.check();
+        auto fixed = registry.get(path, "physicsMapping");
+        assert(fixed != physics2 && fixed->mapping() == physics2->mapping());
+        physics2 = fixed;
+    }
+
+    // Changes are picked up in the background once the interval is elapsed, without blocking readers.
+    replaceFile(path, version1);
+    assert(registry.get(path, "physicsMapping") == physics2);
+    registry.setCheckInterval(std::chrono::milliseconds(0));
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (registry.get(path, "physicsMapping") == physics2 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        assert(registry.get(path, "physicsMapping")->mapping() == physics1->mapping());
+    }
+
+    // Concurrent readers while the file changes.
+    {
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; i++) {
+            readers.emplace_back([&registry, &stop]() {
+                while (!stop) {
+                    auto physics = registry.get(path, "physicsMapping");
+                    const auto &mapping = physics->mapping();
+                    assert(mapping.count("battery.charge") || mapping.count("battery.runtime"));
+                    std::string mappedKey;
+                    assert(physics->compiled().find("battery.charge", mappedKey) || physics->compiled().find("battery.runtime", mappedKey));
+                }
+            });
+        }
+
+        for (int i = 0; i < 50; i++) {
+            replaceFile(path, i % 2 ? version1 : version2);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        stop = true;
+        for (auto &reader : readers) {
+            reader.join();
+        }
+    }
+
+    // Duplicated types resolve to the first one, like loadMapping().
+    replaceFile(path, R"xxx({
+    "physicsMapping" : { "battery.charge" : "charge.battery" },
+    "physicsMapping" : { "battery.runtime" : "runtime.battery" }
+})xxx");
+    registry.clear();
+    assert(registry.get(path, "physicsMapping")->mapping() == fty::nut::loadMapping(path, "physicsMapping"));
+    assert(registry.get(path, "physicsMapping")->mapping().count("battery.charge"));
+
+    registry.clear();
+    std::remove(path.c_str());
+
+    assert(&fty::nut::MappingRegistry::instance() == &fty::nut::MappingRegistry::instance());
+
+    std::cout << "OK" << std::endl;
+}
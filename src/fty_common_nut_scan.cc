@@ -53,14 +53,12 @@ DeviceConfigurations scanDevice(
     return scanRangeDevices(protocol, ipAddress, ipAddress, timeout, documents);
 }
 
-DeviceConfigurations scanRangeDevices(
+static MlmSubprocess::Argv buildScanCommand(
     ScanProtocol protocol,
-    std::string ipAddressStart,
-    std::string ipAddressEnd,
-    unsigned timeout,
+    const std::string& ipAddressStart,
+    const std::string& ipAddressEnd,
     const std::vector<secw::DocumentPtr>& documents)
 {
-    std::string stdout, stderr;
     MlmSubprocess::Argv args {
         "nut-scanner",
         "--quiet",
@@ -95,9 +93,49 @@ DeviceConfigurations scanRangeDevices(
         }
     }
 
-    (void)priv::runCommand(args, stdout, stderr, timeout);
+    return args;
+}
+
+DeviceConfigurations scanRangeDevices(
+    ScanProtocol protocol,
+    std::string ipAddressStart,
+    std::string ipAddressEnd,
+    unsigned timeout,
+    const std::vector<secw::DocumentPtr>& documents)
+{
+    DeviceConfigurations devices;
+
+    (void)scanRangeDevices(protocol, ipAddressStart, ipAddressEnd, timeout, documents,
+        [&devices](DeviceConfiguration&& device) {
+            devices.emplace_back(std::move(device));
+        }
+    );
+
+    return devices;
+}
+
+int scanRangeDevices(
+    ScanProtocol protocol,
+    std::string ipAddressStart,
+    std::string ipAddressEnd,
+    unsigned timeout,
+    const std::vector<secw::DocumentPtr>& documents,
+    const ScannerOutputParser::Callback& callback)
+{
+    const MlmSubprocess::Argv args = buildScanCommand(protocol, ipAddressStart, ipAddressEnd, documents);
+
+    // Invoke command, parsing devices as they are found.
+    ScannerOutputParser parser(callback);
+    std::string stderr;
+    int ret = priv::runCommand(
+        args,
+        [&parser](const char *data, size_t length) { parser.feed(data, length); },
+        stderr,
+        timeout
+    );
+    parser.finish();
 
-    return parseScannerOutput(stdout);
+    return ret;
 }
 
 }
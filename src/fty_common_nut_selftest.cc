@@ -40,8 +40,19 @@ typedef struct {
 static test_item_t
 all_tests [] = {
 // Tests for stable public classes:
+    { "fty_common_nut_intern", fty_common_nut_intern_test, true, true, NULL },
     { "fty_common_nut_convert", fty_common_nut_convert_test, true, true, NULL },
+    { "fty_common_nut_upsd", fty_common_nut_upsd_test, true, true, NULL },
     { "fty_common_nut_parse", fty_common_nut_parse_test, true, true, NULL },
+    { "fty_common_nut_registry", fty_common_nut_registry_test, true, true, NULL },
+    { "fty_common_nut_plan", fty_common_nut_plan_test, true, true, NULL },
+    { "fty_common_nut_delta", fty_common_nut_delta_test, true, true, NULL },
+#ifdef FTY_COMMON_NUT_BUILD_DRAFT_API
+// Tests for stable/draft private classes:
+// Now built only with --enable-drafts, so even stable builds are hidden behind the flag
+    { "fty_common_nut_utils_private_test", NULL, true, false, "fty_common_nut_utils_private_test" },
+    { "private_classes", NULL, false, false, "$ALL" }, // compiles stable tests only
+#endif // FTY_COMMON_NUT_BUILD_DRAFT_API
     {NULL, NULL, 0, 0, NULL}          //  Sentinel
 };
 
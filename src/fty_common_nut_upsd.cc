@@ -0,0 +1,710 @@
+/*  =========================================================================
+    fty_common_nut_upsd - class description
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_nut_upsd -
+@discuss
+    Client of the NUT network protocol (upsd).
+@end
+*/
+
+#include "fty_common_nut_classes.h"
+
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fty {
+namespace nut {
+
+/**
+ * \brief Connection closed by upsd.
+ */
+class UpsdConnectionClosed : public std::runtime_error
+{
+public:
+    UpsdConnectionClosed() : std::runtime_error("Connection closed by upsd") {}
+};
+
+/**
+ * \brief Quote a request argument if needed.
+ */
+static std::string quoteWord(const std::string &word)
+{
+    if (!word.empty() && word.find_first_of(" \t\"\\") == std::string::npos) {
+        return word;
+    }
+
+    std::string quoted = "\"";
+    for (char c : word) {
+        if (c == '"' || c == '\\') {
+            quoted.push_back('\\');
+        }
+        quoted.push_back(c);
+    }
+    return quoted + "\"";
+}
+
+/**
+ * \brief Split a reply line into words, unquoting and unescaping quoted words.
+ */
+static std::vector<std::string> splitWords(const std::string &line)
+{
+    std::vector<std::string> words;
+
+    for (size_t i = 0; i < line.size(); ) {
+        if (line[i] == ' ' || line[i] == '\t') {
+            i++;
+            continue;
+        }
+
+        std::string word;
+        if (line[i] == '"') {
+            for (i++; i < line.size() && line[i] != '"'; i++) {
+                if (line[i] == '\\' && i + 1 < line.size()) {
+                    i++;
+                }
+                word.push_back(line[i]);
+            }
+            if (i == line.size()) {
+                throw std::runtime_error("Unterminated quoted string in upsd reply '" + line + "'");
+            }
+            i++;
+        }
+        else {
+            for (; i < line.size() && line[i] != ' ' && line[i] != '\t'; i++) {
+                word.push_back(line[i]);
+            }
+        }
+        words.push_back(std::move(word));
+    }
+
+    return words;
+}
+
+/**
+ * \brief Milliseconds left before a deadline, for poll() (0 if passed).
+ */
+static int remainingMs(std::chrono::steady_clock::time_point deadline)
+{
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    return remaining > 0 ? static_cast<int>(std::min<decltype(remaining)>(remaining, std::numeric_limits<int>::max())) : 0;
+}
+
+UpsdClient::UpsdClient(const std::string &host, uint16_t port, std::chrono::milliseconds timeout) :
+    m_host(host),
+    m_port(port),
+    m_timeout(timeout),
+    m_fd(-1),
+    m_bufferStart(0),
+    m_requestsSent(0)
+{
+}
+
+UpsdClient::~UpsdClient()
+{
+    close();
+}
+
+void UpsdClient::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_buffer.clear();
+    m_bufferStart = 0;
+    m_requestsSent = 0;
+}
+
+void UpsdClient::connect()
+{
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *addresses;
+    const int ret = getaddrinfo(m_host.c_str(), std::to_string(m_port).c_str(), &hints, &addresses);
+    if (ret != 0) {
+        throw std::runtime_error("Can't resolve upsd host '" + m_host + "': " + gai_strerror(ret));
+    }
+
+    std::string error = "no address";
+    for (struct addrinfo *address = addresses; address && m_fd < 0; address = address->ai_next) {
+        int fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, address->ai_protocol);
+        if (fd < 0) {
+            error = strerror(errno);
+            continue;
+        }
+
+        // Connect without blocking, to honor the timeout.
+        if (::connect(fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            error = strerror(errno);
+            ::close(fd);
+            continue;
+        }
+
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        int err = 0;
+        socklen_t length = sizeof(err);
+        const int ready = poll(&pfd, 1, remainingMs(m_deadline));
+        if (ready <= 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &length) < 0 || err != 0) {
+            error = ready == 0 ? "timeout" : strerror(ready < 0 ? errno : err);
+            ::close(fd);
+            continue;
+        }
+
+        m_fd = fd;
+    }
+    freeaddrinfo(addresses);
+
+    if (m_fd < 0) {
+        throw std::runtime_error("Can't connect to upsd at '" + m_host + ":" + std::to_string(m_port) + "': " + error);
+    }
+}
+
+/**
+ * \brief Send as much of the pending requests as the socket takes, without blocking.
+ * \return True if requests are still pending.
+ */
+bool UpsdClient::sendPending()
+{
+    while (m_requestsSent < m_requests.size()) {
+        const ssize_t ret = ::send(m_fd, m_requests.data() + m_requestsSent, m_requests.size() - m_requestsSent, MSG_NOSIGNAL);
+        if (ret >= 0) {
+            m_requestsSent += ret;
+            continue;
+        }
+        if (errno == EPIPE || errno == ECONNRESET) {
+            throw UpsdConnectionClosed();
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        if (errno != EINTR) {
+            throw std::runtime_error(std::string("Error sending to upsd: ") + strerror(errno));
+        }
+    }
+    return false;
+}
+
+std::string UpsdClient::readLine()
+{
+    for (;;) {
+        const size_t end = m_buffer.find('\n', m_bufferStart);
+        if (end != std::string::npos) {
+            std::string line(m_buffer, m_bufferStart, end - m_bufferStart);
+            m_bufferStart = end + 1;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            return line;
+        }
+
+        // Drop consumed data before reading more.
+        m_buffer.erase(0, m_bufferStart);
+        m_bufferStart = 0;
+
+        char data[16384];
+        const ssize_t ret = recv(m_fd, data, sizeof(data), 0);
+        if (ret > 0) {
+            m_buffer.append(data, ret);
+            continue;
+        }
+        if (ret == 0 || errno == ECONNRESET) {
+            throw UpsdConnectionClosed();
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            throw std::runtime_error(std::string("Error receiving from upsd: ") + strerror(errno));
+        }
+
+        // Keep sending pipelined requests while waiting for replies: upsd stops
+        // reading requests once its replies fill the socket buffers.
+        const bool pending = sendPending();
+        struct pollfd pfd = { m_fd, static_cast<short>(pending ? POLLIN | POLLOUT : POLLIN), 0 };
+        if (poll(&pfd, 1, remainingMs(m_deadline)) == 0) {
+            throw std::runtime_error("Timeout receiving from upsd");
+        }
+    }
+}
+
+UpsdClient::Words UpsdClient::readWords(const std::string &request)
+{
+    Words words = splitWords(readLine());
+    if (words.empty()) {
+        throw std::runtime_error("Empty upsd reply to '" + request + "'");
+    }
+    if (words[0] == "ERR") {
+        throw std::runtime_error("upsd error '" + (words.size() > 1 ? words[1] : std::string()) + "' for '" + request + "'");
+    }
+    return words;
+}
+
+void UpsdClient::readList(const std::string &request, const std::function<void(const Words &words)> &item)
+{
+    // Reply is "BEGIN <request>", items, then "END <request>".
+    Words words = readWords(request);
+    if (words[0] != "BEGIN") {
+        throw std::runtime_error("Unexpected upsd reply to '" + request + "'");
+    }
+
+    while ((words = readWords(request))[0] != "END") {
+        item(words);
+    }
+}
+
+void UpsdClient::transact(const std::vector<std::string> &requests, const std::function<void(size_t request)> &handler)
+{
+    m_deadline = std::chrono::steady_clock::now() + m_timeout;
+
+    std::string data;
+    for (const auto &request : requests) {
+        data.append(request).append("\n");
+    }
+
+    for (int attempt = 0; ; attempt++) {
+        const bool reused = connected();
+        size_t replies = 0;
+
+        try {
+            if (!reused) {
+                connect();
+            }
+            // Requests are sent as replies are read (see readLine()).
+            m_requests = data;
+            m_requestsSent = 0;
+            sendPending();
+            for (size_t i = 0; i < requests.size(); i++, replies++) {
+                handler(i);
+            }
+            return;
+        }
+        catch (UpsdConnectionClosed &e) {
+            close();
+            // upsd may have closed an idle connection, retry once on a new one.
+            if (reused && replies == 0 && attempt == 0) {
+                continue;
+            }
+            throw std::runtime_error(e.what());
+        }
+        catch (...) {
+            // Replies left unread would desynchronize the connection.
+            close();
+            throw;
+        }
+    }
+}
+
+KeyValues UpsdClient::listUps()
+{
+    KeyValues result;
+    const std::string request = "LIST UPS";
+
+    transact({ request }, [&](size_t) {
+        readList(request, [&result](const Words &words) {
+            // UPS <name> "<description>"
+            if (words.size() >= 3 && words[0] == "UPS") {
+                result[words[1]] = words[2];
+            }
+        });
+    });
+
+    return result;
+}
+
+KeyValues UpsdClient::listVars(const std::string &ups)
+{
+    return std::move(listVars(std::vector<std::string> { ups })[0]);
+}
+
+std::vector<KeyValues> UpsdClient::listVars(const std::vector<std::string> &upses)
+{
+    std::vector<KeyValues> result(upses.size());
+    std::vector<std::string> requests;
+    for (const auto &ups : upses) {
+        requests.push_back("LIST VAR " + quoteWord(ups));
+    }
+
+    transact(requests, [&](size_t i) {
+        result[i].clear();
+        readList(requests[i], [&result, i](const Words &words) {
+            // VAR <ups> <name> "<value>"
+            if (words.size() >= 4 && words[0] == "VAR") {
+                result[i][words[2]] = words[3];
+            }
+        });
+    });
+
+    return result;
+}
+
+std::string UpsdClient::getVar(const std::string &ups, const std::string &var)
+{
+    std::string result;
+    const std::string request = "GET VAR " + quoteWord(ups) + " " + quoteWord(var);
+
+    transact({ request }, [&](size_t) {
+        const Words words = readWords(request);
+        if (words.size() < 4 || words[0] != "VAR") {
+            throw std::runtime_error("Unexpected upsd reply to '" + request + "'");
+        }
+        result = words[3];
+    });
+
+    return result;
+}
+
+KeyValues UpsdClient::getVars(const std::string &ups, const std::vector<std::string> &vars)
+{
+    KeyValues result;
+    std::vector<std::string> requests;
+    for (const auto &var : vars) {
+        requests.push_back("GET VAR " + quoteWord(ups) + " " + quoteWord(var));
+    }
+
+    transact(requests, [&](size_t i) {
+        const Words words = splitWords(readLine());
+        if (words.size() >= 2 && words[0] == "ERR" && words[1] == "VAR-NOT-SUPPORTED") {
+            return;
+        }
+        if (words.size() >= 2 && words[0] == "ERR") {
+            throw std::runtime_error("upsd error '" + words[1] + "' for '" + requests[i] + "'");
+        }
+        if (words.size() < 4 || words[0] != "VAR") {
+            throw std::runtime_error("Unexpected upsd reply to '" + requests[i] + "'");
+        }
+        result[words[2]] = words[3];
+    });
+
+    return result;
+}
+
+}
+}
+
+/**
+ * \brief Stand-in for upsd serving fixed devices on an ephemeral local port, one connection at a time.
+ */
+class FakeUpsd
+{
+public:
+    FakeUpsd(const std::map<std::string, fty::nut::KeyValues> &devices) :
+        m_devices(devices),
+        m_stop(false),
+        m_silent(false),
+        m_drop(false),
+        m_accepts(0)
+    {
+        m_listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        // Small socket buffers (inherited by connections), so that large batches overflow them.
+        const int bufferSize = 65536;
+        if (m_listenFd < 0 ||
+            setsockopt(m_listenFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)) < 0 ||
+            setsockopt(m_listenFd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize)) < 0 ||
+            bind(m_listenFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0 ||
+            listen(m_listenFd, 4) < 0 ||
+            getsockname(m_listenFd, reinterpret_cast<struct sockaddr *>(&address), &length) < 0) {
+            throw std::runtime_error(std::string("Can't listen: ") + strerror(errno));
+        }
+        m_port = ntohs(address.sin_port);
+        m_thread = std::thread(&FakeUpsd::run, this);
+    }
+
+    ~FakeUpsd()
+    {
+        m_stop = true;
+        m_thread.join();
+        ::close(m_listenFd);
+    }
+
+    uint16_t port() const { return m_port; }
+    int accepts() const { return m_accepts; }
+    void silent(bool silent) { m_silent = silent; }
+
+    /// Close current connection, like upsd dropping an idle client.
+    void drop()
+    {
+        m_drop = true;
+        while (m_drop) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+private:
+    static std::string quote(const std::string &value)
+    {
+        std::string quoted = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                quoted.push_back('\\');
+            }
+            quoted.push_back(c);
+        }
+        return quoted + "\"";
+    }
+
+    std::string reply(const std::string &line)
+    {
+        const auto words = fty::nut::splitWords(line);
+        const bool list = words.size() == 3 && words[0] == "LIST" && words[1] == "VAR";
+        const bool get = words.size() == 4 && words[0] == "GET" && words[1] == "VAR";
+
+        if (words.size() == 2 && words[0] == "LIST" && words[1] == "UPS") {
+            std::string result = "BEGIN LIST UPS\n";
+            for (const auto &device : m_devices) {
+                result += "UPS " + device.first + " " + quote("Device " + device.first) + "\n";
+            }
+            return result + "END LIST UPS\n";
+        }
+        if (!list && !get) {
+            return "ERR UNKNOWN-COMMAND\n";
+        }
+
+        const auto device = m_devices.find(words[2]);
+        if (device == m_devices.end()) {
+            return "ERR UNKNOWN-UPS\n";
+        }
+        if (get) {
+            const auto value = device->second.find(words[3]);
+            if (value == device->second.end()) {
+                return "ERR VAR-NOT-SUPPORTED\n";
+            }
+            return "VAR " + device->first + " " + value->first + " " + quote(value->second) + "\n";
+        }
+
+        std::string result = "BEGIN LIST VAR " + device->first + "\n";
+        for (const auto &value : device->second) {
+            result += "VAR " + device->first + " " + value.first + " " + quote(value.second) + "\n";
+        }
+        return result + "END LIST VAR " + device->first + "\n";
+    }
+
+    void run()
+    {
+        int fd = -1;
+        std::string buffer;
+
+        while (!m_stop) {
+            if (m_drop) {
+                if (fd >= 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+                m_drop = false;
+            }
+
+            struct pollfd pfds[2] = { { m_listenFd, POLLIN, 0 }, { fd, POLLIN, 0 } };
+            if (poll(pfds, fd >= 0 ? 2 : 1, 10) <= 0) {
+                continue;
+            }
+
+            if (pfds[0].revents) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+                fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                buffer.clear();
+                m_accepts++;
+                continue;
+            }
+
+            char data[4096];
+            const ssize_t ret = recv(fd, data, sizeof(data), 0);
+            if (ret <= 0) {
+                ::close(fd);
+                fd = -1;
+                continue;
+            }
+            buffer.append(data, ret);
+
+            // Reply to each complete request, pipelined requests included.
+            size_t eol;
+            std::string replies;
+            while ((eol = buffer.find('\n')) != std::string::npos) {
+                replies += reply(buffer.substr(0, eol));
+                buffer.erase(0, eol + 1);
+            }
+            if (!m_silent && ::send(fd, replies.data(), replies.size(), MSG_NOSIGNAL) < 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    std::map<std::string, fty::nut::KeyValues> m_devices;
+    int m_listenFd;
+    uint16_t m_port;
+    std::thread m_thread;
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_silent;
+    std::atomic<bool> m_drop;
+    std::atomic<int> m_accepts;
+};
+
+template <typename Function>
+static bool throwsRuntimeError(Function function)
+{
+    try {
+        function();
+    }
+    catch (std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+void fty_common_nut_upsd_test(bool verbose)
+{
+    std::cout << " * fty_common_nut_upsd: ";
+
+    // Values as output by a driver dump, and served by upsd for same device.
+    const std::string dump =
+        "device.mfr: EATON\n"
+        "device.model: ePDU MANAGED 38U-A IN: L6-30P 24A 1P OUT: 2XC13:20XC13\n"
+        "input.L1.current: 0.00\n"
+        "outlet.1.current: 0.00\n"
+        "outlet.1.desc: Outlet A1\n"
+        "outlet.1.status: on\n"
+        "ups.status: OL\n";
+    const auto dumpValues = fty::nut::parseDumpOutput(dump);
+    const fty::nut::KeyValues quotedValues = {
+        { "device.description", "a \"quoted\" value" },
+        { "device.location", "back\\slash \\\"" },
+        { "device.contact", "" }
+    };
+
+    // Device with more variables than socket buffers can hold, in requests as in replies.
+    fty::nut::KeyValues bigValues;
+    for (int i = 0; i < 50000; i++) {
+        bigValues["outlet." + std::to_string(i) + ".some.rather.long.variable.name.to.fill.socket.buffers.quickly"] =
+            "value " + std::to_string(i) + std::string(100, 'x');
+    }
+
+    FakeUpsd server({ { "epdu", dumpValues }, { "ups", quotedValues }, { "big", bigValues } });
+
+    // Same values as from a dump, on a single connection.
+    {
+        fty::nut::UpsdClient client("127.0.0.1", server.port());
+        assert(!client.connected());
+
+        assert((client.listUps() == fty::nut::KeyValues { { "big", "Device big" }, { "epdu", "Device epdu" }, { "ups", "Device ups" } }));
+        assert(client.listVars("epdu") == dumpValues);
+        assert(client.listVars("ups") == quotedValues);
+        assert(client.getVar("epdu", "outlet.1.desc") == "Outlet A1");
+        assert(client.getVar("ups", "device.location") == "back\\slash \\\"");
+
+        // Pipelined requests.
+        const auto all = client.listVars({ "ups", "epdu", "ups" });
+        assert(all.size() == 3 && all[0] == quotedValues && all[1] == dumpValues && all[2] == quotedValues);
+        assert(client.listVars(std::vector<std::string>()).empty());
+        assert((client.getVars("epdu", { "ups.status", "unknown.var", "device.mfr" }) == fty::nut::KeyValues { { "device.mfr", "EATON" }, { "ups.status", "OL" } }));
+
+        assert(client.connected());
+        assert(server.accepts() == 1);
+    }
+
+    // Batches larger than socket buffers: requests keep being sent while replies are read.
+    {
+        fty::nut::UpsdClient client("127.0.0.1", server.port(), std::chrono::seconds(30));
+
+        std::vector<std::string> vars;
+        for (const auto &value : bigValues) {
+            vars.push_back(value.first);
+        }
+        assert(client.getVars("big", vars) == bigValues);
+
+        const auto all = client.listVars({ "big", "epdu", "big", "big" });
+        assert(all.size() == 4 && all[0] == bigValues && all[1] == dumpValues && all[3] == bigValues);
+    }
+
+    // Errors reported by upsd.
+    {
+        fty::nut::UpsdClient client("127.0.0.1", server.port());
+        const int accepts = server.accepts();
+
+        assert(throwsRuntimeError([&]() { client.listVars("unknown"); }));
+        assert(throwsRuntimeError([&]() { client.getVar("epdu", "unknown.var"); }));
+        assert(throwsRuntimeError([&]() { client.getVars("unknown", { "ups.status" }); }));
+        assert(throwsRuntimeError([&]() { client.listVars({ "epdu", "unknown", "ups" }); }));
+
+        // Client is still usable afterwards.
+        assert(client.listVars("epdu") == dumpValues);
+        assert(server.accepts() > accepts);
+    }
+
+    // Connection closed by upsd between requests.
+    {
+        fty::nut::UpsdClient client("127.0.0.1", server.port());
+        const int accepts = server.accepts();
+
+        assert(client.getVar("epdu", "ups.status") == "OL");
+        server.drop();
+        assert(client.getVar("epdu", "ups.status") == "OL");
+        assert(server.accepts() == accepts + 2);
+    }
+
+    // Server not answering.
+    {
+        fty::nut::UpsdClient client("127.0.0.1", server.port(), std::chrono::milliseconds(100));
+
+        server.silent(true);
+        const auto start = std::chrono::steady_clock::now();
+        assert(throwsRuntimeError([&]() { client.listUps(); }));
+        assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+        assert(!client.connected());
+        server.silent(false);
+        assert(client.listVars("epdu") == dumpValues);
+    }
+
+    // No server.
+    uint16_t port;
+    {
+        FakeUpsd stopped({});
+        port = stopped.port();
+    }
+    {
+        fty::nut::UpsdClient client("127.0.0.1", port, std::chrono::milliseconds(1000));
+        assert(throwsRuntimeError([&]() { client.listUps(); }));
+        assert(!client.connected());
+    }
+
+    std::cout << "OK" << std::endl;
+}
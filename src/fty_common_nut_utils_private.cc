@@ -28,24 +28,743 @@
 
 #include "fty_common_nut_classes.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <signal.h>
+#include <sstream>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unordered_map>
+
+extern char **environ;
+
 namespace fty {
 namespace nut {
 namespace priv {
 
-int runCommand(
-    const MlmSubprocess::Argv& args,
-    std::string& stdout,
-    std::string& stderr,
-    int timeout)
+static std::string formatCommand(const MlmSubprocess::Argv& args)
 {
     std::stringstream fullCommand;
     for (const auto& i : args) {
         fullCommand << i << " ";
     }
-    std::string fullCommandStr = fullCommand.str();
+    return fullCommand.str();
+}
+
+void writeFileAtomically(const std::string& path, const char *data, size_t length)
+{
+    std::stringstream err;
+
+    std::string tmpPath = path + ".XXXXXX";
+    int fd = ::mkostemp(&tmpPath[0], O_CLOEXEC);
+    if (fd < 0) {
+        err << "Error creating temporary file for '" << path << "': " << strerror(errno) << ".";
+        throw std::runtime_error(err.str());
+    }
+
+    // Keep the permissions and ownership of the file being replaced.
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0) {
+        ::fchmod(fd, st.st_mode & 07777);
+        if (::fchown(fd, st.st_uid, st.st_gid) < 0) {
+            // Not fatal, we may not be allowed to change ownership.
+        }
+    }
+    else {
+        // New file gets the permissions of a regular file creation instead of the 0600 of mkstemp()
+        // (umask can only be read by setting it).
+        const mode_t mask = ::umask(0);
+        ::umask(mask);
+        ::fchmod(fd, 0666 & ~mask);
+    }
+
+    size_t remaining = length;
+    while (remaining > 0) {
+        ssize_t written = ::write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err << "Error writing file '" << tmpPath << "': " << strerror(errno) << ".";
+            ::close(fd);
+            ::unlink(tmpPath.c_str());
+            throw std::runtime_error(err.str());
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    if (::fsync(fd) < 0 || ::close(fd) < 0) {
+        err << "Error syncing file '" << tmpPath << "': " << strerror(errno) << ".";
+        ::unlink(tmpPath.c_str());
+        throw std::runtime_error(err.str());
+    }
+
+    if (::rename(tmpPath.c_str(), path.c_str()) < 0) {
+        err << "Error renaming file '" << tmpPath << "' to '" << path << "': " << strerror(errno) << ".";
+        ::unlink(tmpPath.c_str());
+        throw std::runtime_error(err.str());
+    }
+
+    // Make the rename itself durable.
+    const size_t slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+/**
+ * \brief Output of a command, stored in chunks of growing size.
+ *
+ * Appending never moves data already stored, and the whole output is copied
+ * once into its final string.
+ */
+class OutputBuffer
+{
+public:
+    void append(const char *data, size_t length)
+    {
+        while (length) {
+            if (m_chunks.empty() || m_used == m_chunks.back().size) {
+                const size_t size = m_chunks.empty() ? 4096 : std::min<size_t>(m_chunks.back().size * 2, 1 << 20);
+                m_chunks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+                m_used = 0;
+            }
+            const size_t count = std::min(length, m_chunks.back().size - m_used);
+            std::memcpy(m_chunks.back().data.get() + m_used, data, count);
+            m_used += count;
+            m_size += count;
+            data += count;
+            length -= count;
+        }
+    }
+
+    void appendTo(std::string& out) const
+    {
+        out.reserve(out.size() + m_size);
+        for (size_t i = 0; i < m_chunks.size(); i++) {
+            out.append(m_chunks[i].data.get(), i + 1 < m_chunks.size() ? m_chunks[i].size : m_used);
+        }
+    }
+
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Chunk> m_chunks;
+    size_t m_used = 0;
+    size_t m_size = 0;
+};
+
+/**
+ * \brief Hashed timer wheel, firing timers with a resolution of one tick.
+ *
+ * Scheduling is O(1). Timers farther than one revolution stay in their slot
+ * for later rounds. Timers can't be removed, so owners must check on expiry
+ * whether the timer is still relevant.
+ */
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerWheel(std::chrono::milliseconds tick, size_t slots) :
+        m_tick(tick),
+        m_slots(slots),
+        m_start(Clock::now()),
+        m_current(0),
+        m_count(0)
+    {
+    }
+
+    void schedule(uint64_t id, Clock::time_point when)
+    {
+        // Round up, so that a timer never fires early.
+        const uint64_t tick = std::max(tickOf(when + m_tick - std::chrono::nanoseconds(1)), m_current + 1);
+        m_slots[tick % m_slots.size()].push_back({ id, tick });
+        m_count++;
+    }
+
+    /**
+     * \brief Collect identifiers of timers expired at given time.
+     */
+    void expire(Clock::time_point now, std::vector<uint64_t>& expired)
+    {
+        const uint64_t target = tickOf(now);
+        // Past one revolution, every slot has been visited.
+        const uint64_t first = target - m_current > m_slots.size() ? target - m_slots.size() + 1 : m_current + 1;
+
+        for (uint64_t tick = first; tick <= target && m_count; tick++) {
+            auto& slot = m_slots[tick % m_slots.size()];
+            auto last = std::partition(slot.begin(), slot.end(), [target](const Timer& timer) { return timer.tick > target; });
+            for (auto it = last; it != slot.end(); ++it) {
+                expired.push_back(it->id);
+            }
+            m_count -= slot.end() - last;
+            slot.erase(last, slot.end());
+        }
+        m_current = std::max(m_current, target);
+    }
+
+    /**
+     * \brief Time to wait until the next slot holding timers, in milliseconds (-1 if none).
+     */
+    int timeout(Clock::time_point now) const
+    {
+        if (!m_count) {
+            return -1;
+        }
+        uint64_t tick = m_current + 1;
+        while (m_slots[tick % m_slots.size()].empty()) {
+            tick++;
+        }
+        // Round up, so that the tick is reached on wake-up.
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(m_start + m_tick * static_cast<Clock::rep>(tick) - now).count() + 1;
+        return static_cast<int>(std::max<decltype(remaining)>(remaining, 0));
+    }
+
+private:
+    struct Timer
+    {
+        uint64_t id;
+        uint64_t tick;
+    };
+
+    uint64_t tickOf(Clock::time_point time) const
+    {
+        return time <= m_start ? 0 : (time - m_start) / m_tick;
+    }
+
+    const Clock::duration m_tick;
+    std::vector<std::vector<Timer>> m_slots;
+    const Clock::time_point m_start;
+    uint64_t m_current;
+    size_t m_count;
+};
+
+/**
+ * \brief Command supervised by the reactor.
+ */
+class Command
+{
+public:
+    MlmSubprocess::Argv args;
+    OutputCallback stdoutCallback;
+    OutputCallback stderrCallback;
+    CommandCompletion completion;
+    std::chrono::steady_clock::time_point deadline;
+    std::atomic<bool> cancelled { false };
+
+    // Owned by the reactor thread.
+    uint64_t id = 0;
+    pid_t pid = -1;
+    /// Standard output and error pipes, then pidfd (-1 when closed or unavailable).
+    int fds[3] = { -1, -1, -1 };
+    /// Standard output pipe is left out of epoll.
+    bool outputPaused = false;
+    bool reaped = false;
+    int ret = -1;
+    CommandStatus status = CommandStatus::Exited;
+    bool terminating = false;
+    bool killed = false;
+    std::chrono::steady_clock::time_point killTime;
+};
+
+/**
+ * \brief Single thread of the library supervising all commands in flight.
+ *
+ * Commands are spawned with posix_spawn() and watched with epoll: their
+ * output pipes, and their pidfd (when supported) to reap them as soon as
+ * they exit. Processes are reaped by PID only, so that a SIGCHLD handler of
+ * the application or other children are not interfered with. Deadlines are
+ * kept in a timer wheel.
+ */
+class EventLoop
+{
+public:
+    static EventLoop& instance()
+    {
+        static EventLoop loop;
+        return loop;
+    }
+
+    void add(const CommandPtr& command)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_added.push_back(command);
+        }
+        wake();
+    }
+
+    void cancel(const CommandPtr& command)
+    {
+        command->cancelled = true;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cancelled.push_back(command);
+        }
+        wake();
+    }
+
+    void pause(const CommandPtr& command, bool paused)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_paused.emplace_back(command, paused);
+        }
+        wake();
+    }
+
+private:
+    /// Tick of timers, also the polling period of exited processes without pidfd.
+    static constexpr std::chrono::milliseconds tick { 10 };
+
+    EventLoop() :
+        m_timers(tick, 1024),
+        m_stop(false),
+        m_nextId(1)
+    {
+        m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+        m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_epollFd < 0 || m_wakeFd < 0) {
+            throw std::runtime_error(std::string("Can't create event loop: ") + strerror(errno));
+        }
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = 0;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event);
+
+        m_thread = std::thread(&EventLoop::run, this);
+    }
+
+    ~EventLoop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        wake();
+        m_thread.join();
+        ::close(m_wakeFd);
+        ::close(m_epollFd);
+    }
+
+    void wake()
+    {
+        const uint64_t one = 1;
+        ssize_t r = ::write(m_wakeFd, &one, sizeof(one));
+        (void)r;
+    }
+
+    void run();
+    void start(const CommandPtr& command);
+    void service(Command& command, std::chrono::steady_clock::time_point now);
+    void closeFd(Command& command, int index);
+    void pauseOutput(Command& command, bool paused);
+    void reap(Command& command);
+    void finish(Command& command);
+
+    /**
+     * \brief Encode a file descriptor of a command for epoll (0 is the wake-up eventfd).
+     */
+    static uint64_t eventKey(uint64_t id, int index) { return id << 2 | static_cast<uint64_t>(index + 1); }
+
+    int m_epollFd;
+    int m_wakeFd;
+    std::unordered_map<uint64_t, CommandPtr> m_commands;
+    TimerWheel m_timers;
+
+    std::mutex m_mutex;
+    std::vector<CommandPtr> m_added;
+    std::vector<CommandPtr> m_cancelled;
+    std::vector<std::pair<CommandPtr, bool>> m_paused;
+    bool m_stop;
+
+    uint64_t m_nextId;
+    std::thread m_thread;
+};
+
+constexpr std::chrono::milliseconds EventLoop::tick;
+
+/**
+ * \brief Open a pidfd on a process, if supported by the kernel.
+ * \return pidfd, or -1.
+ */
+static int openPidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+void EventLoop::start(const CommandPtr& command)
+{
+    const std::string fullCommandStr = formatCommand(command->args);
+    const int timeout = command->deadline == std::chrono::steady_clock::time_point::max() ? 0 :
+        static_cast<int>(std::chrono::duration_cast<std::chrono::seconds>(command->deadline - std::chrono::steady_clock::now()).count());
     log_info("Running command %s(with %d seconds timeout)...", fullCommandStr.c_str(), timeout);
 
-    int ret = MlmSubprocess::output(args, stdout, stderr, timeout);
+    int out[2] = { -1, -1 };
+    int err[2] = { -1, -1 };
+    int ret = 0;
+    // Only read ends are non-blocking, children expect blocking output.
+    if (command->args.empty() || pipe2(out, O_CLOEXEC) < 0 || pipe2(err, O_CLOEXEC) < 0 ||
+        fcntl(out[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(err[0], F_SETFL, O_NONBLOCK) < 0) {
+        ret = command->args.empty() ? EINVAL : errno;
+    }
+    else {
+        // Child gets write ends of pipes as stdout and stderr (dup2() clears O_CLOEXEC) and /dev/null as stdin.
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+        // Child starts with no blocked signals and default SIGPIPE, whatever the application set.
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        sigset_t signals;
+        sigemptyset(&signals);
+        posix_spawnattr_setsigmask(&attributes, &signals);
+        sigaddset(&signals, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attributes, &signals);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+        std::vector<char *> argv;
+        for (auto& arg : command->args) {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        ret = posix_spawnp(&command->pid, argv[0], &actions, &attributes, argv.data(), environ);
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&actions);
+    }
+
+    for (int fd : { out[1], err[1] }) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    if (ret != 0) {
+        for (int fd : { out[0], err[0] }) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        log_error("Execution of command %sfailed to start: %s.", fullCommandStr.c_str(), strerror(ret));
+        command->status = CommandStatus::FailedToStart;
+        finish(*command);
+        return;
+    }
+
+    command->id = m_nextId++;
+    command->fds[0] = out[0];
+    command->fds[1] = err[0];
+    command->fds[2] = openPidfd(command->pid);
+
+    for (int i = 0; i < 3; i++) {
+        if (command->fds[i] >= 0) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = eventKey(command->id, i);
+            epoll_ctl(m_epollFd, EPOLL_CTL_ADD, command->fds[i], &event);
+        }
+    }
+    if (command->deadline != std::chrono::steady_clock::time_point::max()) {
+        m_timers.schedule(command->id, command->deadline);
+    }
+
+    m_commands.emplace(command->id, command);
+}
+
+void EventLoop::closeFd(Command& command, int index)
+{
+    if (command.fds[index] >= 0) {
+        if (index != 0 || !command.outputPaused) {
+            epoll_ctl(m_epollFd, EPOLL_CTL_DEL, command.fds[index], nullptr);
+        }
+        ::close(command.fds[index]);
+        command.fds[index] = -1;
+    }
+}
+
+void EventLoop::pauseOutput(Command& command, bool paused)
+{
+    if (command.fds[0] < 0 || command.outputPaused == paused) {
+        return;
+    }
+    // Command blocks once the pipe is full, its deadline still applies.
+    if (paused) {
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, command.fds[0], nullptr);
+    }
+    else {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = eventKey(command.id, 0);
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, command.fds[0], &event);
+    }
+    command.outputPaused = paused;
+}
+
+void EventLoop::reap(Command& command)
+{
+    int status;
+    const pid_t r = waitpid(command.pid, &status, WNOHANG);
+    if (r == 0 || (r < 0 && errno == EINTR)) {
+        return;
+    }
+
+    // Process may have been reaped behind our back (ECHILD), its status is lost then.
+    command.reaped = true;
+    command.ret = r < 0 ? -1 : WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+    closeFd(command, 2);
+}
+
+/**
+ * \brief Enforce cancellation and deadline of a command, finishing it once it has exited and closed its output.
+ */
+void EventLoop::service(Command& command, std::chrono::steady_clock::time_point now)
+{
+    if (!command.terminating && (command.cancelled || now >= command.deadline)) {
+        // Stop reading output and terminate command, escalating to SIGKILL if it doesn't comply.
+        command.status = command.cancelled ? CommandStatus::Cancelled : CommandStatus::TimedOut;
+        if (command.status == CommandStatus::TimedOut) {
+            log_warning("Command %stimed out, terminating it.", formatCommand(command.args).c_str());
+        }
+        if (!command.reaped) {
+            ::kill(command.pid, SIGTERM);
+        }
+        command.terminating = true;
+        command.killTime = now + std::chrono::seconds(1);
+        m_timers.schedule(command.id, command.killTime);
+        closeFd(command, 0);
+        closeFd(command, 1);
+    }
+    if (command.terminating && !command.killed && !command.reaped && now >= command.killTime) {
+        ::kill(command.pid, SIGKILL);
+        command.killed = true;
+    }
+
+    if (!command.reaped && command.fds[2] < 0 && command.fds[0] < 0 && command.fds[1] < 0) {
+        // Without pidfd, poll for exit of process once its output is closed.
+        reap(command);
+        if (!command.reaped) {
+            m_timers.schedule(command.id, now + tick);
+        }
+    }
+
+    if (command.reaped && command.fds[0] < 0 && command.fds[1] < 0) {
+        finish(command);
+    }
+}
+
+void EventLoop::finish(Command& command)
+{
+    if (command.status != CommandStatus::FailedToStart) {
+        const std::string fullCommandStr = formatCommand(command.args);
+        if (command.ret == 0) {
+            log_info("Execution of command %ssucceeded.", fullCommandStr.c_str());
+        }
+        else {
+            log_error("Execution of command %sfailed with code %d.", fullCommandStr.c_str(), command.ret);
+        }
+    }
+
+    // Release callbacks, they may hold the owner of the command.
+    CommandCompletion completion;
+    completion.swap(command.completion);
+    command.stdoutCallback = nullptr;
+    command.stderrCallback = nullptr;
+
+    try {
+        completion(command.status, command.ret);
+    }
+    catch (std::exception& e) {
+        log_error("Completion of command %sthrew: %s", formatCommand(command.args).c_str(), e.what());
+    }
+    catch (...) {
+        log_error("Completion of command %sthrew an exception.", formatCommand(command.args).c_str());
+    }
+
+    // Last, as this may release the command.
+    m_commands.erase(command.id);
+}
+
+void EventLoop::run()
+{
+    std::vector<CommandPtr> added;
+    std::vector<CommandPtr> cancelled;
+    std::vector<std::pair<CommandPtr, bool>> paused;
+    std::vector<uint64_t> expired;
+    struct epoll_event events[256];
+    char buffer[65536];
+
+    for (;;) {
+        bool stop;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            added.swap(m_added);
+            cancelled.swap(m_cancelled);
+            paused.swap(m_paused);
+            stop = m_stop;
+        }
+
+        for (const auto& command : added) {
+            start(command);
+        }
+        for (const auto& command : cancelled) {
+            if (m_commands.count(command->id) && m_commands[command->id] == command) {
+                service(*command, std::chrono::steady_clock::now());
+            }
+        }
+        for (const auto& request : paused) {
+            if (m_commands.count(request.first->id) && m_commands[request.first->id] == request.first) {
+                pauseOutput(*request.first, request.second);
+            }
+        }
+        added.clear();
+        cancelled.clear();
+        paused.clear();
+
+        if (stop) {
+            if (m_commands.empty()) {
+                break;
+            }
+            for (auto& command : m_commands) {
+                if (!command.second->cancelled) {
+                    command.second->cancelled = true;
+                    expired.push_back(command.first);
+                }
+            }
+        }
+
+        const int count = expired.empty() ? epoll_wait(m_epollFd, events, 256, m_timers.timeout(std::chrono::steady_clock::now())) : 0;
+        if (count < 0 && errno != EINTR) {
+            log_error("Polling output of commands failed: %s.", strerror(errno));
+        }
+
+        for (int i = 0; i < count; i++) {
+            const uint64_t key = events[i].data.u64;
+            if (key == 0) {
+                uint64_t value;
+                ssize_t r = ::read(m_wakeFd, &value, sizeof(value));
+                (void)r;
+                continue;
+            }
+
+            const auto it = m_commands.find(key >> 2);
+            if (it == m_commands.end()) {
+                continue;
+            }
+            // Hold command, finishing it may release it.
+            const CommandPtr command = it->second;
+            const int index = static_cast<int>(key & 3) - 1;
+
+            if (index == 2) {
+                reap(*command);
+            }
+            else if (command->fds[index] >= 0) {
+                const ssize_t r = ::read(command->fds[index], buffer, sizeof(buffer));
+                if (r > 0) {
+                    try {
+                        (index == 0 ? command->stdoutCallback : command->stderrCallback)(buffer, r);
+                    }
+                    catch (std::exception& e) {
+                        log_error("Output callback of command %sthrew, cancelling it: %s", formatCommand(command->args).c_str(), e.what());
+                        command->cancelled = true;
+                    }
+                    catch (...) {
+                        log_error("Output callback of command %sthrew, cancelling it.", formatCommand(command->args).c_str());
+                        command->cancelled = true;
+                    }
+                }
+                else if (r == 0 || (errno != EINTR && errno != EAGAIN)) {
+                    closeFd(*command, index);
+                }
+            }
+            service(*command, std::chrono::steady_clock::now());
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        m_timers.expire(now, expired);
+        for (uint64_t id : expired) {
+            const auto it = m_commands.find(id);
+            if (it != m_commands.end()) {
+                const CommandPtr command = it->second;
+                service(*command, now);
+            }
+        }
+        expired.clear();
+    }
+}
+
+CommandPtr runCommandAsync(
+    const MlmSubprocess::Argv& args,
+    const OutputCallback& stdoutCallback,
+    const OutputCallback& stderrCallback,
+    const CommandCompletion& completion,
+    std::chrono::steady_clock::time_point deadline)
+{
+    auto command = std::make_shared<Command>();
+    command->args = args;
+    command->stdoutCallback = stdoutCallback;
+    command->stderrCallback = stderrCallback;
+    command->completion = completion;
+    command->deadline = deadline;
+
+    EventLoop::instance().add(command);
+    return command;
+}
+
+void cancelCommand(const CommandPtr& command)
+{
+    EventLoop::instance().cancel(command);
+}
+
+void pauseCommandOutput(const CommandPtr& command, bool paused)
+{
+    EventLoop::instance().pause(command, paused);
+}
+
+int runCommand(
+    const MlmSubprocess::Argv& args,
+    std::string& stdout,
+    std::string& stderr,
+    int timeout)
+{
+    OutputBuffer output;
+    int ret = runCommand(
+        args,
+        [&output](const char *data, size_t length) { output.append(data, length); },
+        stderr,
+        timeout
+    );
+    output.appendTo(stdout);
 
     if (!stdout.empty()) {
         log_trace("Standard output:\n%s", stdout.c_str());
@@ -54,16 +773,446 @@ int runCommand(
         log_trace("Standard error:\n%s", stderr.c_str());
     }
 
-    if (ret == 0) {
-        log_info("Execution of command %ssucceeded.", fullCommandStr.c_str());
+    return ret;
+}
+
+int runCommand(
+    const MlmSubprocess::Argv& args,
+    const OutputCallback& stdoutCallback,
+    std::string& stderr,
+    int timeout)
+{
+    bool stopped;
+    return runCommandUntil(
+        args,
+        [&stdoutCallback](const char *data, size_t length) {
+            stdoutCallback(data, length);
+            return false;
+        },
+        stderr,
+        timeout,
+        stopped
+    );
+}
+
+int runCommandUntil(
+    const MlmSubprocess::Argv& args,
+    const StoppingOutputCallback& stdoutCallback,
+    std::string& stderr,
+    int timeout,
+    bool& stopped)
+{
+    // Output is queued by the event loop and consumed on this thread, so that the callback may throw.
+    // Reading output is paused while too much of it is queued, to bound memory against a slow callback.
+    static const size_t maxQueued = 1 << 20;
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<std::string> chunks;
+        size_t queued = 0;
+        OutputBuffer error;
+        CommandPtr command;
+        bool paused = false;
+        bool dropping = false;
+        bool done = false;
+        int ret = -1;
+    };
+    auto state = std::make_shared<State>();
+
+    const CommandPtr command = runCommandAsync(
+        args,
+        [state](const char *data, size_t length) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->dropping) {
+                return;
+            }
+            state->chunks.emplace_back(data, length);
+            state->queued += length;
+            if (state->queued >= maxQueued && !state->paused) {
+                // Command isn't known yet if output comes before runCommandAsync() returns, pause it then.
+                state->paused = true;
+                if (state->command) {
+                    pauseCommandOutput(state->command, true);
+                }
+            }
+            state->condition.notify_one();
+        },
+        [state](const char *data, size_t length) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->error.append(data, length);
+        },
+        [state](CommandStatus, int ret) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->ret = ret;
+            state->done = true;
+            state->condition.notify_one();
+        },
+        timeout > 0 ? std::chrono::steady_clock::now() + std::chrono::seconds(timeout) : std::chrono::steady_clock::time_point::max()
+    );
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->command = command;
+    if (state->paused) {
+        pauseCommandOutput(command, true);
     }
-    else {
-        log_error("Execution of command %sfailed with code %d.", fullCommandStr.c_str(), ret);
+
+    // Once stopped or on exception, cancel the command and drop its remaining output, rethrowing once it has finished.
+    std::exception_ptr exception;
+    stopped = false;
+    for (;;) {
+        state->condition.wait(lock, [&state]() { return state->done || !state->chunks.empty(); });
+        if (state->chunks.empty()) {
+            break;
+        }
+
+        const std::string chunk = std::move(state->chunks.front());
+        state->chunks.pop_front();
+        state->queued -= chunk.size();
+        if (state->paused && state->queued <= maxQueued / 2) {
+            state->paused = false;
+            pauseCommandOutput(command, false);
+        }
+
+        lock.unlock();
+        try {
+            stopped = stdoutCallback(chunk.data(), chunk.size());
+        }
+        catch (...) {
+            exception = std::current_exception();
+        }
+        lock.lock();
+
+        if (stopped || exception) {
+            cancelCommand(command);
+            state->dropping = true;
+            state->chunks.clear();
+            state->queued = 0;
+        }
     }
 
-    return ret;
+    state->error.appendTo(stderr);
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+    return state->ret;
 }
 
 }
 }
 }
+
+/**
+ * \brief Wait for completion of an asynchronous command.
+ */
+struct CommandOutcome
+{
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool done = false;
+    fty::nut::priv::CommandStatus status = fty::nut::priv::CommandStatus::Exited;
+    int ret = -1;
+    std::string stdout;
+
+    fty::nut::priv::CommandPtr run(const std::string& script, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+    {
+        return fty::nut::priv::runCommandAsync(
+            { "/bin/sh", "-c", script },
+            [this](const char *data, size_t length) { stdout.append(data, length); },
+            [](const char *, size_t) {},
+            [this](fty::nut::priv::CommandStatus status, int ret) {
+                std::lock_guard<std::mutex> lock(mutex);
+                this->status = status;
+                this->ret = ret;
+                done = true;
+                condition.notify_all();
+            },
+            deadline
+        );
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return done; });
+    }
+};
+
+void fty_common_nut_utils_private_test(bool verbose)
+{
+    using fty::nut::priv::CommandStatus;
+
+    std::cout << " * fty_common_nut_utils_private: ";
+
+    // Synchronous commands.
+    {
+        std::string stdout, stderr;
+        assert(fty::nut::priv::runCommand({ "/bin/sh", "-c", "echo out; echo err >&2; exit 3" }, stdout, stderr, 10) == 3);
+        assert(stdout == "out\n" && stderr == "err\n");
+
+        const auto start = std::chrono::steady_clock::now();
+        assert(fty::nut::priv::runCommand({ "/bin/sh", "-c", "echo before; exec sleep 10" }, stdout, stderr, 1) != 0);
+        assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    }
+
+    // Output callbacks throwing cancel the command, synchronous ones propagate the exception to the caller.
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::thread::id callbackThread;
+        std::string stderr;
+        bool caughtException = false;
+        try {
+            fty::nut::priv::runCommand(
+                { "/bin/sh", "-c", "echo before; exec sleep 10" },
+                [&callbackThread](const char *, size_t) {
+                    callbackThread = std::this_thread::get_id();
+                    throw std::runtime_error("stop");
+                },
+                stderr,
+                0
+            );
+        }
+        catch (std::runtime_error &e) {
+            caughtException = std::string(e.what()) == "stop";
+        }
+        assert(caughtException);
+        assert(callbackThread == std::this_thread::get_id());
+
+        CommandOutcome outcome;
+        fty::nut::priv::runCommandAsync(
+            { "/bin/sh", "-c", "echo before; exec sleep 10" },
+            [](const char *, size_t) { throw std::runtime_error("stop"); },
+            [](const char *, size_t) {},
+            [&outcome](CommandStatus status, int ret) {
+                std::lock_guard<std::mutex> lock(outcome.mutex);
+                outcome.status = status;
+                outcome.ret = ret;
+                outcome.done = true;
+                outcome.condition.notify_all();
+            },
+            std::chrono::steady_clock::time_point::max()
+        );
+        outcome.wait();
+        assert(outcome.status == CommandStatus::Cancelled);
+        assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+        // Exceptions not derived from std::exception mustn't take down the event loop.
+        CommandOutcome other;
+        fty::nut::priv::runCommandAsync(
+            { "/bin/sh", "-c", "echo before; exec sleep 10" },
+            [](const char *, size_t) { throw 42; },
+            [](const char *, size_t) {},
+            [&other](CommandStatus status, int ret) {
+                {
+                    std::lock_guard<std::mutex> lock(other.mutex);
+                    other.status = status;
+                    other.ret = ret;
+                    other.done = true;
+                    other.condition.notify_all();
+                }
+                throw 42;
+            },
+            std::chrono::steady_clock::time_point::max()
+        );
+        other.wait();
+        assert(other.status == CommandStatus::Cancelled);
+
+        CommandOutcome after;
+        after.run("echo alive");
+        after.wait();
+        assert(after.status == CommandStatus::Exited && after.stdout == "alive\n");
+        assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    }
+
+    // Many commands in flight, supervised by the event loop thread.
+    {
+        const int count = 100;
+        std::vector<CommandOutcome> outcomes(count);
+        for (int i = 0; i < count; i++) {
+            outcomes[i].run("sleep 0.2; echo " + std::to_string(i) + "; exit " + std::to_string(i % 4));
+        }
+        for (int i = 0; i < count; i++) {
+            outcomes[i].wait();
+            assert(outcomes[i].status == CommandStatus::Exited);
+            assert(outcomes[i].ret == i % 4);
+            assert(outcomes[i].stdout == std::to_string(i) + "\n");
+        }
+    }
+
+    // Cancellation and deadline.
+    {
+        CommandOutcome cancelled, timedOut, finished;
+        const auto start = std::chrono::steady_clock::now();
+        auto command = cancelled.run("echo started; exec sleep 10");
+        timedOut.run("exec sleep 10", start + std::chrono::milliseconds(200));
+        auto done = finished.run("echo done");
+
+        finished.wait();
+        fty::nut::priv::cancelCommand(command);
+        fty::nut::priv::cancelCommand(done);
+        cancelled.wait();
+        timedOut.wait();
+
+        assert(finished.status == CommandStatus::Exited && finished.ret == 0 && finished.stdout == "done\n");
+        assert(cancelled.status == CommandStatus::Cancelled && cancelled.ret != 0);
+        assert(timedOut.status == CommandStatus::TimedOut && timedOut.ret != 0);
+        assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    }
+
+    // Output larger than pipe and read buffers, commands failing to start or killed by a signal.
+    {
+        std::string stdout, stderr;
+        assert(fty::nut::priv::runCommand({ "/bin/sh", "-c", "head -c 3000000 /dev/zero | tr '\\0' a; echo err >&2" }, stdout, stderr, 10) == 0);
+        assert(stdout == std::string(3000000, 'a') && stderr == "err\n");
+
+        CommandOutcome killed;
+        killed.run("echo before; kill -9 $$");
+        killed.wait();
+        assert(killed.status == CommandStatus::Exited && killed.ret == -9 && killed.stdout == "before\n");
+
+        stdout.clear();
+        assert(fty::nut::priv::runCommand({ "/nonexistent/command" }, stdout, stderr, 10) == -1);
+        assert(fty::nut::priv::runCommand({}, stdout, stderr, 10) == -1);
+    }
+
+    // Output isn't read ahead of a slow callback, nor after it threw.
+    {
+        static const std::string marker = "src/selftest-rw/runCommand.written";
+        ::unlink(marker.c_str());
+        size_t received = 0;
+        bool blocked = false;
+        std::string stderr;
+        assert(fty::nut::priv::runCommand(
+            { "/bin/sh", "-c", "head -c 8000000 /dev/zero; touch " + marker },
+            [&received, &blocked](const char *, size_t length) {
+                if (received == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                    blocked = ::access(marker.c_str(), F_OK) != 0;
+                }
+                received += length;
+            },
+            stderr,
+            10
+        ) == 0);
+        assert(blocked);
+        assert(received == 8000000);
+        assert(::access(marker.c_str(), F_OK) == 0);
+        ::unlink(marker.c_str());
+
+        int calls = 0;
+        bool caughtException = false;
+        try {
+            fty::nut::priv::runCommand(
+                { "/bin/sh", "-c", "head -c 8000000 /dev/zero" },
+                [&calls](const char *, size_t) {
+                    calls++;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    throw std::runtime_error("stop");
+                },
+                stderr,
+                10
+            );
+        }
+        catch (std::runtime_error &) {
+            caughtException = true;
+        }
+        assert(caughtException);
+        assert(calls == 1);
+    }
+
+    // Command ended by its output callback, on the calling thread.
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::string received, stderr;
+        std::thread::id callbackThread;
+        bool stopped = false;
+        fty::nut::priv::runCommandUntil(
+            { "/bin/sh", "-c", "echo ready; sleep 1; echo late; exec sleep 10" },
+            [&received, &callbackThread](const char *data, size_t length) {
+                callbackThread = std::this_thread::get_id();
+                received.append(data, length);
+                return received.find("ready\n") != std::string::npos;
+            },
+            stderr,
+            0,
+            stopped
+        );
+        assert(stopped);
+        assert(received == "ready\n");
+        assert(callbackThread == std::this_thread::get_id());
+        assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+        received.clear();
+        assert(fty::nut::priv::runCommandUntil(
+            { "/bin/sh", "-c", "echo one; exit 3" },
+            [&received](const char *data, size_t length) {
+                received.append(data, length);
+                return false;
+            },
+            stderr,
+            10,
+            stopped
+        ) == 3);
+        assert(!stopped && received == "one\n");
+    }
+
+    // Timer wheel, with timers over more than one revolution.
+    {
+        using Clock = fty::nut::priv::TimerWheel::Clock;
+        const auto tick = std::chrono::milliseconds(10);
+        const auto step = std::chrono::milliseconds(3);
+        const auto start = Clock::now();
+        fty::nut::priv::TimerWheel wheel(tick, 64);
+
+        std::vector<Clock::time_point> times;
+        for (uint64_t id = 0; id < 500; id++) {
+            times.push_back(start + std::chrono::milliseconds(id * 7 % 1500));
+            wheel.schedule(id, times.back());
+        }
+
+        std::vector<bool> fired(times.size(), false);
+        std::vector<uint64_t> expired;
+        for (auto now = start; now < start + std::chrono::seconds(2); now += step) {
+            // Wake-up is due no later than one tick after the next timer.
+            Clock::time_point next = Clock::time_point::max();
+            for (size_t id = 0; id < times.size(); id++) {
+                if (!fired[id]) {
+                    next = std::min(next, times[id]);
+                }
+            }
+            const int timeout = wheel.timeout(now);
+            assert((timeout < 0) == (next == Clock::time_point::max()));
+            assert(timeout < 0 || now + std::chrono::milliseconds(timeout) <= std::max(now, next) + tick + std::chrono::milliseconds(1));
+
+            wheel.expire(now, expired);
+            for (uint64_t id : expired) {
+                assert(!fired[id]);
+                assert(now >= times[id] && now < times[id] + 2 * tick + step);
+                fired[id] = true;
+            }
+            expired.clear();
+        }
+        assert(std::count(fired.begin(), fired.end(), true) == static_cast<long>(times.size()));
+        assert(wheel.timeout(start) == -1);
+    }
+
+    // Synchronous commands from several threads at once.
+    {
+        std::vector<std::thread> threads;
+        std::atomic<int> succeeded(0);
+        for (int i = 0; i < 8; i++) {
+            threads.emplace_back([i, &succeeded]() {
+                std::string stdout, stderr;
+                if (fty::nut::priv::runCommand({ "/bin/echo", std::to_string(i) }, stdout, stderr, 10) == 0 && stdout == std::to_string(i) + "\n") {
+                    succeeded++;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(succeeded == 8);
+    }
+
+    std::cout << "OK" << std::endl;
+}
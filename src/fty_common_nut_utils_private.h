@@ -24,18 +24,147 @@
 
 #include "fty_common_nut_library.h"
 
+#include <chrono>
+#include <functional>
+#include <memory>
+
 namespace fty {
 namespace nut {
 namespace priv {
 
+/**
+ * \brief Callback receiving a chunk of standard output of a command.
+ */
+using OutputCallback = std::function<void(const char *data, size_t length)>;
+
+/**
+ * \brief Callback receiving a chunk of standard output of a command, returning true once no more output is needed.
+ */
+using StoppingOutputCallback = std::function<bool(const char *data, size_t length)>;
+
+/**
+ * \brief Atomically and durably replace a file with new contents.
+ *
+ * Contents are written to a unique temporary file next to the destination,
+ * synced and renamed over it, and the directory is synced, so readers and
+ * concurrent writers see either the old or a complete new file, even after a
+ * crash. Permissions and ownership of the replaced file are kept, a new file
+ * gets 0666 minus the umask.
+ *
+ * \param path Path of file.
+ * \param data Contents of file.
+ * \param length Length of contents.
+ * \throw std::runtime_error if the file can't be written.
+ */
+void writeFileAtomically(const std::string& path, const char *data, size_t length);
+
+/**
+ * \brief Outcome of a command run asynchronously.
+ */
+enum class CommandStatus
+{
+    Exited,
+    FailedToStart,
+    TimedOut,
+    Cancelled
+};
+
+/**
+ * \brief Callback fired once a command has finished, with its return code.
+ */
+using CommandCompletion = std::function<void(CommandStatus status, int ret)>;
+
+class Command;
+using CommandPtr = std::shared_ptr<Command>;
+
+/**
+ * \brief Run a command on the event loop of the library, without blocking.
+ *
+ * The event loop is a single thread owned by the library, supervising all
+ * commands in flight. Callbacks are fired from that thread, so they must not
+ * block nor wait for another command. An output callback throwing cancels the
+ * command.
+ *
+ * \param args Command to run.
+ * \param stdoutCallback Callback fired for each chunk of standard output.
+ * \param stderrCallback Callback fired for each chunk of standard error.
+ * \param completion Callback fired once the command has finished.
+ * \param deadline Time after which the command is terminated (time_point::max() for none).
+ * \return Handle of command, to cancel it.
+ */
+CommandPtr runCommandAsync(
+    const MlmSubprocess::Argv& args,
+    const OutputCallback& stdoutCallback,
+    const OutputCallback& stderrCallback,
+    const CommandCompletion& completion,
+    std::chrono::steady_clock::time_point deadline);
+
+/**
+ * \brief Cancel a command, terminating it if it is running.
+ *
+ * Completion is fired with CommandStatus::Cancelled, unless the command had
+ * already finished.
+ */
+void cancelCommand(const CommandPtr& command);
+
+/**
+ * \brief Stop or resume reading standard output of a command.
+ *
+ * While paused, the command blocks once its output pipe is full. Its
+ * deadline and cancellation still apply.
+ */
+void pauseCommandOutput(const CommandPtr& command, bool paused);
+
 int runCommand(
     const MlmSubprocess::Argv& args,
     std::string& stdout,
     std::string& stderr,
     int timeout);
 
+/**
+ * \brief Run a command, streaming its standard output as it is produced.
+ *
+ * The callback is fired on the calling thread, at most about 1 MiB of output
+ * is read ahead of it. If it throws, the command is cancelled, its remaining
+ * output is dropped and the exception is rethrown once it has finished.
+ *
+ * \param args Command to run.
+ * \param stdoutCallback Callback fired for each chunk of standard output.
+ * \param stderr Standard error of the command.
+ * \param timeout Timeout in seconds after which the command is terminated (0 for none).
+ * \return Return code of the command.
+ */
+int runCommand(
+    const MlmSubprocess::Argv& args,
+    const OutputCallback& stdoutCallback,
+    std::string& stderr,
+    int timeout);
+
+/**
+ * \brief Run a command, streaming its standard output until the callback has all it needs.
+ *
+ * Same as runCommand(), except that the command is cancelled and its
+ * remaining output dropped as soon as the callback returns true.
+ *
+ * \param args Command to run.
+ * \param stdoutCallback Callback fired for each chunk of standard output.
+ * \param stderr Standard error of the command.
+ * \param timeout Timeout in seconds after which the command is terminated (0 for none).
+ * \param stopped Set to true if the command was ended by the callback.
+ * \return Return code of the command (meaningless if stopped).
+ */
+int runCommandUntil(
+    const MlmSubprocess::Argv& args,
+    const StoppingOutputCallback& stdoutCallback,
+    std::string& stderr,
+    int timeout,
+    bool& stopped);
+
 }
 }
 }
 
+//  Self test of this class
+FTY_COMMON_NUT_PRIVATE void fty_common_nut_utils_private_test(bool verbose);
+
 #endif